@@ -39,4 +39,35 @@ void accelDisable();
 void accelReading(uint16_t *x, uint16_t *y, uint16_t *z);
 void accelReadingBuf(uint8_t *buf);
 
+#ifdef ACCEL_DMA
+/**
+ * Set up DMA1 channels 2 and 3 for SPI1 sample reads and enable the
+ * channel 2 transfer complete interrupt
+ */
+void accelDmaInit();
+
+/**
+ * Stop the sample DMA channels and their clock
+ */
+void accelDmaShutdown();
+
+/**
+ * Start reading a sample (6 bytes, high byte first) into buf by DMA, the
+ * DMA1 channel 2 interrupt signals the end of the transfer. buf must stay
+ * valid until then.
+ */
+void accelReadingDmaStart(uint8_t *buf);
+
+/**
+ * Finish the sample read, called from the DMA1 channel 2 interrupt
+ */
+void accelReadingDmaEnd();
+
+/**
+ * Returns whether a sample read is in flight, the SPI and DMA clocks must
+ * keep running (sleep rather than stop mode) until it ends
+ */
+uint8_t accelDmaBusy();
+#endif
+
 #endif //__ACCEL_H
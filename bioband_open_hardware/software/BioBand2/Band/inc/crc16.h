@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CWA_CRC16_H
+#define _CWA_CRC16_H
+
+#include "shared.h"
+
+/*
+ * Modbus style CRC16 used to validate the sample data of each flash page.
+ * 
+ * The band build (MRC_CWA defined) uses the byte at a time table lookup on
+ * table_crc_hi/table_crc_lo, the PC build uses slicing-by-8 tables derived
+ * from the same tables. Both give bit identical results.
+ */
+
+#define CRC16_INITIAL_VALUE 0xFF
+
+/*
+ * Build the slicing tables if not already done. Only required on the PC and
+ * called automatically by crc16Update, but should be invoked before starting
+ * any threads that may use the crc.
+ */
+void crc16Init(void);
+
+/*
+ * Continue a crc calculation over len bytes of data. Start with both crc_hi
+ * and crc_lo set to CRC16_INITIAL_VALUE.
+ */
+void crc16Update(uint8_t* crc_hi, uint8_t* crc_lo, const uint8_t* data,
+	uint32_t len);
+
+#endif // _CWA_CRC16_H
@@ -59,12 +59,17 @@ int resetIfOurBadBlock(uint16_t aBlock);
 void resetAllValidBlocks();
 
 int resetWriteIterator();
-int writeFirstHalfPageToFlash();
-int writeFinalHalfPageToFlash();
+int writeFirstHalfPageToFlash(const uint8_t* aPage);
+int writeFinalHalfPageToFlash(const uint8_t* aPage);
+void eraseAheadTask();
+void setCompressedPages(bool aCompressed);
 
 int resetReadIterator();
 int readPageToMemory(bool* aDataEnd);
+int readPageToBuffer(uint8_t* aBuffer, bool* aDataEnd);
+int readNextPageToBuffer(uint8_t* aBuffer, uint8_t* aPageAddr);
 
+int seekLogicalPage(uint32_t pagenum);
 int readLogicalPage(uint16_t pagenum);
 
 int doesDataExist();
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "stm32f10x.h"
+#include "shared.h"
+
+/**
+ * Start the core cycle counter, profileStart & profileEnd then time the
+ * profile_path hot paths
+ */
+void profileInit();
+
+/**
+ * Returns the cycle count to pass to profileEnd
+ */
+uint32_t profileStart();
+
+/**
+ * Add the cycles since aStart to the stats of aPath
+ */
+void profileEnd(profile_path aPath, uint32_t aStart);
+
+/**
+ * Copy the stats of aPath to aBuffer (PROFILE_STATS_SIZE bytes, see
+ * encodeProfileStats), optionally clearing them
+ * \return 0 indicates successful completion, < 0 if aPath is unknown
+ */
+int profileReport(uint8_t aPath, uint8_t* aBuffer, uint8_t aClear);
+
+#endif //__PROFILE_H
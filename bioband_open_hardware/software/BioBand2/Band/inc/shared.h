@@ -81,6 +81,7 @@
 #define EPOC_TIME_SIZE		4
 #define ACCEL_CONFIG_SIZE	1
 #define VERSION_SIZE		1
+#define OVERRUN_COUNT_SIZE	2
 
 // Spare area addresses (all pages)
 #define BAD_BLOCK_ADDR		PAGE_SIZE
@@ -106,6 +107,9 @@
 #define END_SAMPLES_ADDR	(END_TICK_ADDR + BIOBAND_TICK_SIZE)
 #define ACTION_EPOC_ADDR	(END_SAMPLES_ADDR + MAX_SAMPLES_SIZE)
 
+// Spare area address (all pages with OVERRUN_COUNT_MASK set, after the debug)
+#define OVERRUN_COUNT_ADDR	(FLASH_PAGE - OVERRUN_COUNT_SIZE)
+
 // Using 01 to distinguish from Hynix bad block marker (x00)
 #define OUR_BAD_BLOCK_INDICATOR	0x01
 #define VALID_BLOCK_INDICATOR	0xff
@@ -126,11 +130,49 @@
 #define COLLECT_LOSS_MASK		0xEF
 #define COLLECT_OK_MASK			0x10
 
+// Bit 5  [1 = compressed page, 0 = raw samples]
+#define COMPRESSED_MASK			0x20
+
+// Bit 6  [1 = samples dropped so far stored at OVERRUN_COUNT_ADDR]
+#define OVERRUN_COUNT_MASK		0x40
+
+// ----
+
+// Compressed page format
+//
+// The first PACKED_DATA_SIZE bytes of the page are a bit stream (msb first)
+// holding the first sample as three 16 bit values followed by groups of
+// PACK_GROUP_SAMPLES samples. Each group holds the x,y,z deltas from the
+// previous sample, shifted right by the low bits which are zero for every
+// delta in the group, zig-zag encoded and packed at the width of the largest
+// value for each axis:
+//   [4 bit shift][5 bit x width][5 bit y width][5 bit z width]
+//   [x][y][z] .. repeated for each sample in the group
+// The sample count (big-endian) follows the bit stream, then the usual crc.
+
+#define PACK_GROUP_SAMPLES		8
+#define PACK_SHIFT_BITS			4
+#define PACK_WIDTH_BITS			5
+#define PACKED_DATA_SIZE		2044
+#define PACKED_COUNT_ADDR		PACKED_DATA_SIZE
+
+// Widest group, every value at 16 bits
+#define PACK_MAX_GROUP_BITS		(PACK_SHIFT_BITS + 3 * PACK_WIDTH_BITS + \
+	PACK_GROUP_SAMPLES * 3 * 16)
+
+// Every group is all zero deltas
+#define MAX_SAMPLES_PER_PAGE	(1 + PACK_GROUP_SAMPLES * \
+	((PACKED_DATA_SIZE * 8 - 48) / (PACK_SHIFT_BITS + 3 * PACK_WIDTH_BITS)))
+
 // ----
 
 // 4 spaces and two data bytes (i.e 00dd00) at start of page
 #define PAGE_LEADER				6
 
+// Streamed raw downloads (STREAM_RAW_CHAR) send the leader & page contents
+// back to back in full size bulk packets, only the final packet is short
+#define STREAM_PACKET_SIZE		64
+
 // ----
 
 #define OK_MSG "OK"
@@ -149,7 +191,7 @@
 // ----
 
 #ifndef LINUX
-#pragma pack(1)
+#pragma pack(push, 1)
 #endif
 
 struct config_info {
@@ -172,6 +214,10 @@ struct config_info {
 };
 #endif
 
+#ifndef LINUX
+#pragma pack(pop)
+#endif
+
 typedef enum _cwa_mode
 {
 	CWA_UNKNOWN_MODE,
@@ -214,6 +260,9 @@ typedef enum _cwa_mode
 #define SET_FIRST_DOWNLD_CHAR	'J'
 #define GET_FIRST_DOWNLD_CHAR	'j'
 #define GET_IS_COMPLETE_CHAR	'C'
+#define STREAM_RAW_CHAR			'Q'
+#define GET_PROFILE_CHAR		'P'
+#define READ_RAW_FROM_CHAR		'O'
 
 // Table of CRC values for high-order byte
 extern uint8_t table_crc_hi[256];
@@ -238,9 +287,77 @@ typedef enum _accel_g_scale
 	CWA_8G = 0x30
 } accel_g_scale;
 
+// Accel config byte, bits 0-3 data rate, bits 4-6 g scale & bit 7 set to
+// store compressed pages
+#define ACCEL_DR_MASK		0x0F
+#define ACCEL_GS_MASK		0x70
+#define ACCEL_COMPRESS_MASK	0x80
+
 uint8_t encodeRateAndGscale(accel_data_rate rate, accel_g_scale scale);
 int decodeRateAndGscale(uint8_t byte, accel_data_rate* rate,
 	accel_g_scale* scale);
+
+// Compressed page encoder, the samples are packed into the page as they
+// arrive so the first half can be written while the rest is filled
+
+#define PACK_NONE		0
+#define PACK_PAGE_FULL	1
+
+struct page_packer {
+	uint8_t* page;
+	// page started when the current one is full, the same page by default
+	uint8_t* next_page;
+	uint16_t bit_pos;
+	uint16_t num_samples;
+	uint8_t group_count;
+	int16_t last[3];
+	int16_t group[PACK_GROUP_SAMPLES][3];
+};
+
+void packerReset(struct page_packer* aPacker, uint8_t* aPage);
+uint8_t packerAddSample(struct page_packer* aPacker, const uint8_t* aSample);
+
+#ifndef MRC_CWA
+int unpackPage(const uint8_t* aPage, uint8_t* aSamples, int aMaxSamples);
+#endif
+
+// Cycle count profile of the band's hot paths (see profile.c)
+
+typedef enum _profile_path
+{
+	PROF_ACCEL_INTR,
+	PROF_PROGRAM_PAGE,
+	PROF_ERASE_BLOCK,
+	PROF_READ_PAGE,
+	PROFILE_NUM_PATHS
+} profile_path;
+
+// Bucket 0 counts durations of less than 2^PROFILE_FIRST_BUCKET_BITS cycles,
+// each following bucket covers another PROFILE_BUCKET_BITS bits and the last
+// is open ended
+#define PROFILE_BUCKETS				8
+#define PROFILE_FIRST_BUCKET_BITS	10
+#define PROFILE_BUCKET_BITS			2
+
+struct profile_stats {
+	uint32_t count;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t total_cycles;
+	uint16_t buckets[PROFILE_BUCKETS];
+};
+
+// GET_PROFILE_CHAR is followed by the path, or'd with PROFILE_CLEAR_FLAG to
+// clear its stats once read. The reply is the big endian count, min, max,
+// total (8 bytes) & buckets followed by the core clock in Hz (4 bytes)
+#define PROFILE_CLEAR_FLAG		0x80
+#define PROFILE_STATS_SIZE		(20 + 2 * PROFILE_BUCKETS)
+#define PROFILE_REPLY_SIZE		(PROFILE_STATS_SIZE + 4)
+
+void encodeProfileStats(const struct profile_stats* aStats, uint8_t* aBuffer);
+#ifndef MRC_CWA
+void decodeProfileStats(const uint8_t* aBuffer, struct profile_stats* aStats);
+#endif
 	
 #define FW_VER_BITS		5
 #define FW_MASK			0x1F
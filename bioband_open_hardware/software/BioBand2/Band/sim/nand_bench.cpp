@@ -0,0 +1,618 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Benchmark of the band storage layer (nand_cwa.c) running against the host
+ * NAND simulator. Reports the GPIO bus cycles (register accesses), NAND
+ * command/address/data cycles and modelled array busy time for:
+ * 
+ *  - each page written by collect() (first + final half page writes)
+ *  - a findNextUsedBlock2 scan (findFirstUsedBlock over leading bad blocks)
+ *  - building the block map (first resetReadIterator) and the scan again with
+ *    the map held
+ *  - each page of a full read-back (resetReadIterator/readPageToMemory) and
+ *    of a streamed read-back (readNextPageToBuffer), also resumed from the
+ *    middle of the capture (seekLogicalPage)
+ *  - random page reads (readLogicalPage) and the battery level scan
+ * 
+ * The band's own cycle profile (profile.c, counting bus cycles here) of the
+ * program, erase & read paths over those runs is then read back through the
+ * GET_PROFILE_CHAR encoding and checked against the pages written.
+ * 
+ * A second, smaller run injects program & erase failures and checks every
+ * page still reads back in sequence. A third writes compressed pages (as
+ * collect() does with ACCEL_COMPRESS_MASK set) and checks they unpack. A
+ * fourth compares the erases left in the page writes with and without the
+ * erase ahead (eraseAheadTask) running between them. A fifth run checks the
+ * sample overrun count & loss flag stored in each page's spare area, and a
+ * last one that a block map with too many partial blocks is not rebuilt for
+ * every read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stm32f10x.h"
+#include "shared.h"
+#include "nand_cwa.h"
+#include "nand_sim.h"
+#include "profile.h"
+
+#define DEFAULT_BLOCKS 64
+#define DEFAULT_LEADING_BAD 16
+#define SCAN_REPEATS 100
+#define LOGICAL_READS 256
+#define PACKED_SAMPLES 100000
+
+extern uint8_t data_values[FLASH_PAGE];
+extern uint32_t start_page_tick;
+extern volatile uint16_t sample_overruns;
+
+static void fillPage(uint32_t aPageNum) {
+	uint16_t loop;
+	for (loop = 0; loop < PAGE_SIZE; loop++) {
+		data_values[loop] = (uint8_t) (aPageNum * 7 + loop * 13);
+	}
+	start_page_tick = aPageNum;
+}
+
+static bool checkPage(uint32_t aPageNum) {
+	uint32_t tick;
+	uint16_t loop;
+	
+	memcpy(&tick, data_values + CURRENT_TICK_ADDR, BIOBAND_TICK_SIZE);
+	if (tick != aPageNum)
+		return false;
+	for (loop = 0; loop < PAGE_SIZE; loop++) {
+		if (data_values[loop] != (uint8_t) (aPageNum * 7 + loop * 13))
+			return false;
+	}
+	return true;
+}
+
+static uint32_t writePages(uint32_t aNumPages) {
+	uint32_t loop;
+	for (loop = 0; loop < aNumPages; loop++) {
+		fillPage(loop);
+		if (writeFirstHalfPageToFlash(data_values) ||
+				writeFinalHalfPageToFlash(data_values))
+			break;
+	}
+	return loop;
+}
+
+static uint32_t readBack(uint32_t* aErrors) {
+	uint32_t pages = 0;
+	
+	*aErrors = 0;
+	if (resetReadIterator())
+		return 0;
+	
+	while (1) {
+		bool data_end = 0;
+		int ret = readPageToMemory(&data_end);
+		if (data_end || -2 == ret)
+			break;
+		if (!checkPage(pages)) {
+			if (*aErrors < 10)
+				printf("Page %u did not read back correctly\n", pages);
+			(*aErrors)++;
+		}
+		pages++;
+		if (ret)
+			// Last used block finished
+			break;
+	}
+	return pages;
+}
+
+static uint32_t streamBack(uint32_t aFirstPage, uint32_t* aErrors) {
+	uint32_t pages = aFirstPage - 1;
+	uint8_t page_addr;
+	
+	if (resetReadIterator())
+		return 0;
+	if ((aFirstPage > 1) && seekLogicalPage(aFirstPage))
+		return 0;
+	
+	while (!readNextPageToBuffer(data_values, &page_addr)) {
+		if (!checkPage(pages)) {
+			if (*aErrors < 10)
+				printf("Streamed page %u did not read back correctly\n", pages);
+			(*aErrors)++;
+		}
+		pages++;
+	}
+	return pages - (aFirstPage - 1);
+}
+
+static uint32_t checkLogicalPages(uint32_t aNumPages, uint32_t aStep,
+	uint32_t* aErrors) {
+	uint32_t pagenum, reads = 0;
+	
+	for (pagenum = 1; pagenum <= aNumPages; pagenum += aStep) {
+		if (readLogicalPage(pagenum) || !checkPage(pagenum - 1)) {
+			if (*aErrors < 10)
+				printf("Logical page %u did not read back correctly\n", pagenum);
+			(*aErrors)++;
+		}
+		reads++;
+	}
+	// One past the end must fail
+	if (!readLogicalPage(aNumPages + 1))
+		(*aErrors)++;
+	return reads + 1;
+}
+
+static uint32_t readBatteryLevels() {
+	uint16_t block = 0;
+	uint32_t levels = 0;
+	unsigned int number;
+	
+	while (block < MAX_BLOCKS) {
+		number = readNextSetOfBatteryLevels(64, &block);
+		if (!number)
+			break;
+		levels += number / BATTERY_LEVEL_SIZE;
+	}
+	return levels;
+}
+
+static void report(const char* aName, uint64_t aOps, double aSecs) {
+	struct nand_sim_counters c;
+	double ops = aOps ? (double) aOps : 1;
+	
+	nandSimGetCounters(&c);
+	printf("%-10s %7llu ops  bus %9.1f  nand %7.1f (cmd %.1f addr %.1f "
+		"in %.1f out %.1f)  array %8.1f us  host %.3f s\n", aName,
+		(unsigned long long) aOps, nandSimBusCycles(&c) / ops,
+		(c.cmd_cycles + c.addr_cycles + c.data_in_cycles + c.data_out_cycles) /
+		ops, c.cmd_cycles / ops, c.addr_cycles / ops, c.data_in_cycles / ops,
+		c.data_out_cycles / ops, c.array_busy_ns / ops / 1000, aSecs);
+	if (c.protocol_errors)
+		printf("%-10s %llu protocol errors!\n", aName,
+			(unsigned long long) c.protocol_errors);
+}
+
+static double secsSince(clock_t aStart) {
+	return (double) (clock() - aStart) / CLOCKS_PER_SEC;
+}
+
+static int checkProfile(uint32_t aWritten) {
+	const char* names[PROFILE_NUM_PATHS] = {"accel", "program", "erase",
+		"read"};
+	uint8_t reply[PROFILE_STATS_SIZE];
+	struct profile_stats stats;
+	uint32_t bucket_total;
+	uint8_t path, loop;
+	int failed = 0;
+	
+	for (path = PROF_PROGRAM_PAGE; path < PROFILE_NUM_PATHS; path++) {
+		if (profileReport(path, reply, 1))
+			return 1;
+		decodeProfileStats(reply, &stats);
+		bucket_total = 0;
+		for (loop = 0; loop < PROFILE_BUCKETS; loop++)
+			bucket_total += stats.buckets[loop];
+		if (!stats.count || (stats.min_cycles > stats.max_cycles) ||
+				(bucket_total != stats.count))
+			failed = 1;
+		// Every page is programmed as two halves
+		if ((PROF_PROGRAM_PAGE == path) && (stats.count != 2 * aWritten))
+			failed = 1;
+		printf("profile %-8s %6u ops  bus min %u mean %.1f max %u\n",
+			names[path], stats.count, stats.min_cycles, stats.count ?
+			(double) stats.total_cycles / stats.count : 0, stats.max_cycles);
+	}
+	
+	// Cleared by the reads above, unknown paths refused
+	profileReport(PROF_PROGRAM_PAGE, reply, 0);
+	decodeProfileStats(reply, &stats);
+	if (stats.count || !profileReport(PROFILE_NUM_PATHS, reply, 0))
+		failed = 1;
+	
+	printf("Profile check: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
+
+static int checkFaultRecovery() {
+	const uint32_t num_pages = 8 * MAX_PAGES_PER_BLOCK;
+	struct nand_sim_counters c;
+	uint32_t written, read, errors, logical_errors = 0;
+	
+	nandSimReset();
+	nandSimSetFactoryBadBlock(2);
+	nandSimFailProgram(3, 10);	// second half of a page after the first
+	nandSimFailErase(5);
+	nandSimFailProgram(7, 0);	// first page of a freshly erased block
+	nandSimFailProgram(9, 63);	// last page in a block
+	
+	nand_cwa_init();
+	if (resetWriteIterator())
+		return 1;
+	written = writePages(num_pages);
+	read = readBack(&errors);
+	checkLogicalPages(written, 1, &logical_errors);
+	nandSimGetCounters(&c);
+	errors += logical_errors;
+	
+	printf("Fault recovery check: %s (%u written, %u read back, %llu program "
+		"& %llu erase fails, %llu protocol errors)\n",
+		(written == num_pages && read == written && !errors &&
+		!c.protocol_errors) ? "ok" : "FAILED", written, read,
+		(unsigned long long) c.program_fails,
+		(unsigned long long) c.erase_fails,
+		(unsigned long long) c.protocol_errors);
+	
+	return (written == num_pages && read == written && !errors &&
+		!c.protocol_errors) ? 0 : 1;
+}
+
+// More blocks marked part way through than the block map holds, the map is
+// given up on until the flash changes rather than rebuilt for every read
+static int checkMapOverflow() {
+	const uint32_t num_blocks = 24;
+	struct nand_sim_counters first, second;
+	uint32_t loop, written, read, errors;
+	
+	nandSimReset();
+	for (loop = 0; loop < num_blocks; loop++)
+		nandSimFailProgram(loop, 10);
+	
+	nand_cwa_init();
+	if (resetWriteIterator())
+		return 1;
+	written = writePages(num_blocks * MAX_PAGES_PER_BLOCK / 2);
+	
+	nandSimClearCounters();
+	if (resetReadIterator())
+		return 1;
+	nandSimGetCounters(&first);
+	nandSimClearCounters();
+	if (resetReadIterator())
+		return 1;
+	nandSimGetCounters(&second);
+	read = readBack(&errors);
+	
+	bool ok = (read == written) && !errors &&
+		(second.page_reads < first.page_reads);
+	printf("Map overflow check: %s (%llu -> %llu page reads to start a read, "
+		"%u read back)\n", ok ? "ok" : "FAILED",
+		(unsigned long long) first.page_reads,
+		(unsigned long long) second.page_reads, read);
+	return ok ? 0 : 1;
+}
+
+// Writes as collect() does, optionally with eraseAheadTask on the idle wake
+// ups between half page writes, noting the erases & array time inside writes
+static uint32_t writePagesIdle(uint32_t aNumPages, bool aAhead,
+	uint64_t* aWriteErases, uint64_t* aMaxWriteNs) {
+	struct nand_sim_counters before, after;
+	uint32_t loop;
+	int half, idle, ret;
+	
+	*aWriteErases = 0;
+	*aMaxWriteNs = 0;
+	for (loop = 0; loop < aNumPages; loop++) {
+		fillPage(loop);
+		for (half = 0; half < 2; half++) {
+			for (idle = 0; aAhead && idle < 4; idle++)
+				eraseAheadTask();
+			nandSimGetCounters(&before);
+			ret = half ? writeFinalHalfPageToFlash(data_values) :
+				writeFirstHalfPageToFlash(data_values);
+			nandSimGetCounters(&after);
+			if (ret)
+				return loop;
+			*aWriteErases += (after.block_erases - before.block_erases) +
+				(after.erase_fails - before.erase_fails);
+			if (after.array_busy_ns - before.array_busy_ns > *aMaxWriteNs)
+				*aMaxWriteNs = after.array_busy_ns - before.array_busy_ns;
+		}
+	}
+	return loop;
+}
+
+static int checkEraseAhead() {
+	const uint32_t num_pages = 8 * MAX_PAGES_PER_BLOCK;
+	struct nand_sim_counters c;
+	uint64_t erases[2], max_ns[2];
+	uint32_t written, read, errors = 0;
+	int run, failed = 0;
+	
+	for (run = 0; run < 2; run++) {
+		nandSimReset();
+		nandSimSetFactoryBadBlock(4);
+		nandSimFailErase(6);
+		
+		nand_cwa_init();
+		if (resetWriteIterator())
+			return 1;
+		written = writePagesIdle(num_pages, run, &erases[run], &max_ns[run]);
+		read = readBack(&errors);
+		nandSimGetCounters(&c);
+		if (written != num_pages || read != written || errors ||
+				c.protocol_errors)
+			failed = 1;
+	}
+	// The erase ahead leaves no erase in the writes
+	if (erases[1] || max_ns[1] >= max_ns[0])
+		failed = 1;
+	
+	printf("Erase ahead check: %s (erases in writes %llu -> %llu, max write "
+		"array time %.1f -> %.1f us)\n", failed ? "FAILED" : "ok",
+		(unsigned long long) erases[0], (unsigned long long) erases[1],
+		max_ns[0] / 1000.0, max_ns[1] / 1000.0);
+	return failed;
+}
+
+static int checkOverrunCount() {
+	const uint32_t num_pages = 2 * MAX_PAGES_PER_BLOCK;
+	const uint32_t overrun_page = MAX_PAGES_PER_BLOCK + 5;
+	uint32_t loop, errors = 0;
+	uint16_t count;
+	uint8_t status;
+	
+	nandSimReset();
+	nand_cwa_init();
+	if (resetWriteIterator())
+		return 1;
+	
+	// Samples dropped while filling one page
+	sample_overruns = 0;
+	for (loop = 0; loop < num_pages; loop++) {
+		if (loop == overrun_page)
+			sample_overruns = 3;
+		fillPage(loop);
+		if (writeFirstHalfPageToFlash(data_values) ||
+				writeFinalHalfPageToFlash(data_values))
+			return 1;
+	}
+	sample_overruns = 0;
+	
+	if (resetReadIterator())
+		return 1;
+	for (loop = 0; loop < num_pages; loop++) {
+		bool data_end = 0;
+		readPageToMemory(&data_end);
+		status = data_values[PAGE_STATUS_ADDR];
+		memcpy(&count, data_values + OVERRUN_COUNT_ADDR, OVERRUN_COUNT_SIZE);
+		if (!checkPage(loop) || !(status & OVERRUN_COUNT_MASK) ||
+				(count != ((loop < overrun_page) ? 0 : 3)) ||
+				(!(status & COLLECT_OK_MASK) != (loop == overrun_page)))
+			errors++;
+	}
+	
+	printf("Overrun count check: %s (%u pages, %u errors)\n",
+		errors ? "FAILED" : "ok", num_pages, errors);
+	return errors ? 1 : 0;
+}
+
+static void fillSample(uint32_t aNum, uint8_t* aSample) {
+	
+	// Slow movement plus a couple of lsbs of noise, 12 bits left justified as
+	// the accelerometer gives
+	
+	uint8_t axis;
+	for (axis = 0; axis < 3; axis++) {
+		int32_t val = (int32_t) ((aNum / 4 + axis * 300) % 1024) - 512;
+		val += (int32_t) ((aNum * 2654435761u + axis) >> 29) - 4;
+		aSample[axis * 2] = (uint16_t) (val << 4) >> 8;
+		aSample[axis * 2 + 1] = (uint16_t) (val << 4) & 0xff;
+	}
+}
+
+static int checkCompressedPages() {
+	struct page_packer packer;
+	static uint8_t unpacked[MAX_SAMPLES_PER_PAGE * BYTES_PER_SAMPLE];
+	uint8_t sample[BYTES_PER_SAMPLE];
+	uint32_t loop, pages = 0, checked = 0, errors = 0;
+	bool half = 0;
+	
+	nandSimReset();
+	nand_cwa_init();
+	if (resetWriteIterator())
+		return 1;
+	
+	// Pack & write the halves as the accelerometer interrupt & collect() do
+	setCompressedPages(1);
+	packerReset(&packer, data_values);
+	for (loop = 0; loop < PACKED_SAMPLES; loop++) {
+		fillSample(loop, sample);
+		if (PACK_PAGE_FULL == packerAddSample(&packer, sample)) {
+			if (!half || writeFinalHalfPageToFlash(data_values))
+				errors++;
+			half = 0;
+			pages++;
+		}
+		if (!half && ((packer.bit_pos >> 3) >= SAMPLE_HALF_PAGE)) {
+			if (writeFirstHalfPageToFlash(data_values))
+				errors++;
+			half = 1;
+		}
+	}
+	setCompressedPages(0);
+	
+	// Read back & unpack
+	if (resetReadIterator())
+		return 1;
+	while (1) {
+		bool data_end = 0;
+		int num, ret = readPageToMemory(&data_end);
+		if (data_end || -2 == ret)
+			break;
+		num = (data_values[PAGE_STATUS_ADDR] & COMPRESSED_MASK) ?
+			unpackPage(data_values, unpacked, MAX_SAMPLES_PER_PAGE) : -1;
+		if (num <= 0) {
+			errors++;
+		} else {
+			int idx;
+			for (idx = 0; idx < num; idx++) {
+				fillSample(checked++, sample);
+				if (memcmp(sample, unpacked + idx * BYTES_PER_SAMPLE,
+						BYTES_PER_SAMPLE))
+					errors++;
+			}
+		}
+		if (ret)
+			break;
+	}
+	
+	printf("Compressed page check: %s (%u pages, %.1f samples per page, "
+		"raw %d)\n", (checked && !errors) ? "ok" : "FAILED", pages,
+		pages ? (double) checked / pages : 0.0, SAMPLES_PER_PAGE);
+	
+	return (checked && !errors) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t num_blocks = DEFAULT_BLOCKS;
+	uint32_t leading_bad = DEFAULT_LEADING_BAD;
+	uint32_t num_pages, written, read, errors, loop, ops;
+	struct nand_identity id;
+	clock_t start;
+	int failed = 0;
+	
+	if (argc > 1)
+		num_blocks = atoi(argv[1]);
+	if (argc > 2)
+		leading_bad = atoi(argv[2]);
+	if (!num_blocks || (num_blocks + leading_bad) >= MAX_BLOCKS) {
+		printf("usage: %s [blocks to write, default %d] "
+			"[leading bad blocks, default %d]\n", argv[0], DEFAULT_BLOCKS,
+			DEFAULT_LEADING_BAD);
+		return 1;
+	}
+	num_pages = num_blocks * MAX_PAGES_PER_BLOCK;
+	
+	nandSimReset();
+	for (loop = 0; loop < leading_bad; loop++)
+		nandSimSetFactoryBadBlock(loop);
+	
+	nand_cwa_init();
+	profileInit();
+	readDeviceId(&id);
+	if (0xAD != id.maker || 0xDC != id.device) {
+		printf("Unexpected device id %02x %02x\n", id.maker, id.device);
+		return 1;
+	}
+	
+	printf("%u blocks (%u pages), %u leading bad blocks\n", num_blocks,
+		num_pages, leading_bad);
+	
+	// Write
+	if (resetWriteIterator()) {
+		printf("No valid blocks\n");
+		return 1;
+	}
+	nandSimClearCounters();
+	start = clock();
+	written = writePages(num_pages);
+	report("write", written, secsSince(start));
+	
+	// Scan for the first used block
+	nandSimClearCounters();
+	start = clock();
+	for (loop = 0; loop < SCAN_REPEATS; loop++) {
+		uint8_t last_page;
+		if (findFirstUsedBlock(&last_page) != leading_bad)
+			failed = 1;
+	}
+	report("scan", SCAN_REPEATS, secsSince(start));
+	report("scan/blk", SCAN_REPEATS * (leading_bad + 1), 0);
+	
+	// Block map build, then the same scan from the map
+	nandSimClearCounters();
+	start = clock();
+	if (resetReadIterator())
+		failed = 1;
+	report("map", 1, secsSince(start));
+	
+	nandSimClearCounters();
+	start = clock();
+	for (loop = 0; loop < SCAN_REPEATS; loop++) {
+		uint8_t last_page;
+		if (findFirstUsedBlock(&last_page) != leading_bad)
+			failed = 1;
+	}
+	report("scan map", SCAN_REPEATS, secsSince(start));
+	
+	// Read back
+	nandSimClearCounters();
+	start = clock();
+	read = readBack(&errors);
+	report("read", read, secsSince(start));
+	
+	// Streamed read back, includes the final page of a full last block
+	nandSimClearCounters();
+	start = clock();
+	ops = streamBack(1, &errors);
+	report("stream", ops, secsSince(start));
+	if (ops != written)
+		failed = 1;
+	
+	// Streamed read back of only the second half (READ_RAW_FROM_CHAR)
+	nandSimClearCounters();
+	start = clock();
+	loop = written / 2 + 3;
+	ops = streamBack(loop, &errors);
+	report("resume", ops, secsSince(start));
+	if (ops != written - (loop - 1))
+		failed = 1;
+	
+	// Random page reads
+	nandSimClearCounters();
+	start = clock();
+	ops = checkLogicalPages(written, written / LOGICAL_READS + 1, &errors);
+	report("logical", ops, secsSince(start));
+	
+	// Battery levels, one per block
+	nandSimClearCounters();
+	start = clock();
+	if (readBatteryLevels() != num_blocks)
+		failed = 1;
+	report("levels", num_blocks, secsSince(start));
+	
+	if (written != num_pages || read != written || errors || failed) {
+		printf("Read back FAILED (%u written, %u read, %u errors)\n", written,
+			read, errors);
+		failed = 1;
+	}
+	
+	failed |= checkProfile(written);
+	failed |= checkFaultRecovery();
+	failed |= checkCompressedPages();
+	failed |= checkEraseAhead();
+	failed |= checkOverrunCount();
+	failed |= checkMapOverflow();
+	
+	nandSimReset();
+	return failed;
+}
@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Host simulation of the band's GPIO port B and the NAND flash hanging off it,
+ * see nand_sim.h.
+ * 
+ * The firmware only ever talks to the NAND through GPIO register accesses, so
+ * the simulator sits underneath the registers: every write to ODR/BSRR/BRR is
+ * turned into pin edges, NWE rising edges latch command/address/data cycles
+ * (qualified by NCE, CLE & ALE) and NRE falling edges put the next byte on the
+ * data pins read back through IDR.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+
+#include "stm32f10x.h"
+#include "hw_config.h"
+#include "shared.h"
+#include "nand_sim.h"
+
+using namespace std;
+
+// ----
+
+// Firmware globals normally owned by main.c/accel.c
+
+uint8_t data_values[FLASH_PAGE];
+struct config_info current_config;
+uint32_t start_page_tick = 0;
+uint16_t currentBatteryVoltage = 0;
+uint16_t currentTemperature = 0;
+volatile uint16_t sample_overruns = 0;
+uint8_t accel_rate_and_g_scale = 0;
+
+// ----
+
+// Simulated peripherals
+
+GPIO_TypeDef sim_gpioa;
+GPIO_TypeDef sim_gpiob;
+
+#define NUM_BKP_REGS 11
+
+static uint16_t backup_regs[NUM_BKP_REGS];
+
+enum gpio_reg {
+	REG_CRL = 0,
+	REG_CRH,
+	REG_IDR,
+	REG_ODR,
+	REG_BSRR,
+	REG_BRR,
+	REG_LCKR
+};
+
+#define NAND_DATA_PINS (NAND_D7 | NAND_D6 | NAND_D5 | NAND_D4 | NAND_D3 | \
+	NAND_D2 | NAND_D1 | NAND_D0)
+#define NAND_DATA_SHIFT 8
+
+// ----
+
+// NAND device state
+
+enum nand_state {
+	NAND_IDLE,
+	NAND_READ_ADDR,
+	NAND_READ_DATA,
+	NAND_PROG_ADDR,
+	NAND_PROG_DATA,
+	NAND_ERASE_ADDR,
+	NAND_STATUS,
+	NAND_ID_ADDR,
+	NAND_ID_DATA
+};
+
+static const uint8_t nand_id[] = { 0xAD, 0xDC, 0x10, 0x95, 0x54 };
+
+#define STATUS_FAIL			0x01
+#define STATUS_READY		0x40
+#define STATUS_NOT_PROTECT	0x80
+
+static uint8_t* blocks[MAX_BLOCKS];
+static bool factory_bad[MAX_BLOCKS];
+static set<uint32_t> fail_program;
+static set<uint16_t> fail_erase;
+
+static nand_state state = NAND_IDLE;
+static uint8_t addr[5];
+static uint8_t addr_count = 0;
+static uint16_t column = 0;
+static uint8_t page_register[FLASH_PAGE];
+static uint8_t id_index = 0;
+static uint8_t last_status = STATUS_READY | STATUS_NOT_PROTECT;
+static uint8_t bus_out = 0xFF;
+static bool driving = false;
+
+static uint32_t busy_polls = 1;
+static uint32_t busy_left = 0;
+
+static struct nand_sim_counters counters;
+// Never cleared, so profile.c's start & end counts stay in step
+static uint32_t bus_cycle_count = 0;
+
+// ----
+
+// NAND array
+
+static uint8_t* pagePtr(uint16_t aBlock, uint8_t aPage, bool aAllocate) {
+	if (!blocks[aBlock]) {
+		if (!aAllocate)
+			return NULL;
+		blocks[aBlock] = (uint8_t*) malloc(FLASH_BLOCK);
+		if (!blocks[aBlock]) {
+			fprintf(stderr, "nand_sim: out of memory for block %u\n", aBlock);
+			exit(1);
+		}
+		memset(blocks[aBlock], 0xFF, FLASH_BLOCK);
+	}
+	return blocks[aBlock] + (aPage * FLASH_PAGE);
+}
+
+static void setBusy(uint64_t aNs) {
+	busy_left = busy_polls;
+	counters.array_busy_ns += aNs;
+}
+
+static void decodeRow(uint32_t aRow, uint16_t* aBlock, uint8_t* aPage) {
+	*aBlock = (aRow >> 6) & (MAX_BLOCKS - 1);
+	*aPage = aRow & (MAX_PAGES_PER_BLOCK - 1);
+}
+
+static void loadPage() {
+	uint16_t block;
+	uint8_t page;
+	uint8_t* ptr;
+	
+	column = addr[0] | ((addr[1] & 0x0F) << 8);
+	decodeRow(addr[2] | (addr[3] << 8) | ((addr[4] & 0x03) << 16), &block,
+		&page);
+	
+	ptr = pagePtr(block, page, false);
+	if (ptr)
+		memcpy(page_register, ptr, FLASH_PAGE);
+	else
+		memset(page_register, 0xFF, FLASH_PAGE);
+	
+	counters.page_reads++;
+	setBusy(SIM_T_READ_NS);
+}
+
+static void programPage() {
+	uint16_t block, loop;
+	uint8_t page;
+	uint32_t row = addr[2] | (addr[3] << 8) | ((addr[4] & 0x03) << 16);
+	
+	decodeRow(row, &block, &page);
+	
+	last_status = STATUS_READY | STATUS_NOT_PROTECT;
+	if (factory_bad[block] || fail_program.erase(row)) {
+		// Leave the array untouched, the firmware should mark the block
+		last_status |= STATUS_FAIL;
+		counters.program_fails++;
+	} else {
+		// Programming can only clear bits
+		uint8_t* ptr = pagePtr(block, page, true);
+		for (loop = 0; loop < FLASH_PAGE; loop++) {
+			ptr[loop] &= page_register[loop];
+		}
+		counters.page_programs++;
+	}
+	setBusy(SIM_T_PROG_NS);
+}
+
+static void eraseBlock() {
+	uint16_t block;
+	uint8_t page;
+	
+	decodeRow(addr[0] | (addr[1] << 8) | ((addr[2] & 0x03) << 16), &block,
+		&page);
+	
+	last_status = STATUS_READY | STATUS_NOT_PROTECT;
+	if (factory_bad[block] || fail_erase.erase(block)) {
+		last_status |= STATUS_FAIL;
+		counters.erase_fails++;
+	} else {
+		free(blocks[block]);
+		blocks[block] = NULL;
+		counters.block_erases++;
+	}
+	setBusy(SIM_T_ERASE_NS);
+}
+
+static void nandCommand(uint8_t aCmd) {
+	counters.cmd_cycles++;
+	
+	switch (aCmd) {
+		case 0x00:
+			state = NAND_READ_ADDR;
+			addr_count = 0;
+			break;
+		case 0x30:
+			if (NAND_READ_ADDR == state && 5 == addr_count) {
+				loadPage();
+				state = NAND_READ_DATA;
+			} else {
+				counters.protocol_errors++;
+				state = NAND_IDLE;
+			}
+			break;
+		case 0x80:
+			state = NAND_PROG_ADDR;
+			addr_count = 0;
+			memset(page_register, 0xFF, FLASH_PAGE);
+			break;
+		case 0x10:
+			if ((NAND_PROG_ADDR == state || NAND_PROG_DATA == state) &&
+				5 == addr_count) {
+				programPage();
+			} else {
+				counters.protocol_errors++;
+			}
+			state = NAND_IDLE;
+			break;
+		case 0x60:
+			state = NAND_ERASE_ADDR;
+			addr_count = 0;
+			break;
+		case 0xD0:
+			if (NAND_ERASE_ADDR == state && 3 == addr_count) {
+				eraseBlock();
+			} else {
+				counters.protocol_errors++;
+			}
+			state = NAND_IDLE;
+			break;
+		case 0x70:
+			state = NAND_STATUS;
+			break;
+		case 0x90:
+			state = NAND_ID_ADDR;
+			addr_count = 0;
+			break;
+		case 0xFF:
+			state = NAND_IDLE;
+			setBusy(0);
+			break;
+		default:
+			counters.protocol_errors++;
+			state = NAND_IDLE;
+			break;
+	}
+}
+
+static void nandAddress(uint8_t aAddr) {
+	counters.addr_cycles++;
+	
+	if (addr_count >= sizeof(addr)) {
+		counters.protocol_errors++;
+		return;
+	}
+	addr[addr_count++] = aAddr;
+	
+	if (NAND_PROG_ADDR == state && 5 == addr_count) {
+		column = addr[0] | ((addr[1] & 0x0F) << 8);
+		state = NAND_PROG_DATA;
+	} else if (NAND_ID_ADDR == state) {
+		id_index = 0;
+		state = NAND_ID_DATA;
+	} else if (NAND_READ_ADDR != state && NAND_PROG_ADDR != state &&
+		NAND_ERASE_ADDR != state) {
+		counters.protocol_errors++;
+	}
+}
+
+static void nandDataIn(uint8_t aByte) {
+	counters.data_in_cycles++;
+	
+	if (NAND_PROG_DATA == state && column < FLASH_PAGE) {
+		page_register[column++] = aByte;
+	} else {
+		counters.protocol_errors++;
+	}
+}
+
+static uint8_t nandDataOut() {
+	uint8_t val = 0xFF;
+	
+	counters.data_out_cycles++;
+	
+	switch (state) {
+		case NAND_READ_DATA:
+			if (column < FLASH_PAGE)
+				val = page_register[column++];
+			else
+				counters.protocol_errors++;
+			break;
+		case NAND_STATUS:
+			val = last_status;
+			break;
+		case NAND_ID_DATA:
+			val = nand_id[id_index++ % sizeof(nand_id)];
+			break;
+		default:
+			counters.protocol_errors++;
+			break;
+	}
+	return val;
+}
+
+// ----
+
+// Port B pins
+
+static bool dataBusIsInput() {
+	// Mode bits [1:0] of each CRH nibble are 00 for an input
+	uint32_t crh = sim_gpiob.CRH.value;
+	uint8_t inputs = 0;
+	uint8_t pin;
+	
+	for (pin = 0; pin < 8; pin++) {
+		if (!((crh >> (pin * 4)) & 0x03))
+			inputs++;
+	}
+	if (inputs && inputs != 8)
+		counters.protocol_errors++;
+	return 8 == inputs;
+}
+
+static void nandPins(uint32_t aOld, uint32_t aNew) {
+	bool selected = !(aNew & NAND_NCE);
+	
+	if (!(aOld & NAND_NRE) && (aNew & NAND_NRE)) {
+		// End of read cycle, device stops driving the bus
+		driving = false;
+	}
+	
+	if (!selected)
+		return;
+	
+	if (busy_left && ((aOld ^ aNew) & (NAND_NWE | NAND_NRE))) {
+		// Bus cycle while RNB is low
+		counters.protocol_errors++;
+	}
+	
+	if (!(aOld & NAND_NWE) && (aNew & NAND_NWE)) {
+		// Rising NWE latches the data bus
+		uint8_t byte = (aNew & NAND_DATA_PINS) >> NAND_DATA_SHIFT;
+		bool cle = aNew & NAND_CLE;
+		bool ale = aNew & NAND_ALE;
+		
+		if (dataBusIsInput())
+			counters.protocol_errors++;
+		
+		if (cle && !ale)
+			nandCommand(byte);
+		else if (ale && !cle)
+			nandAddress(byte);
+		else if (!cle && !ale)
+			nandDataIn(byte);
+		else
+			counters.protocol_errors++;
+	}
+	
+	if ((aOld & NAND_NRE) && !(aNew & NAND_NRE)) {
+		// Falling NRE, device drives the next byte
+		bus_out = nandDataOut();
+		driving = true;
+	}
+}
+
+static void setOutput(GPIO_TypeDef* aPort, uint32_t aValue) {
+	uint32_t old = aPort->ODR.value;
+	aPort->ODR.value = aValue & 0xFFFF;
+	if (&sim_gpiob == aPort)
+		nandPins(old, aPort->ODR.value);
+}
+
+static uint32_t inputData(GPIO_TypeDef* aPort) {
+	// Outputs and pulled inputs read back the ODR value
+	uint32_t val = aPort->ODR.value;
+	
+	if (&sim_gpiob == aPort) {
+		if (dataBusIsInput()) {
+			val &= ~NAND_DATA_PINS;
+			val |= (driving ? bus_out : 0xFF) << NAND_DATA_SHIFT;
+		} else if (driving) {
+			// MCU and NAND both driving the data bus
+			counters.protocol_errors++;
+		}
+		
+		if (busy_left) {
+			busy_left--;
+			counters.busy_polls++;
+			val &= ~NAND_RNB;
+		} else {
+			val |= NAND_RNB;
+		}
+	}
+	return val;
+}
+
+static void regLocate(const sim_reg* aReg, GPIO_TypeDef** aPort,
+	gpio_reg* aWhich) {
+	
+	const sim_reg* base = &sim_gpiob.CRL;
+	*aPort = &sim_gpiob;
+	if (aReg < base || aReg > &sim_gpiob.LCKR) {
+		base = &sim_gpioa.CRL;
+		*aPort = &sim_gpioa;
+	}
+	*aWhich = (gpio_reg) (aReg - base);
+}
+
+sim_reg::operator uint32_t() const {
+	GPIO_TypeDef* port;
+	gpio_reg which;
+	
+	counters.reg_reads++;
+	bus_cycle_count++;
+	regLocate(this, &port, &which);
+	switch (which) {
+		case REG_IDR:
+			return inputData(port);
+		case REG_BSRR:
+		case REG_BRR:
+			// Write only
+			return 0;
+		default:
+			return value;
+	}
+}
+
+sim_reg& sim_reg::operator=(uint32_t aValue) {
+	GPIO_TypeDef* port;
+	gpio_reg which;
+	
+	counters.reg_writes++;
+	bus_cycle_count++;
+	regLocate(this, &port, &which);
+	switch (which) {
+		case REG_ODR:
+			setOutput(port, aValue);
+			break;
+		case REG_BSRR:
+			// Set has priority over reset
+			setOutput(port, (port->ODR.value & ~(aValue >> 16)) |
+				(aValue & 0xFFFF));
+			break;
+		case REG_BRR:
+			setOutput(port, port->ODR.value & ~(aValue & 0xFFFF));
+			break;
+		case REG_IDR:
+			// Read only
+			break;
+		default:
+			value = aValue;
+			break;
+	}
+	return *this;
+}
+
+// ----
+
+// StdPeriph equivalents (same register accesses as the library)
+
+static void configPins(sim_reg* aCr, GPIO_TypeDef* aPort, uint16_t aPins,
+	uint8_t aFirstPin, uint32_t aMode, GPIOMode_TypeDef aPull) {
+	uint32_t reg = *aCr;
+	uint8_t pin;
+	
+	for (pin = 0; pin < 8; pin++) {
+		uint16_t bit = 1 << (pin + aFirstPin);
+		if (aPins & bit) {
+			reg &= ~(0x0F << (pin * 4));
+			reg |= aMode << (pin * 4);
+			if (GPIO_Mode_IPD == aPull)
+				aPort->BRR = bit;
+			else if (GPIO_Mode_IPU == aPull)
+				aPort->BSRR = bit;
+		}
+	}
+	*aCr = reg;
+}
+
+void GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_InitStruct) {
+	uint32_t mode = GPIO_InitStruct->GPIO_Mode & 0x0F;
+	
+	if (GPIO_InitStruct->GPIO_Mode & 0x10) {
+		// Output
+		mode |= GPIO_InitStruct->GPIO_Speed;
+	}
+	
+	if (GPIO_InitStruct->GPIO_Pin & 0x00FF) {
+		configPins(&GPIOx->CRL, GPIOx, GPIO_InitStruct->GPIO_Pin, 0, mode,
+			GPIO_InitStruct->GPIO_Mode);
+	}
+	if (GPIO_InitStruct->GPIO_Pin & 0xFF00) {
+		configPins(&GPIOx->CRH, GPIOx, GPIO_InitStruct->GPIO_Pin, 8, mode,
+			GPIO_InitStruct->GPIO_Mode);
+	}
+}
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+	return ((uint32_t) GPIOx->IDR & GPIO_Pin) ? (uint8_t) Bit_SET :
+		(uint8_t) Bit_RESET;
+}
+
+uint16_t GPIO_ReadInputData(GPIO_TypeDef* GPIOx) {
+	return (uint16_t) GPIOx->IDR;
+}
+
+uint8_t GPIO_ReadOutputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+	return ((uint32_t) GPIOx->ODR & GPIO_Pin) ? (uint8_t) Bit_SET :
+		(uint8_t) Bit_RESET;
+}
+
+uint16_t GPIO_ReadOutputData(GPIO_TypeDef* GPIOx) {
+	return (uint16_t) GPIOx->ODR;
+}
+
+void GPIO_SetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+	GPIOx->BSRR = GPIO_Pin;
+}
+
+void GPIO_ResetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
+	GPIOx->BRR = GPIO_Pin;
+}
+
+void GPIO_WriteBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, BitAction BitVal) {
+	if (BitVal != Bit_RESET)
+		GPIOx->BSRR = GPIO_Pin;
+	else
+		GPIOx->BRR = GPIO_Pin;
+}
+
+void GPIO_Write(GPIO_TypeDef* GPIOx, uint16_t PortVal) {
+	GPIOx->ODR = PortVal;
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph,
+	FunctionalState NewState) {
+}
+
+void BKP_WriteBackupRegister(uint16_t BKP_DR, uint16_t Data) {
+	if ((BKP_DR >> 2) < NUM_BKP_REGS)
+		backup_regs[BKP_DR >> 2] = Data;
+}
+
+uint16_t BKP_ReadBackupRegister(uint16_t BKP_DR) {
+	if ((BKP_DR >> 2) < NUM_BKP_REGS)
+		return backup_regs[BKP_DR >> 2];
+	return 0;
+}
+
+// ----
+
+// Simulator control
+
+void nandSimReset() {
+	uint16_t loop;
+	
+	for (loop = 0; loop < MAX_BLOCKS; loop++) {
+		free(blocks[loop]);
+		blocks[loop] = NULL;
+		factory_bad[loop] = false;
+	}
+	fail_program.clear();
+	fail_erase.clear();
+	memset(backup_regs, 0, sizeof(backup_regs));
+	
+	state = NAND_IDLE;
+	addr_count = 0;
+	busy_left = 0;
+	driving = false;
+	last_status = STATUS_READY | STATUS_NOT_PROTECT;
+	
+	nandSimClearCounters();
+}
+
+void nandSimClearCounters() {
+	memset(&counters, 0, sizeof(counters));
+}
+
+void nandSimGetCounters(struct nand_sim_counters* aCounters) {
+	*aCounters = counters;
+}
+
+uint64_t nandSimBusCycles(const struct nand_sim_counters* aCounters) {
+	return aCounters->reg_reads + aCounters->reg_writes;
+}
+
+uint32_t simCycleCount() {
+	return bus_cycle_count;
+}
+
+void nandSimSetBusyPolls(uint32_t aPolls) {
+	busy_polls = aPolls;
+}
+
+void nandSimSetFactoryBadBlock(uint16_t aBlock) {
+	if (aBlock < MAX_BLOCKS) {
+		uint8_t* ptr = pagePtr(aBlock, 0, true);
+		ptr[BAD_BLOCK_ADDR] = 0x00;
+		factory_bad[aBlock] = true;
+	}
+}
+
+void nandSimFailProgram(uint16_t aBlock, uint8_t aPage) {
+	fail_program.insert((aBlock << 6) | (aPage & (MAX_PAGES_PER_BLOCK - 1)));
+}
+
+void nandSimFailErase(uint16_t aBlock) {
+	fail_erase.insert(aBlock);
+}
+
+void nandSimPeek(uint16_t aBlock, uint8_t aPage, uint16_t aByteAddrInPage,
+	uint8_t* aDest, uint16_t aNumBytes) {
+	uint8_t* ptr = pagePtr(aBlock, aPage, false);
+	if (ptr)
+		memcpy(aDest, ptr + aByteAddrInPage, aNumBytes);
+	else
+		memset(aDest, 0xFF, aNumBytes);
+}
+
+uint32_t nandSimAllocatedBlocks() {
+	uint32_t count = 0;
+	uint16_t loop;
+	for (loop = 0; loop < MAX_BLOCKS; loop++) {
+		if (blocks[loop])
+			count++;
+	}
+	return count;
+}
+
+// EOF
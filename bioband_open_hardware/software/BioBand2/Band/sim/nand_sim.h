@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Host simulation of the Hynix HY27UF084G2B NAND (4096 blocks of 64 x 2112
+ * byte pages) as wired to GPIOB on the band. The simulator decodes the pin
+ * level protocol driven by nand_cwa.c (CLE/ALE/NWE/NRE/NCE and the D0-D7 data
+ * bus), holds the array sparsely (only programmed blocks take memory), allows
+ * bad blocks and program/erase failures to be injected and counts the bus
+ * activity needed for each operation.
+ */
+
+#ifndef _NAND_SIM_H
+#define _NAND_SIM_H
+
+#include <stdint.h>
+
+// Typical array timings from the data sheet (used for the modelled busy time)
+#define SIM_T_READ_NS	25000
+#define SIM_T_PROG_NS	200000
+#define SIM_T_ERASE_NS	1500000
+
+struct nand_sim_counters {
+	uint64_t reg_reads;			// GPIO register reads (incl. RNB polls)
+	uint64_t reg_writes;		// GPIO register writes
+	uint64_t cmd_cycles;		// NAND command latch cycles
+	uint64_t addr_cycles;		// NAND address latch cycles
+	uint64_t data_in_cycles;	// bytes written to the page register
+	uint64_t data_out_cycles;	// bytes read from the device
+	uint64_t busy_polls;		// RNB reads while the device was busy
+	uint64_t page_reads;
+	uint64_t page_programs;
+	uint64_t block_erases;
+	uint64_t program_fails;
+	uint64_t erase_fails;
+	uint64_t protocol_errors;	// cycles the device would not accept
+	uint64_t array_busy_ns;		// modelled tR + tPROG + tBERS
+};
+
+// Erase the whole device, clear any injected faults, counters & backup regs
+void nandSimReset();
+
+void nandSimClearCounters();
+void nandSimGetCounters(struct nand_sim_counters* aCounters);
+
+// Total bus cycles, i.e GPIO register accesses made by the firmware
+uint64_t nandSimBusCycles(const struct nand_sim_counters* aCounters);
+
+// Number of RNB polls that read busy after each program/erase/read
+void nandSimSetBusyPolls(uint32_t aPolls);
+
+// Factory bad block (0x00 marker, the block will not erase or program)
+void nandSimSetFactoryBadBlock(uint16_t aBlock);
+
+// One shot failures of the next program of a page or erase of a block
+void nandSimFailProgram(uint16_t aBlock, uint8_t aPage);
+void nandSimFailErase(uint16_t aBlock);
+
+// Direct array access, bypasses the bus and the counters
+void nandSimPeek(uint16_t aBlock, uint8_t aPage, uint16_t aByteAddrInPage,
+	uint8_t* aDest, uint16_t aNumBytes);
+uint32_t nandSimAllocatedBlocks();
+
+#endif //_NAND_SIM_H
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Host stand-in for the CMSIS/StdPeriph headers so the band storage code can
+ * be built and run on a PC against the simulated NAND in nand_sim.cpp.
+ * 
+ * Only the parts used by nand_cwa.c and debug.c are provided. The GPIO
+ * registers are sim_reg objects so every register access made by the firmware
+ * (directly or through the GPIO_xxx functions) is seen and counted by the
+ * simulator.
+ */
+
+#ifndef __STM32F10x_H
+#define __STM32F10x_H
+
+#include <stdint.h>
+
+#ifndef __cplusplus
+#error "The NAND simulator build compiles the firmware sources as C++"
+#endif
+
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+typedef enum {ERROR = 0, SUCCESS = !ERROR} ErrorStatus;
+
+// ----
+
+// Peripheral register, reads and writes are routed to the simulator
+
+struct sim_reg {
+	uint32_t value;
+	
+	operator uint32_t() const;
+	sim_reg& operator=(uint32_t aValue);
+	sim_reg& operator|=(uint32_t aValue) { return *this = (uint32_t) *this | aValue; }
+	sim_reg& operator&=(uint32_t aValue) { return *this = (uint32_t) *this & aValue; }
+	
+private:
+	sim_reg& operator=(const sim_reg&);
+};
+
+typedef struct {
+	sim_reg CRL;
+	sim_reg CRH;
+	sim_reg IDR;
+	sim_reg ODR;
+	sim_reg BSRR;
+	sim_reg BRR;
+	sim_reg LCKR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef sim_gpioa;
+extern GPIO_TypeDef sim_gpiob;
+
+#define GPIOA (&sim_gpioa)
+#define GPIOB (&sim_gpiob)
+
+// ----
+
+// GPIO (values as stm32f10x_gpio.h)
+
+#define GPIO_Pin_0		((uint16_t)0x0001)
+#define GPIO_Pin_1		((uint16_t)0x0002)
+#define GPIO_Pin_2		((uint16_t)0x0004)
+#define GPIO_Pin_3		((uint16_t)0x0008)
+#define GPIO_Pin_4		((uint16_t)0x0010)
+#define GPIO_Pin_5		((uint16_t)0x0020)
+#define GPIO_Pin_6		((uint16_t)0x0040)
+#define GPIO_Pin_7		((uint16_t)0x0080)
+#define GPIO_Pin_8		((uint16_t)0x0100)
+#define GPIO_Pin_9		((uint16_t)0x0200)
+#define GPIO_Pin_10		((uint16_t)0x0400)
+#define GPIO_Pin_11		((uint16_t)0x0800)
+#define GPIO_Pin_12		((uint16_t)0x1000)
+#define GPIO_Pin_13		((uint16_t)0x2000)
+#define GPIO_Pin_14		((uint16_t)0x4000)
+#define GPIO_Pin_15		((uint16_t)0x8000)
+#define GPIO_Pin_All	((uint16_t)0xFFFF)
+
+typedef enum {
+	GPIO_Speed_10MHz = 1,
+	GPIO_Speed_2MHz,
+	GPIO_Speed_50MHz
+} GPIOSpeed_TypeDef;
+
+typedef enum {
+	GPIO_Mode_AIN = 0x0,
+	GPIO_Mode_IN_FLOATING = 0x04,
+	GPIO_Mode_IPD = 0x28,
+	GPIO_Mode_IPU = 0x48,
+	GPIO_Mode_Out_OD = 0x14,
+	GPIO_Mode_Out_PP = 0x10,
+	GPIO_Mode_AF_OD = 0x1C,
+	GPIO_Mode_AF_PP = 0x18
+} GPIOMode_TypeDef;
+
+typedef struct {
+	uint16_t GPIO_Pin;
+	GPIOSpeed_TypeDef GPIO_Speed;
+	GPIOMode_TypeDef GPIO_Mode;
+} GPIO_InitTypeDef;
+
+typedef enum {
+	Bit_RESET = 0,
+	Bit_SET
+} BitAction;
+
+void GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_InitStruct);
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+uint16_t GPIO_ReadInputData(GPIO_TypeDef* GPIOx);
+uint8_t GPIO_ReadOutputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+uint16_t GPIO_ReadOutputData(GPIO_TypeDef* GPIOx);
+void GPIO_SetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void GPIO_ResetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void GPIO_WriteBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, BitAction BitVal);
+void GPIO_Write(GPIO_TypeDef* GPIOx, uint16_t PortVal);
+
+// ----
+
+// RCC & backup registers
+
+#define RCC_APB2Periph_GPIOA	((uint32_t)0x00000004)
+#define RCC_APB2Periph_GPIOB	((uint32_t)0x00000008)
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState);
+
+#define BKP_DR1		((uint16_t)0x0004)
+#define BKP_DR2		((uint16_t)0x0008)
+#define BKP_DR3		((uint16_t)0x000C)
+#define BKP_DR4		((uint16_t)0x0010)
+#define BKP_DR5		((uint16_t)0x0014)
+#define BKP_DR6		((uint16_t)0x0018)
+#define BKP_DR7		((uint16_t)0x001C)
+#define BKP_DR8		((uint16_t)0x0020)
+#define BKP_DR9		((uint16_t)0x0024)
+#define BKP_DR10	((uint16_t)0x0028)
+
+void BKP_WriteBackupRegister(uint16_t BKP_DR, uint16_t Data);
+uint16_t BKP_ReadBackupRegister(uint16_t BKP_DR);
+
+// ----
+
+// Cycle counter for profile.c, the simulator has no core clock so the bus
+// cycles made so far are counted instead
+
+uint32_t simCycleCount();
+
+#define PROFILE_CYCLE_COUNT() simCycleCount()
+
+#endif // __STM32F10x_H
@@ -90,7 +90,7 @@ uint8_t accel_rate_and_g_scale = CWA_8G | CWA_50HZ;
 volatile accel_data_rate current_accel_rate = CWA_50HZ;
 
 static uint8_t getAccelRate() {
-	uint8_t ar = accel_rate_and_g_scale & 0x0F;
+	uint8_t ar = accel_rate_and_g_scale & ACCEL_DR_MASK;
 	uint8_t retval;
 	current_accel_rate = ar;
 	switch (current_accel_rate) {
@@ -103,7 +103,7 @@ static uint8_t getAccelRate() {
 }
 
 static uint8_t getGScale() {
-	uint8_t gs = accel_rate_and_g_scale & 0xF0;
+	uint8_t gs = accel_rate_and_g_scale & ACCEL_GS_MASK;
 	uint8_t retval;
 	switch (gs) {
 		case CWA_2G: retval = LIS331DLH_CR4_FS_2G; break;
@@ -232,4 +232,97 @@ void accelReadingBuf(uint8_t *buf) {
 	accelDeassertNSS();
 }
 
+#ifdef ACCEL_DMA
+
+/*
+ * DMA sample reads. The LIS331DLH has no FIFO, so every sample still needs
+ * its own data ready interrupt, but the 6 data bytes are clocked straight
+ * into the sample buffer by DMA1 (channel 2 is SPI1 Rx, channel 3 SPI1 Tx)
+ * while the CPU sleeps, rather than the interrupt handler polling each byte.
+ * The Tx channel clocks out the same zero byte for every data byte.
+ */
+
+static uint8_t dma_tx_zero = 0;
+static volatile uint8_t dma_busy = 0;
+
+void accelDmaInit() {
+	DMA_InitTypeDef DMA_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
+	
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+	
+	// Rx, SPI1 data register to the sample buffer (set per transfer)
+	DMA_DeInit(DMA1_Channel2);
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&(SPI1->DR);
+	DMA_InitStructure.DMA_MemoryBaseAddr = 0;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+	DMA_InitStructure.DMA_BufferSize = BYTES_PER_SAMPLE;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(DMA1_Channel2, &DMA_InitStructure);
+	DMA_ITConfig(DMA1_Channel2, DMA_IT_TC, ENABLE);
+	
+	// Tx, the zero byte to the SPI1 data register
+	DMA_DeInit(DMA1_Channel3);
+	DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)&dma_tx_zero;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Disable;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+	DMA_Init(DMA1_Channel3, &DMA_InitStructure);
+	
+	// Same priority as the data ready interrupt so neither preempts the other
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel2_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+	
+	dma_busy = 0;
+}
+
+void accelDmaShutdown() {
+	DMA_Cmd(DMA1_Channel2, DISABLE);
+	DMA_Cmd(DMA1_Channel3, DISABLE);
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, DISABLE);
+	dma_busy = 0;
+}
+
+void accelReadingDmaStart(uint8_t *buf) {
+	dma_busy = 1;
+	accelAssertNSS();
+	// Send address with autoincrement set, polled so that its Rx byte is
+	// consumed before the Rx channel starts
+	accelSpiCycle(LIS331DLH_REG_OUT_X_L | LIS331DLH_SPI_READ |
+		LIS331DLH_AUTOINCREMENT);
+	
+	DMA1_Channel2->CMAR = (uint32_t)buf;
+	DMA1_Channel2->CNDTR = BYTES_PER_SAMPLE;
+	DMA1_Channel3->CNDTR = BYTES_PER_SAMPLE;
+	DMA1_Channel2->CCR |= DMA_CCR2_EN;
+	DMA1_Channel3->CCR |= DMA_CCR3_EN;
+	// Rx has the higher channel priority so it keeps up with Tx
+	SPI1->CR2 |= SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx;
+}
+
+void accelReadingDmaEnd() {
+	DMA1->IFCR = DMA1_FLAG_GL2 | DMA1_FLAG_GL3;
+	SPI1->CR2 &= (uint16_t)~(SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx);
+	DMA1_Channel2->CCR &= (uint16_t)~DMA_CCR2_EN;
+	DMA1_Channel3->CCR &= (uint16_t)~DMA_CCR3_EN;
+	// The last byte received, so the bus is idle
+	accelDeassertNSS();
+	dma_busy = 0;
+}
+
+uint8_t accelDmaBusy() {
+	return dma_busy;
+}
+
+#endif
+
 // EOF
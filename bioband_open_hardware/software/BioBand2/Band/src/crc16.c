@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "crc16.h"
+
+#ifndef MRC_CWA
+
+#define CRC16_SLICES 8
+
+// Combined 16 bit tables, slice n holds the crc contribution of a byte
+// followed by n zero bytes (low byte = crc_hi, high byte = crc_lo)
+static uint16_t crc16_slice[CRC16_SLICES][256];
+static uint8_t crc16_slices_built = 0;
+
+void crc16Init(void) {
+	uint16_t loop, slice;
+	
+	if (crc16_slices_built)
+		return;
+	
+	for (loop = 0; loop < 256; loop++) {
+		crc16_slice[0][loop] = (uint16_t) (table_crc_hi[loop] |
+			(table_crc_lo[loop] << 8));
+	}
+	for (slice = 1; slice < CRC16_SLICES; slice++) {
+		for (loop = 0; loop < 256; loop++) {
+			uint16_t prev = crc16_slice[slice - 1][loop];
+			crc16_slice[slice][loop] = (prev >> 8) ^
+				crc16_slice[0][prev & 0xFF];
+		}
+	}
+	crc16_slices_built = 1;
+}
+
+void crc16Update(uint8_t* crc_hi, uint8_t* crc_lo, const uint8_t* data,
+	uint32_t len) {
+	
+	uint16_t crc = (uint16_t) (*crc_hi | (*crc_lo << 8));
+	
+	crc16Init();
+	
+	while (len >= CRC16_SLICES) {
+		crc ^= (uint16_t) (data[0] | (data[1] << 8));
+		crc = crc16_slice[7][crc & 0xFF] ^ crc16_slice[6][crc >> 8] ^
+			crc16_slice[5][data[2]] ^ crc16_slice[4][data[3]] ^
+			crc16_slice[3][data[4]] ^ crc16_slice[2][data[5]] ^
+			crc16_slice[1][data[6]] ^ crc16_slice[0][data[7]];
+		data += CRC16_SLICES;
+		len -= CRC16_SLICES;
+	}
+	while (len--) {
+		crc = (crc >> 8) ^ crc16_slice[0][(crc ^ *data++) & 0xFF];
+	}
+	
+	*crc_hi = (uint8_t) crc;
+	*crc_lo = (uint8_t) (crc >> 8);
+}
+
+#else // band
+
+void crc16Init(void) {
+	// nothing to do, uses the shared tables directly
+}
+
+void crc16Update(uint8_t* crc_hi, uint8_t* crc_lo, const uint8_t* data,
+	uint32_t len) {
+	
+	uint8_t hi = *crc_hi;
+	uint8_t lo = *crc_lo;
+	
+	while (len--) {
+		uint8_t i = hi ^ *data++;
+		hi = lo ^ table_crc_hi[i];
+		lo = table_crc_lo[i];
+	}
+	
+	*crc_hi = hi;
+	*crc_lo = lo;
+}
+
+#endif // MRC_CWA
+
+// EOF
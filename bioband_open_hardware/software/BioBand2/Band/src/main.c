@@ -38,6 +38,8 @@
 #include "accel.h"
 #include "tempsensor.h"
 #include "debug.h"
+#include "crc16.h"
+#include "profile.h"
 
 // ----
 
@@ -60,8 +62,13 @@ typedef enum _firmware_version
 	CWA_FW_1_2 = 0x02, 	// Bugfixes from knobbly long running tests
 	CWA_FW_1_3 = 0x03, 	// Added isCompleteCapture api & removed PC/Band version 
 						// dependency
-	// Five bits, space for 28 more firmware versions in the field
-	CW_CURRENT_FW = CWA_FW_1_3,
+	CWA_FW_1_4 = 0x04, 	// Added streamed raw download
+	CWA_FW_1_5 = 0x05, 	// Added compressed pages
+	CWA_FW_1_6 = 0x06, 	// Added cycle count profile
+	CWA_FW_1_7 = 0x07, 	// Added incremental raw download
+	CWA_FW_1_8 = 0x08, 	// Added overrun count in the spare area
+	// Five bits, space for 23 more firmware versions in the field
+	CW_CURRENT_FW = CWA_FW_1_8,
 } firmware_version;
 
 typedef enum _hardware_version
@@ -77,6 +84,11 @@ void getVerFloats(float* hw_ptr, float* fw_ptr) {
 		case CWA_FW_1_1: *fw_ptr = 1.1; break;
 		case CWA_FW_1_2: *fw_ptr = 1.2; break;
 		case CWA_FW_1_3: *fw_ptr = 1.3; break;
+		case CWA_FW_1_4: *fw_ptr = 1.4; break;
+		case CWA_FW_1_5: *fw_ptr = 1.5; break;
+		case CWA_FW_1_6: *fw_ptr = 1.6; break;
+		case CWA_FW_1_7: *fw_ptr = 1.7; break;
+		case CWA_FW_1_8: *fw_ptr = 1.8; break;
 		default: // unknown?
 			*fw_ptr = 0.0;
 			break;
@@ -140,15 +152,17 @@ bool usb_configured = 0;
 volatile uint32_t data_count = 0;
 volatile bool proceed_as_normal = 1;
 
-volatile bool lastHalfPage = 0;
-volatile bool firstHalfPage = 0;
-
 uint16_t currentBatteryVoltage = 0;
 uint16_t currentTemperature = 0;
 
 int b_index = 0;
 uint8_t data_values[FLASH_PAGE];
 
+// Compressed pages, the samples are packed into data_values as they arrive
+bool compress_pages = 0;
+bool packed_half = 0;
+struct page_packer packer;
+
 uint32_t start_page_tick = 0;
 
 // Wait for config standby count
@@ -158,6 +172,38 @@ volatile int transfer_size;
 
 volatile bool simple_tx_read_check = 0;
 
+// Streamed raw download, the main loop reads the next flash page into one
+// buffer while ready_for_tx_cb sends the other
+#define STREAM_PAGE_BYTES (PAGE_LEADER + FLASH_PAGE)
+#define STREAM_DONE_LEN 4
+
+uint8_t stream_buffer[FLASH_PAGE];
+uint8_t* const stream_pages[2] = { data_values, stream_buffer };
+volatile uint8_t stream_page_addr[2];
+volatile bool stream_full[2];
+volatile uint8_t stream_send = 0;
+uint16_t stream_pos = 0;
+uint8_t stream_packet[STREAM_PACKET_SIZE];
+uint8_t stream_count = 0;
+uint8_t stream_done = 0;
+volatile bool stream_end = 0;
+volatile bool stream_idle = 0;
+
+// Sample ring, the accelerometer interrupt fills the pages & collect() writes
+// them to flash a half page at a time, so the writes may fall behind by up to
+// a page. The stream buffer is free while collecting. ring_fill & ring_write
+// count the half pages filled & written (wrapping), samples arriving with no
+// page free are dropped & counted in sample_overruns.
+#define SAMPLE_RING_PAGES 2
+#define RING_HALVES (2 * SAMPLE_RING_PAGES)
+
+uint8_t* const sample_ring[SAMPLE_RING_PAGES] = { data_values, stream_buffer };
+uint32_t ring_tick[SAMPLE_RING_PAGES]; // tick at the start of each page
+uint32_t ring_count[SAMPLE_RING_PAGES]; // data_count at the end of each page
+volatile uint8_t ring_fill = 0;
+volatile uint8_t ring_write = 0;
+volatile uint16_t sample_overruns = 0;
+
 uint16_t readBlockAddr = 0;
 uint8_t pageAddr = 0;
 uint8_t lastPageAddr = 0;
@@ -190,6 +236,7 @@ typedef enum _cwa_state
 	CWA_STANDBY_FOR_COLLECT,
 	CWA_COLLECT,
 	CWA_SLEEP,
+	CWA_STREAM_RAW,
 	CWA_NUM_OF_STATES
 } cwa_state;
 
@@ -203,6 +250,22 @@ static void powerDown() {
 	PWR_EnterSTOPMode(PWR_Regulator_LowPower, PWR_STOPEntry_WFI);
 }
 
+static void collectPowerDown() {
+#ifdef ACCEL_DMA
+	// Stop mode halts the SPI and DMA clocks, so only sleep while a sample
+	// read is in flight. Interrupts are masked over the check so a read can't
+	// start just before stopping, a pending interrupt still ends the WFI.
+	__disable_irq();
+	if (accelDmaBusy())
+		__WFI();
+	else
+		powerDown();
+	__enable_irq();
+#else
+	powerDown();
+#endif
+}
+
 static void enableUSB() {
 	if (!usb_configured) {
 		USB_ConfigSerialNum(current_config.band_id);
@@ -235,47 +298,119 @@ static void send_done() {
 // Simplistic accelerometer interrupt count
 volatile uint8_t tcount = 0;
 
-void accelIntrHandler(void) {
+static uint8_t packed_sample[BYTES_PER_SAMPLE];
+static uint8_t* sample_dest = packed_sample;
+
+static uint8_t ringIndex(uint8_t aHalf) {
+	return (aHalf >> 1) % SAMPLE_RING_PAGES;
+}
+
+static bool ringPageFree(uint8_t aHalf) {
 	
-	/* 
-	 * Accelerometer interrupt handler
-	 * 
-	 * Accelerometer interrupts are generated only when the device has entered
-	 * collect state.
-	 *  
-	 * The b_index variable is used to co-ordinate the temperature and battery
-	 * level sensor measurements need to be triggered at the correct times to
-	 * allow for settling times of the sensors. In the same way, sample data is
-	 * written to flash in half page quantities to allow new samples to be
-	 * recorded without the need for an additional buffer.
-	 */
+	// Whether the page starting at half page aHalf has no data left to write
 	
-	bool enable_thermometer = 0;
+	return (uint8_t) (aHalf - ring_write) <= RING_HALVES - 2;
+}
 
-	if (CWA_TEST_MODE == current_config.mode) {
-		tcount++;
-		if (tcount == 50) {
-			BlueLed(1);
-		} else if (tcount >= 100) {
-			tcount = 0;
-			BlueLed(0);
+static void ringPageDone() {
+	ring_count[ringIndex(ring_fill)] = data_count;
+	ring_fill++;
+}
+
+static uint8_t* sampleBuffer() {
+	
+	// Where the next sample is read to, raw samples go straight into the page
+	// being filled (note high byte is read first in this mode) unless there's
+	// no page free to start
+	
+	if (compress_pages || (!b_index && !ringPageFree(ring_fill))) {
+		sample_dest = packed_sample;
+	} else {
+		sample_dest = &sample_ring[ringIndex(ring_fill)][b_index];
+	}
+	return sample_dest;
+}
+
+static bool storeSample(uint8_t* aSample) {
+	
+	// Account for the sample just read into aSample, returns 0 if dropped
+	
+	if (data_count >= current_config.max_samples) {
+		// Collect is complete, the ring is being written out
+		return 0;
+	}
+	
+	if (compress_pages) {
+		if (!ringPageFree(ring_fill + (packed_half ? 1 : 2)) &&
+			(packer.bit_pos + PACK_MAX_GROUP_BITS > PACKED_DATA_SIZE * 8)) {
+			// The sample could start the next page, which isn't free
+			aSample = NULL;
+		} else if (PACK_PAGE_FULL == packerAddSample(&packer, aSample)) {
+			if (!packed_half)
+				ring_fill++;
+			packed_half = 0;
+			ringPageDone();
+			ring_tick[ringIndex(ring_fill)] = RTC_GetCounter();
+			packer.next_page = sample_ring[ringIndex(ring_fill + 2)];
 		}
+	} else if (aSample == packed_sample) {
+		// Read while the ring was full
+		aSample = NULL;
+	} else if (!b_index) {
+		ring_tick[ringIndex(ring_fill)] = RTC_GetCounter();
+	}
+	
+	if (!aSample) {
+		if (sample_overruns < 0xFFFF)
+			sample_overruns++;
+		return 0;
+	}
+	
+	if (compress_pages && !packed_half &&
+		((packer.bit_pos >> 3) >= SAMPLE_HALF_PAGE)) {
+		// First half ready to write
+		packed_half = 1;
+		ring_fill++;
 	}
 	
-	// Note high byte is read first in this mode
-	accelReadingBuf((uint8_t*)&(data_values[b_index]));
-
 	b_index+=6;
 	data_count++;
+	return 1;
+}
+
+static bool readSample() {
+	
+	// Read the next sample into the page being filled
+	
+	uint8_t* sample = sampleBuffer();
+	accelReadingBuf(sample);
+	return storeSample(sample);
+}
+
+static void sampleTasks() {
+	
+	/*
+	 * The b_index variable is used to co-ordinate the temperature and battery
+	 * level sensor measurements need to be triggered at the correct times to
+	 * allow for settling times of the sensors. In the same way, sample data is
+	 * passed to collect() to write to flash in half page quantities as each
+	 * half of a ring page fills. Compressed pages are written the same way,
+	 * but when the packed data reaches each half (b_index then only times the
+	 * sensor measurements).
+	 */
+	
+	bool enable_thermometer = 0;
 	
 	// A 'task list' for things to do while we're recording data
 	switch(b_index) {
 	case SAMPLE_HALF_PAGE:
-		firstHalfPage = 1;
+		if (!compress_pages)
+			ring_fill++;
 		break;
 	case SAMPLE_FULL_PAGE:
 		b_index = 0;
-		lastHalfPage = 1;
+		if (!compress_pages)
+			ringPageDone();
 		break;
 		
 #ifdef ENABLE_TEMPERATURE
@@ -325,6 +460,56 @@ void accelIntrHandler(void) {
 	}
 }
 
+void accelIntrHandler(void) {
+	
+	/* 
+	 * Accelerometer interrupt handler
+	 * 
+	 * Accelerometer interrupts are generated only when the device has entered
+	 * collect state. With ACCEL_DMA the sample is read by DMA and the rest is
+	 * done by accelDmaIntrHandler once it has arrived, the SPI bus has to be
+	 * left alone until then.
+	 */
+	
+	uint32_t prof_start = profileStart();
+	
+	if (CWA_TEST_MODE == current_config.mode) {
+		tcount++;
+		if (tcount == 50) {
+			BlueLed(1);
+		} else if (tcount >= 100) {
+			tcount = 0;
+			BlueLed(0);
+		}
+	}
+	
+#ifdef ACCEL_DMA
+	if (!accelDmaBusy()) {
+		accelReadingDmaStart(sampleBuffer());
+	} else if (sample_overruns < 0xFFFF) {
+		// The last sample is still being read, so this one is lost
+		sample_overruns++;
+	}
+#else
+	if (readSample())
+		sampleTasks();
+#endif
+	
+	profileEnd(PROF_ACCEL_INTR, prof_start);
+}
+
+#ifdef ACCEL_DMA
+void accelDmaIntrHandler(void) {
+	
+	// DMA1 channel 2 transfer complete, the sample started by
+	// accelIntrHandler has been read
+	
+	accelReadingDmaEnd();
+	if (storeSample(sample_dest))
+		sampleTasks();
+}
+#endif
+
 void RTCIntrHandler(void) {
 	
 	/*
@@ -547,6 +732,144 @@ static cwa_state readDebug() {
 	return current_state;
 }
 
+static void resetStream() {
+	stream_full[0] = 0;
+	stream_full[1] = 0;
+	stream_send = 0;
+	stream_pos = 0;
+	stream_count = 0;
+	stream_done = 0;
+	stream_end = 0;
+	stream_idle = 1;
+}
+
+static void sendStreamPacket() {
+	
+	/*
+	 * Fill the pending packet from the leader & contents of the page being
+	 * sent, moving on to the other buffer as each page completes. Only full
+	 * packets are sent until the end of the data, so the PC can use large
+	 * bulk reads. If no complete packet is available the sender goes idle
+	 * until the main loop has read the next page (see streamPages).
+	 */
+	
+	stream_idle = 0;
+	
+	while (stream_count < STREAM_PACKET_SIZE) {
+		uint8_t slot = stream_send;
+		if (stream_full[slot]) {
+			if (stream_pos < PAGE_LEADER) {
+				// Settling pattern & page number
+				stream_packet[stream_count++] =
+					(3 == stream_pos) ? stream_page_addr[slot] : 0;
+				stream_pos++;
+			} else {
+				uint8_t* ptr = stream_pages[slot] + stream_pos - PAGE_LEADER;
+				while ((stream_count < STREAM_PACKET_SIZE) &&
+						(stream_pos < STREAM_PAGE_BYTES)) {
+					stream_packet[stream_count++] = *ptr++;
+					stream_pos++;
+				}
+			}
+			if (STREAM_PAGE_BYTES == stream_pos) {
+				// Page sent, release the buffer for the next read
+				stream_pos = 0;
+				stream_send = slot ^ 1;
+				stream_full[slot] = 0;
+			}
+		} else if (stream_end && (stream_done < STREAM_DONE_LEN)) {
+			stream_packet[stream_count++] = "Done"[stream_done++];
+		} else {
+			break;
+		}
+	}
+	
+	if (STREAM_PACKET_SIZE == stream_count) {
+		stream_count = 0;
+		USB_Send_Data(stream_packet, STREAM_PACKET_SIZE);
+	} else if (stream_end && (STREAM_DONE_LEN == stream_done)) {
+		// Final short packet, zero length if the previous one was full size
+		uint8_t count = stream_count;
+		stream_count = 0;
+		current_state = CWA_STANDBY_FOR_CONFIG;
+		USB_Send_Data(stream_packet, count);
+	} else {
+		stream_idle = 1;
+	}
+}
+
+static int seekRawStart(uint32_t aFirstPage) {
+	
+	// Position the read iterator for a raw download from logical page
+	// aFirstPage, replying to the PC if the download can't start
+	
+	if (resetReadIterator()) {
+		send_error_result();
+		return -1;
+	}
+	if ((aFirstPage > 1) && seekLogicalPage(aFirstPage)) {
+		// Nothing after the pages the PC already holds
+		send_done();
+		return -1;
+	}
+	return 0;
+}
+
+static cwa_state startRawRead(uint32_t aFirstPage) {
+	
+	// Send the first page leader, the rest of the flash contents are sent by
+	// ready_for_tx_cb
+	
+	cwa_state move_to_state = CWA_CONFIG;
+	bool data_end = 0;
+	
+	transfer_size = INITIAL_TRANSFER_SIZE;
+	b_index = 0;
+	simple_tx_read_check = 0;
+	if (!seekRawStart(aFirstPage)) {
+		int loop;
+		uint8_t tmp[6];
+		for (loop = 0; loop < 6; loop++) {
+			tmp[loop] = 0;
+		}
+
+		// Send settling pattern & page number
+		tmp[2] = readPageHighByte();
+		tmp[3] = readPageLowByte();
+		
+		if (readPageToMemory(&data_end)) {
+
+			send_error_result();
+
+		} else {
+			transfer_size = INITIAL_TRANSFER_SIZE;
+		
+			// Move to CWA_READ_RAW state
+			move_to_state = CWA_READ_RAW;
+			current_state = CWA_READ_RAW;
+			USB_Send_Data(tmp, 6);
+		}
+	}
+	return move_to_state;
+}
+
+static cwa_state startStreamRaw(uint32_t aFirstPage) {
+	
+	// The pages are read by streamPages & sent by ready_for_tx_cb
+	
+	cwa_state move_to_state = CWA_CONFIG;
+	
+	simple_tx_read_check = 0;
+	if (!seekRawStart(aFirstPage)) {
+		resetStream();
+		
+		// Move to CWA_STREAM_RAW state
+		move_to_state = CWA_STREAM_RAW;
+		current_state = CWA_STREAM_RAW;
+	}
+	return move_to_state;
+}
+
 static cwa_state configure() {
 	
 	/*
@@ -782,39 +1105,26 @@ static cwa_state configure() {
 					}	
 				} break;
 
-			case READ_RAW_CHAR: {
-					// Read all the flash contents out to the PC
-					bool data_end = 0;					
-					transfer_size = INITIAL_TRANSFER_SIZE;
-					b_index = 0;
-					simple_tx_read_check = 0;			
-					if (resetReadIterator()) {
-	
-						send_error_result();
-	
-					} else {
-						int loop;
-						uint8_t tmp[6];
-						for (loop = 0; loop < 6; loop++) {
-							tmp[loop] = 0;
-						}
+			case READ_RAW_CHAR:
+				// Read all the flash contents out to the PC
+				move_to_state = startRawRead(1);
+				break;
 
-						// Send settling pattern & page number
-						tmp[2] = readPageHighByte();
-						tmp[3] = readPageLowByte();
-						
-						if (readPageToMemory(&data_end)) {
+			case STREAM_RAW_CHAR:
+				// Stream all the flash contents out to the PC
+				move_to_state = startStreamRaw(1);
+				break;
 
-							send_error_result();
-		
-						} else {
-							transfer_size = INITIAL_TRANSFER_SIZE;
-						
-							// Move to CWA_READ_RAW state
-							move_to_state = CWA_READ_RAW;
-							current_state = CWA_READ_RAW;
-							USB_Send_Data(tmp, 6);
-						}
+			case READ_RAW_FROM_CHAR: {
+					// Incremental download, the PC already holds the pages
+					// before the given logical page
+					uint32_t first_page = ((uint32_t) buffer_in[1] << 24) |
+						((uint32_t) buffer_in[2] << 16) |
+						((uint32_t) buffer_in[3] << 8) | buffer_in[4];
+					if (buffer_in[5]) {
+						move_to_state = startStreamRaw(first_page);
+					} else {
+						move_to_state = startRawRead(first_page);
 					}
 				} break;
 
@@ -952,6 +1262,25 @@ static cwa_state configure() {
 				move_to_state = readDebug();
 				break;
 				
+			case GET_PROFILE_CHAR: {
+					// Simple action to read (& optionally clear) the cycle
+					// count profile of one hot path plus the core clock
+					uint8_t tmp[PROFILE_REPLY_SIZE];
+					RCC_ClocksTypeDef clocks;
+					move_to_state = CWA_STANDBY_FOR_CONFIG;
+					if (profileReport(buffer_in[1] & ~PROFILE_CLEAR_FLAG, tmp,
+							buffer_in[1] & PROFILE_CLEAR_FLAG)) {
+						send_error_result();
+					} else {
+						RCC_GetClocksFreq(&clocks);
+						tmp[PROFILE_STATS_SIZE] = clocks.HCLK_Frequency >> 24;
+						tmp[PROFILE_STATS_SIZE + 1] = clocks.HCLK_Frequency >> 16;
+						tmp[PROFILE_STATS_SIZE + 2] = clocks.HCLK_Frequency >> 8;
+						tmp[PROFILE_STATS_SIZE + 3] = clocks.HCLK_Frequency;
+						USB_Send_Data(tmp, PROFILE_REPLY_SIZE);
+					}
+				} break;
+				
 			case SET_ACCEL_CONFIG_CHAR:
 				// Simple action to set the accelerometer & g scale config
 				move_to_state = CWA_STANDBY_FOR_CONFIG;
@@ -1136,6 +1465,9 @@ void ready_for_tx_cb() {
 		case CWA_READ_DBG:
 			readDebug();
 			break;
+		case CWA_STREAM_RAW:
+			sendStreamPacket();
+			break;
 	}
 	
 	simple_tx_read_check = 0;
@@ -1151,6 +1483,41 @@ static cwa_state waitForEndOfRead() {
 	return CWA_STANDBY_FOR_CONFIG;
 }
 
+static cwa_state streamPages() {
+	
+	/*
+	 * A full power state. Read the flash pages into whichever stream buffer is
+	 * free while ready_for_tx_cb sends the other. The sender only goes idle
+	 * when it has no transfer in flight, so restarting it from here cannot
+	 * race with the usb callback.
+	 */
+	
+	uint8_t fill = 0;
+	
+	while (proceed_as_normal && (CWA_STANDBY_FOR_CONFIG != current_state)) {
+		
+		if (!stream_end && !stream_full[fill]) {
+			uint8_t page_addr = 0;
+			
+			// Show data activity via blue led
+			BlueLed(1);
+			if (readNextPageToBuffer(stream_pages[fill], &page_addr)) {
+				stream_end = 1;
+			} else {
+				stream_page_addr[fill] = page_addr;
+				stream_full[fill] = 1;
+				fill ^= 1;
+			}
+			BlueLed(0);
+		}
+		
+		if (stream_idle)
+			sendStreamPacket();
+	}
+	
+	return CWA_STANDBY_FOR_CONFIG;
+}
+
 static cwa_state waitForCollectionTime() {
 	
 	// Low power state. Wait for time for collection to start.
@@ -1185,8 +1552,8 @@ static cwa_state collect() {
 	// Low power state. Collection of xyz values until number of samples or
 	// flash maximum reached.
 	
-	uint8_t crc_hi = 0xFF;
-	uint8_t crc_lo = 0xFF;
+	uint8_t crc_hi = CRC16_INITIAL_VALUE;
+	uint8_t crc_lo = CRC16_INITIAL_VALUE;
 
 	uint32_t tmp, max_samples = current_config.max_samples;
 	uint16_t u16_dr10 = accel_rate_and_g_scale;
@@ -1218,69 +1585,78 @@ static cwa_state collect() {
 	SPI_Configuration_Accelerometer(0);
 	
 	b_index = 0;
-	lastHalfPage = 0;
-	firstHalfPage = 0;
+	ring_fill = 0;
+	ring_write = 0;
+	sample_overruns = 0;
+	ring_tick[0] = RTC_GetCounter();
+	
+	compress_pages = (accel_rate_and_g_scale & ACCEL_COMPRESS_MASK) ? 1 : 0;
+	setCompressedPages(compress_pages);
+	packerReset(&packer, sample_ring[0]);
+	packer.next_page = sample_ring[1];
+	packed_half = 0;
 	
 	BKP_WriteBackupRegister(BKP_DR10, u16_dr10);
+#ifdef ACCEL_DMA
+	accelDmaInit();
+#endif
 	accelEnable();
 	
 	// Do an initial read to trigger the first call of the accelerometer
 	// interrupt handler
-	accelReadingBuf((uint8_t*)&(data_values[b_index]));
-	b_index+=6;
-	data_count++;
-
-	while (data_count < max_samples) {
+	readSample();
 
-		// Each interrupt - check whether have enough data to write half a page
-		// to flash
-		if (lastHalfPage) {
-			uint16_t loop;
+	// Continue until the samples are collected & the ring written out
+	while ((data_count < max_samples) || (ring_write != ring_fill)) {
 
-			// Calculate final checksum
-			for (loop = SAMPLE_HALF_PAGE; loop < SAMPLE_FULL_PAGE; loop++) {
-				uint8_t i = crc_hi ^ data_values[loop];
-				crc_hi = crc_lo ^ table_crc_hi[i];
-				crc_lo = table_crc_lo[i];
-			}
-			
-			data_values[SAMPLE_FULL_PAGE] = crc_hi;
-			data_values[SAMPLE_FULL_PAGE + 1] = crc_lo;
-    
-			if (writeFinalHalfPageToFlash()) {
-				writeStr("F1!");
-				break;
-			}
-			lastHalfPage = 0;
-			saveValue(BKP_DR5, data_count);
-			start_page_tick = RTC_GetCounter();
-		} else if (firstHalfPage) {
-			uint16_t loop;
-
-			crc_hi = 0xFF;
-			crc_lo = 0xFF;
-			
-			// Calculate checksum for first half page
-			for (loop = 0; loop < SAMPLE_HALF_PAGE; loop++) {
-				uint8_t i = crc_hi ^ data_values[loop];
-				crc_hi = crc_lo ^ table_crc_hi[i];
-				crc_lo = table_crc_lo[i];
-			}
+		// Write each half page the interrupt has filled, oldest first
+		if (ring_write != ring_fill) {
+			uint8_t page_idx = ringIndex(ring_write);
+			uint8_t* page = sample_ring[page_idx];
 			
-			if (writeFirstHalfPageToFlash()) {
-				writeStr("F0!");
-				break;
+			if (ring_write & 1) {
+				// Calculate final checksum
+				crc16Update(&crc_hi, &crc_lo, &page[SAMPLE_HALF_PAGE],
+					SAMPLE_FULL_PAGE - SAMPLE_HALF_PAGE);
+				
+				page[SAMPLE_FULL_PAGE] = crc_hi;
+				page[SAMPLE_FULL_PAGE + 1] = crc_lo;
+				
+				start_page_tick = ring_tick[page_idx];
+				if (writeFinalHalfPageToFlash(page)) {
+					writeStr("F1!");
+					break;
+				}
+				saveValue(BKP_DR5, ring_count[page_idx]);
+			} else {
+				crc_hi = CRC16_INITIAL_VALUE;
+				crc_lo = CRC16_INITIAL_VALUE;
+				
+				// Calculate checksum for first half page
+				crc16Update(&crc_hi, &crc_lo, page, SAMPLE_HALF_PAGE);
+				
+				if (writeFirstHalfPageToFlash(page)) {
+					writeStr("F0!");
+					break;
+				}
 			}
-			firstHalfPage = 0;
+			ring_write++;
+		} else {
+			// Idle, erase the next block ahead of the writes
+			eraseAheadTask();
+			collectPowerDown();
 		}
-
-		powerDown();
 	}
 	
 	saveValue(BKP_DR5, data_count);
 	storeEndTick(RTC_GetCounter());
 	storeEndSamples(data_count);
 	
+#ifdef ACCEL_DMA
+	// Let a sample read in flight finish before taking the bus back
+	while (accelDmaBusy());
+	accelDmaShutdown();
+#endif
 	SPI_Configuration_Accelerometer(0);
 	accelDisable();
 	SPI_Configuration_TempSensor();
@@ -1364,6 +1740,7 @@ int main(void) {
 	// Set up BioBand hardware
 	Set_System();
 	GPIO_Configuration();
+	profileInit();
 	
 	resetDbg();
 	
@@ -1606,6 +1983,10 @@ int main(void) {
 		case CWA_READ_DBG:
 			current_state = waitForEndOfRead();
 			break;
+		case CWA_STREAM_RAW:
+			writeStr("RS");
+			current_state = streamPages();
+			break;
 		case CWA_STANDBY_FOR_COLLECT:
 #ifdef ENABLE_BATTERY_LEVEL
 			if (adc_configured) {
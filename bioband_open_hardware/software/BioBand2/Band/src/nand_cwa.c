@@ -47,6 +47,7 @@
 #include "nand_cwa.h"
 #include "shared.h"
 #include "debug.h"
+#include "profile.h"
 
 // ----
 
@@ -76,11 +77,12 @@
 // Page debug area size definitions
 
 // -1 for the dbg len at start
-const uint8_t page0_dbg_size = FLASH_PAGE - VERSION_ADDR - VERSION_SIZE - 1;
+const uint8_t page0_dbg_size =
+	OVERRUN_COUNT_ADDR - VERSION_ADDR - VERSION_SIZE - 1;
 const uint8_t page1_dbg_size =
-	FLASH_PAGE - ACTION_EPOC_ADDR - EPOC_TIME_SIZE - 1;
+	OVERRUN_COUNT_ADDR - ACTION_EPOC_ADDR - EPOC_TIME_SIZE - 1;
 const uint8_t pageN_dbg_size =
-	FLASH_PAGE - TEMP_LEVEL_ADDR - TEMP_LEVEL_SIZE - 1;
+	OVERRUN_COUNT_ADDR - TEMP_LEVEL_ADDR - TEMP_LEVEL_SIZE - 1;
 
 // ----
 
@@ -96,6 +98,8 @@ extern uint32_t start_page_tick;
 extern uint16_t currentBatteryVoltage;
 extern uint16_t currentTemperature;
 
+extern volatile uint16_t sample_overruns;
+
 extern uint8_t accel_rate_and_g_scale;
 
 // ----
@@ -112,12 +116,102 @@ uint8_t last_page_in_block = 0;
 
 uint8_t status = OK_USED_STATUS;
 
+// Samples dropped (main.c) as of the last page written
+static uint16_t recorded_overruns = 0;
+
+// Set for collections storing compressed pages, flagged in each page's status
+bool compressed_pages = 0;
+
+// ----
+
+// Erase ahead, the block after the one being written is erased in the idle
+// time between half page writes (eraseAheadTask) so provisionNextBlock need
+// not wait ms for an erase in the sampling path. The erase runs in the NAND
+// while the MCU sleeps, any other NAND operation waits for it (nandWriteCmd).
+
+#define ERASE_AHEAD_IDLE	0 // no block erased ahead
+#define ERASE_AHEAD_BUSY	1 // erase of erase_ahead_block in progress
+#define ERASE_AHEAD_READY	2 // erase_ahead_block erased, ready to write
+
+static uint8_t erase_ahead_state = ERASE_AHEAD_IDLE;
+static uint16_t erase_ahead_block = 0;
+
+static void finishEraseAhead();
+
+// ----
+
+// Block map, built from flash by buildBlockMap and held until the next erase,
+// bad block marking or first page program. 2 bits per block, blocks at or
+// beyond map_end_block hold no data.
+
+#define BLOCK_BAD			0
+#define BLOCK_USED			1 // all pages usable
+#define BLOCK_PARTIAL		2 // marked by us part way through the block
+
+#define BLOCKS_PER_MAP_BYTE	4
+#define ALL_USED_MAP_BYTE	0x55
+
+#define MAX_PARTIAL_BLOCKS	16
+
+struct partial_block {
+	uint16_t block;
+	uint8_t last_page;
+};
+
+static uint8_t block_map[MAX_BLOCKS / BLOCKS_PER_MAP_BYTE];
+static struct partial_block partial_blocks[MAX_PARTIAL_BLOCKS];
+static uint8_t num_partial_blocks = 0;
+static uint16_t map_end_block = 0;
+static uint16_t final_block = MAX_BLOCKS; // block holding the last data page
+static uint8_t final_block_pages = 0;
+static uint8_t block_map_valid = 0;
+// too many partial blocks to map, don't rescan until the flash changes
+static uint8_t block_map_overflow = 0;
+
 GPIO_InitTypeDef NAND_GPIO_InitStructure;
 
 // ----
 
+static void invalidateBlockMap() {
+	block_map_valid = 0;
+	block_map_overflow = 0;
+}
+
+// ----
+
 // Core Nand functions
 
+#ifdef NAND_DIRECT_GPIO
+
+/*
+ * Direct register bus cycles (build with -DNAND_DIRECT_GPIO)
+ * 
+ * Each byte is two BSRR writes (data bits, NCE & NWE low together then NWE
+ * high) or a BRR write, an IDR read and a BSRR write rather than the
+ * read-modify-write & four calls of the GPIO library versions. NCE is held low
+ * from the first cycle of an operation to nandDeselect(). Relies on the data
+ * and control lines sharing GPIOB, the data bus being the whole of CRH
+ * (pins 8-15) and, since NCE is held, the temperature sensor not sharing
+ * NAND_NCE (v1.2 hardware).
+ */
+
+#if CWA_VERSION < 12
+#error "NAND_DIRECT_GPIO needs v1.2 hardware (temp sensor NCS not on NAND_NCE)"
+#endif
+
+#define NAND_DATA_OUTPUT_CRH	0x33333333 // push-pull 50MHz
+#define NAND_DATA_INPUT_CRH		0x44444444 // floating input
+
+static void nand_cwa_data_bus_write_mode() {
+	NAND_DATA_PORT->CRH = NAND_DATA_OUTPUT_CRH;
+}
+
+static void nand_cwa_data_bus_read_mode() {
+	NAND_DATA_PORT->CRH = NAND_DATA_INPUT_CRH;
+}
+
+#else
+
 static void nand_cwa_data_bus_write_mode() {
 	NAND_GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
 	NAND_GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_PP;
@@ -136,6 +230,8 @@ static void nand_cwa_data_bus_read_mode() {
 	GPIO_Init(NAND_DATA_PORT, &NAND_GPIO_InitStructure);
 }
 
+#endif // NAND_DIRECT_GPIO
+
 void nand_cwa_init() {
 	// Enable clocks to GPIO otherwise nothing happens
 	RCC_APB2PeriphClockCmd(NAND_RCC_CONTROL_PORT, ENABLE);
@@ -164,6 +260,32 @@ void nand_cwa_init() {
 	nand_cwa_data_bus_write_mode();
 }
 
+#ifdef NAND_DIRECT_GPIO
+
+static void nandWriteByte(uint8_t aByte) {
+	NAND_DATA_PORT->BSRR = ((uint32_t) aByte << 8) |
+		((uint32_t) (uint8_t) ~aByte << 24) | ((NAND_NCE | NAND_NWE) << 16);
+	NAND_CONTROL_PORT->BSRR = NAND_NWE;
+}
+
+static uint8_t nandReadByte() {
+	uint8_t val;
+	NAND_CONTROL_PORT->BRR = NAND_NCE | NAND_NRE;
+	val = (NAND_DATA_PORT->IDR >> 8) & 0xff;
+	NAND_CONTROL_PORT->BSRR = NAND_NRE;
+	return val;
+}
+
+static void nandDeselect() {
+	NAND_CONTROL_PORT->BSRR = NAND_NCE;
+}
+
+static int nandBusy() {
+	return !(NAND_CONTROL_PORT->IDR & NAND_RNB);
+}
+
+#else
+
 static void nandWriteByte(uint8_t aByte) {
 	// There must be an easier way
 	GPIO_WriteBit(NAND_CONTROL_PORT,NAND_NCE,Bit_RESET);
@@ -191,8 +313,23 @@ static uint8_t nandReadByte() {
 	return val;
 }
 
+static void nandDeselect() {
+	// NCE already raised after each byte
+}
+
+static int nandBusy() {
+	return GPIO_ReadInputDataBit(NAND_CONTROL_PORT,NAND_RNB) == Bit_RESET;
+}
+
+#endif // NAND_DIRECT_GPIO
+
 static void nandWriteCmd(uint8_t aCmd) {
 	// Assumes NCE already reset and data bus in write mode
+	if ((ERASE_AHEAD_BUSY == erase_ahead_state) &&
+		(READ_STATUS_COMMAND != aCmd)) {
+		// The device accepts nothing else until the erase completes
+		finishEraseAhead();
+	}
 	GPIO_WriteBit(NAND_CONTROL_PORT,NAND_CLE,Bit_SET);
 	nandWriteByte(aCmd);
 	GPIO_WriteBit(NAND_CONTROL_PORT,NAND_CLE,Bit_RESET);
@@ -223,19 +360,21 @@ void readDeviceId(struct nand_identity* aResult) {
 	aResult->fourth = nandReadByte();
 	aResult->fifth  = nandReadByte();
 	nand_cwa_data_bus_write_mode();
+	nandDeselect();
 	
 }
 
 static uint8_t readStatus() {
 	uint8_t result;
 	
-	while (GPIO_ReadInputDataBit(NAND_CONTROL_PORT,NAND_RNB) == Bit_RESET) {}
+	while (nandBusy()) {}
 	
 	nandWriteCmd(READ_STATUS_COMMAND);
 	
 	nand_cwa_data_bus_read_mode();
 	result = nandReadByte();
 	nand_cwa_data_bus_write_mode();
+	nandDeselect();
 	
 	return result;
 }
@@ -273,7 +412,7 @@ static void readData(uint16_t aBlockAddr, uint16_t aPageAddr,
 	
 	// Wait until the page is loaded into the data registers
 	// TODO check is there anyway this could loop forever?
-	while (GPIO_ReadInputDataBit(NAND_CONTROL_PORT,NAND_RNB) == Bit_RESET) {}
+	while (nandBusy()) {}
 	
 	nand_cwa_data_bus_read_mode();
 	for(loop = 0; loop < aNumBytes; loop++) {
@@ -281,6 +420,7 @@ static void readData(uint16_t aBlockAddr, uint16_t aPageAddr,
 		ptr++;
 	}
 	nand_cwa_data_bus_write_mode();
+	nandDeselect();
 	
 }
 
@@ -337,6 +477,13 @@ static void programConfigData() {
 		
 		// Store fw/hw versions
 		nandWriteByte(version_byte);
+	} else {
+		// Keep the following spare area bytes in place, 0xFFs leave the
+		// flash unaltered
+		for(loop = 0; loop < EPOC_TIME_SIZE + ACCEL_CONFIG_SIZE + VERSION_SIZE;
+			loop++) {
+			nandWriteByte(0xFF);
+		}
 	}
 }
 
@@ -345,9 +492,10 @@ static void programSpareArea() {
 	// Handles the writing to all bytes past the bad block marker
 	
 	uint8_t max_dbg_sz = pageN_dbg_size;
-	uint8_t dbg_sz;
+	uint8_t dbg_sz, dbg_written = 0;
 	uint16_t loop;
 	uint8_t* byte_ptr;
+	uint16_t overruns = sample_overruns;
 	
 #ifdef ENABLE_TEMPERATURE
 	// Temp is read in accelIntrHandler (main.c)
@@ -362,8 +510,15 @@ static void programSpareArea() {
 	// Spare page bytes
 	byte_ptr = (uint8_t*) &start_page_tick;
 	
+	if (overruns != recorded_overruns) {
+		// Samples were dropped since the last page
+		status = status & COLLECT_LOSS_MASK;
+		recorded_overruns = overruns;
+	}
+	
 	// Status
-	nandWriteByte(status);
+	nandWriteByte((compressed_pages ? (status | COMPRESSED_MASK) : status) |
+		OVERRUN_COUNT_MASK);
 	status = OK_USED_STATUS;
 	
 	// Store current tick
@@ -440,7 +595,7 @@ static void programSpareArea() {
 		nandWriteByte('P');
 		nandWriteByte(current_page);
 		nandWriteByte(current_page>>8);
-		
+		dbg_written = 6;
 			
 	} else {
 		// Debug data to store
@@ -458,9 +613,21 @@ static void programSpareArea() {
 				if (stop)
 					break;
 				nandWriteByte(byte);
+				dbg_written++;
 			}
 		}
 	}
+	
+	// Skip the unused debug space (0xFFs leave the flash unaltered)
+	for (; dbg_written < max_dbg_sz; dbg_written++) {
+		nandWriteByte(0xFF);
+	}
+	
+	// Store the samples dropped so far
+	byte_ptr = (uint8_t*) &overruns;
+	for(loop = 0; loop < OVERRUN_COUNT_SIZE; loop++) {
+		nandWriteByte(*byte_ptr++);
+	}
 }
 
 static int markBadBlock(uint16_t aBlockAddr, uint8_t aMarker) {
@@ -470,6 +637,8 @@ static int markBadBlock(uint16_t aBlockAddr, uint8_t aMarker) {
 	
 	writeStr("Mkbb");
 	
+	invalidateBlockMap();
+	
 	// Any block where the 1st Byte in the spare area of the 1st or 2nd page (if
 	// the 1st page is Bad) does not contain FFh it's a Bad Block.
 	
@@ -503,6 +672,9 @@ static void markUsed() {
 	
 	writeStr("MkUsd");
 	
+	if (FIRST_PAGE == current_page)
+		invalidateBlockMap();
+	
 	setAddress(current_block, current_page, PAGE_STATUS_ADDR, fiveCycleAddress);
 	
 	nandWriteCmd(PROGRAM_PAGE_CYCLE1);
@@ -559,6 +731,121 @@ uint16_t findNextBadBlock(uint16_t aStartBlockAddr,uint8_t* aByte,
 	return found;
 }
 
+static uint8_t blockClass(uint16_t aBlock) {
+	return (block_map[aBlock / BLOCKS_PER_MAP_BYTE] >>
+		((aBlock % BLOCKS_PER_MAP_BYTE) * 2)) & 0x03;
+}
+
+static void setBlockClass(uint16_t aBlock, uint8_t aClass) {
+	uint8_t shift = (aBlock % BLOCKS_PER_MAP_BYTE) * 2;
+	uint8_t* byte_ptr = &block_map[aBlock / BLOCKS_PER_MAP_BYTE];
+	*byte_ptr = (*byte_ptr & ~(0x03 << shift)) | (aClass << shift);
+}
+
+static uint8_t mappedLastPage(uint16_t aBlock) {
+	// Page limit as findNextUsedBlock2 would return it
+	uint8_t loop;
+	if (BLOCK_PARTIAL == blockClass(aBlock)) {
+		for (loop = 0; loop < num_partial_blocks; loop++) {
+			if (partial_blocks[loop].block == aBlock)
+				return partial_blocks[loop].last_page;
+		}
+	}
+	return MAX_PAGES_PER_BLOCK;
+}
+
+static uint8_t mappedUsedPages(uint16_t aBlock) {
+	// Number of pages holding data
+	if (BLOCK_BAD == blockClass(aBlock))
+		return 0;
+	if (final_block == aBlock)
+		return final_block_pages;
+	return mappedLastPage(aBlock);
+}
+
+static int buildBlockMap() {
+	
+	// One pass over the blocks, same checks as findNextUsedBlock2 plus a
+	// look at the last page to find where the data ends (blocks beyond may
+	// still hold an old capture)
+	
+	uint16_t block;
+	uint8_t byte, dummy;
+	
+	block_map_valid = 0;
+	num_partial_blocks = 0;
+	final_block = MAX_BLOCKS;
+	final_block_pages = 0;
+	
+	for (block = FIRST_BLOCK; block < MAX_BLOCKS; block++) {
+		uint8_t block_class = BLOCK_USED;
+		uint8_t last_page = MAX_PAGES_PER_BLOCK;
+		
+		if (checkBadBlock(block, &byte, &dummy)) {
+			block_class = BLOCK_BAD;
+			if ((byte > OUR_BAD_BLOCK_INDICATOR) &&
+				(byte <= MAX_PAGES_PER_BLOCK)) {
+				block_class = BLOCK_PARTIAL;
+				last_page = byte - OUR_BAD_BLOCK_INDICATOR;
+			}
+		}
+		
+		if (BLOCK_BAD != block_class) {
+			readData(block, FIRST_PAGE, PAGE_STATUS_ADDR, &byte, 1);
+			if (UNUSED_PAGE == byte) {
+				// Unused, end of data
+				break;
+			}
+			
+			if (BLOCK_PARTIAL == block_class) {
+				if (MAX_PARTIAL_BLOCKS == num_partial_blocks) {
+					// Too many to hold, callers fall back to reading flash
+					block_map_overflow = 1;
+					return -1;
+				}
+				partial_blocks[num_partial_blocks].block = block;
+				partial_blocks[num_partial_blocks].last_page = last_page;
+				num_partial_blocks++;
+			}
+			
+			final_block = block;
+			final_block_pages = last_page;
+			
+			readData(block, last_page - 1, PAGE_STATUS_ADDR, &byte, 1);
+			if (UNUSED_PAGE == byte) {
+				// Data ends in this block, pages are written in order so
+				// binary search for the first unused one
+				uint8_t used = FIRST_PAGE;
+				uint8_t unused = last_page - 1;
+				while (unused - used > 1) {
+					uint8_t mid = (used + unused) / 2;
+					readData(block, mid, PAGE_STATUS_ADDR, &byte, 1);
+					if (UNUSED_PAGE == byte)
+						unused = mid;
+					else
+						used = mid;
+				}
+				final_block_pages = unused;
+				setBlockClass(block, block_class);
+				block++;
+				break;
+			}
+		}
+		
+		setBlockClass(block, block_class);
+	}
+	
+	map_end_block = block;
+	block_map_valid = 1;
+	return 0;
+}
+
+static int ensureBlockMap() {
+	if (!block_map_valid && !block_map_overflow)
+		buildBlockMap();
+	return block_map_valid ? 0 : -1;
+}
+
 static uint16_t findNextUsedBlock(uint16_t aStartBlockAddr) {
 	
 	// Sequential search for the next used block
@@ -566,6 +853,14 @@ static uint16_t findNextUsedBlock(uint16_t aStartBlockAddr) {
 	uint16_t block = aStartBlockAddr;
 	uint8_t byte, dummy;
 	
+	if (block_map_valid) {
+		for (; block < map_end_block; block++) {
+			if (BLOCK_USED == blockClass(block))
+				return block;
+		}
+		return MAX_BLOCKS;
+	}
+	
 	while (block < MAX_BLOCKS) {
 		
 		if (!checkBadBlock(block, &byte, &dummy)) {
@@ -597,6 +892,16 @@ static uint16_t findNextUsedBlock2(uint16_t aStartBlockAddr,
 	
 	*aLastPage = MAX_PAGES_PER_BLOCK;
 	
+	if (block_map_valid) {
+		for (; block < map_end_block; block++) {
+			if (BLOCK_BAD != blockClass(block)) {
+				*aLastPage = mappedLastPage(block);
+				return block;
+			}
+		}
+		return MAX_BLOCKS;
+	}
+	
 	while (block < MAX_BLOCKS) {
 		
 		int bad = checkBadBlock(block, &byte, &dummy);
@@ -632,13 +937,10 @@ uint16_t findFirstUsedBlock(uint8_t* aLastPage) {
 	return findNextUsedBlock2(FIRST_BLOCK, aLastPage);
 }
 
-static int eraseBlock(uint16_t aBlockAddr) {
+static void startErase(uint16_t aBlockAddr) {
 	uint8_t threeCycleAddress[3];
-	int loop;
-	int retval =0;
 	
-	if (aBlockAddr >= MAX_BLOCKS)
-		return -1;
+	invalidateBlockMap();
 		
 	/*
 	 * 3rd Cycle A19 A18 A17 A16 A15 A14 A13 A12	< Row 1
@@ -654,6 +956,17 @@ static int eraseBlock(uint16_t aBlockAddr) {
 	nandWriteCmd(ERASE_BLOCK_SETUP);
 	nandWriteAddr(threeCycleAddress,3);
 	nandWriteCmd(ERASE_COMMAND);
+}
+
+static int eraseBlock(uint16_t aBlockAddr) {
+	int retval =0;
+	uint32_t prof_start;
+	
+	if (aBlockAddr >= MAX_BLOCKS)
+		return -1;
+	
+	prof_start = profileStart();
+	startErase(aBlockAddr);
 	
 	retval = readStatus() & 0x01;
 	
@@ -662,11 +975,11 @@ static int eraseBlock(uint16_t aBlockAddr) {
 		markBadBlock(aBlockAddr, OUR_BAD_BLOCK_INDICATOR);
 	}
 	
+	profileEnd(PROF_ERASE_BLOCK, prof_start);
 	return retval;
 }
 
-static int isValidErasedBlock(uint16_t aBlock) {
-	uint8_t retval = 0;
+static int isValidBlock(uint16_t aBlock) {
 	uint8_t byte, dummy;
 	
 	if (checkBadBlock(aBlock, &byte, &dummy)) {
@@ -677,11 +990,63 @@ static int isValidErasedBlock(uint16_t aBlock) {
 			if (!eraseBlock(aBlock))
 				markBadBlock(aBlock, OUR_BAD_BLOCK_INDICATOR);
 		}
-	} else {
-		// Valid block
-		retval = !eraseBlock(aBlock);
+		return 0;
+	}
+	return 1;
+}
+
+static int isValidErasedBlock(uint16_t aBlock) {
+	return isValidBlock(aBlock) && !eraseBlock(aBlock);
+}
+
+static void finishEraseAhead() {
+	
+	// Wait for the erase ahead to complete, a failed block is marked bad and
+	// the next eraseAheadTask moves on from it
+	
+	erase_ahead_state = ERASE_AHEAD_READY;
+	if (readStatus() & 0x01) {
+		erase_ahead_state = ERASE_AHEAD_IDLE;
+		markBadBlock(erase_ahead_block, OUR_BAD_BLOCK_INDICATOR);
+	}
+}
+
+static void cancelEraseAhead() {
+	if (ERASE_AHEAD_BUSY == erase_ahead_state)
+		finishEraseAhead();
+	erase_ahead_state = ERASE_AHEAD_IDLE;
+	erase_ahead_block = 0;
+}
+
+void eraseAheadTask() {
+	
+	// Advance the erase ahead by at most one NAND operation, called while
+	// collecting between half page writes
+	
+	switch (erase_ahead_state) {
+		case ERASE_AHEAD_IDLE:
+			if (erase_ahead_block <= current_block)
+				erase_ahead_block = current_block + 1;
+			if (erase_ahead_block >= MAX_BLOCKS)
+				break;
+			if (isValidBlock(erase_ahead_block)) {
+				startErase(erase_ahead_block);
+				erase_ahead_state = ERASE_AHEAD_BUSY;
+			} else {
+				// Try the following block next time
+				erase_ahead_block++;
+			}
+			break;
+		
+		case ERASE_AHEAD_BUSY:
+			if (!nandBusy())
+				finishEraseAhead();
+			break;
+		
+		default:
+			// Erased block waiting for provisionNextBlock
+			break;
 	}
-	return retval;
 }
 
 void resetAllValidBlocks() {
@@ -695,6 +1060,8 @@ int resetWriteIterator() {
 	
 	// Reset the current block and page indexes
 	
+	cancelEraseAhead();
+	recorded_overruns = 0;
 	for (current_block = 0; current_block < MAX_BLOCKS; current_block++) {
 		if (isValidErasedBlock(current_block)) {
 			// Successfully found the first valid block and erased it
@@ -711,7 +1078,8 @@ int resetWriteIterator() {
 	return 0;
 }
 
-static int programPage(uint16_t startIdx, uint16_t endIdx) {
+static int programPage(const uint8_t* aPage, uint16_t startIdx,
+	uint16_t endIdx) {
 	
 	// Handles the programming of the Nand page according to the supplied start
 	// and end indexes
@@ -719,6 +1087,10 @@ static int programPage(uint16_t startIdx, uint16_t endIdx) {
 	int retval = 0;
 	uint8_t fiveCycleAddress[5];
 	uint16_t loop;
+	uint32_t prof_start = profileStart();
+	
+	if (FIRST_PAGE == current_page)
+		invalidateBlockMap();
 	
 	setAddress(current_block, current_page, startIdx, fiveCycleAddress);
 	
@@ -726,7 +1098,7 @@ static int programPage(uint16_t startIdx, uint16_t endIdx) {
 	nandWriteAddr(fiveCycleAddress,5);
 	
 	for(loop = startIdx; loop < endIdx; loop++) {
-		nandWriteByte(data_values[loop]);
+		nandWriteByte(aPage[loop]);
 	}
 	
 	if (PAGE_SIZE == endIdx) {
@@ -746,29 +1118,39 @@ static int programPage(uint16_t startIdx, uint16_t endIdx) {
 		
 		current_page = MAX_PAGES_PER_BLOCK;
 	}
+	profileEnd(PROF_PROGRAM_PAGE, prof_start);
 	return retval;
 }
 
 static void provisionNextBlock() {
 	
-	// Find and erase the next valid block
+	// Find and erase the next valid block, unless already erased ahead
 	
 	current_block++;
 	
-	while (current_block < MAX_BLOCKS) {
-		if (isValidErasedBlock(current_block)) {
-			// Successfully found a valid block and erased it
-			break;
+	if (ERASE_AHEAD_BUSY == erase_ahead_state)
+		finishEraseAhead();
+	
+	if (ERASE_AHEAD_READY == erase_ahead_state) {
+		// Any blocks the erase ahead stepped over are bad
+		current_block = erase_ahead_block;
+		erase_ahead_state = ERASE_AHEAD_IDLE;
+	} else {
+		while (current_block < MAX_BLOCKS) {
+			if (isValidErasedBlock(current_block)) {
+				// Successfully found a valid block and erased it
+				break;
+			}
+			current_block++;
 		}
-		current_block++;
 	}
 	current_page = FIRST_PAGE;
 	backupFlashIndexs();
 }
 
-int writeFirstHalfPageToFlash() {
+int writeFirstHalfPageToFlash(const uint8_t* aPage) {
 	
-	// Store the first half of the sample data to Nand flash
+	// Store the first half of the sample data in aPage to Nand flash
 	
 	int retval = -1;	
     
@@ -784,28 +1166,28 @@ int writeFirstHalfPageToFlash() {
 			}
 		}
 		
-		retval = programPage(0, SAMPLE_HALF_PAGE);
+		retval = programPage(aPage, 0, SAMPLE_HALF_PAGE);
 	}
 	
 	return retval;
 }
 
-int writeFinalHalfPageToFlash() {
+int writeFinalHalfPageToFlash(const uint8_t* aPage) {
 	
-	// Store the remainder of the sample data to Nand flash
+	// Store the remainder of the sample data in aPage to Nand flash
 	
 	int retval = -1;
 	
 	while (retval && (current_block < MAX_BLOCKS)) {
 		
-		retval = programPage(SAMPLE_HALF_PAGE, PAGE_SIZE);
+		retval = programPage(aPage, SAMPLE_HALF_PAGE, PAGE_SIZE);
 		if (retval) {
 			// Second half of page failed, attempt with a new block
 			
 			// Potential that the first half page has already been tainted by
 			// new data but that's the risk we have to take
 			
-			writeFirstHalfPageToFlash(); // <- we deliberately do not set retval
+			writeFirstHalfPageToFlash(aPage); // <- deliberately not retval
 		}
 	}
 	
@@ -824,10 +1206,16 @@ int writeFinalHalfPageToFlash() {
 	return retval;
 }
 
+void setCompressedPages(bool aCompressed) {
+	compressed_pages = aCompressed;
+}
+
 int resetReadIterator() {
 	
 	// Reset the read block and page indexes
 	
+	ensureBlockMap();
+	
 	read_block = findFirstUsedBlock(&last_page_in_block);
 	if (MAX_BLOCKS == read_block) {
 		// No viable blocks - nothing to read
@@ -842,13 +1230,18 @@ int readPageToMemory(bool* aDataEnd) {
 
 	// Read the Nand flash page to memory
 	
+	return readPageToBuffer(data_values, aDataEnd);
+}
+
+static int readPageAndAdvance(uint8_t* aBuffer, bool* aDataEnd) {
+	
 	*aDataEnd = 0;
 	
 	if (MAX_BLOCKS <= read_block)
 		return -1;
 		
-	readData(read_block, read_page, 0, data_values, (uint16_t) FLASH_PAGE);
-	if (UNUSED_PAGE == data_values[PAGE_STATUS_ADDR]) {
+	readData(read_block, read_page, 0, aBuffer, (uint16_t) FLASH_PAGE);
+	if (UNUSED_PAGE == aBuffer[PAGE_STATUS_ADDR]) {
 		// End of data
 		*aDataEnd = 1;
 		return -2;
@@ -868,27 +1261,87 @@ int readPageToMemory(bool* aDataEnd) {
 	return 0;
 }
 
-int readLogicalPage(uint16_t pagenum) {
+int readPageToBuffer(uint8_t* aBuffer, bool* aDataEnd) {
+
+	// Read the Nand flash page to the given page sized buffer
 	
-	// Find a particular page number (absolute rather than relative to the
-	// block being read)
+	uint32_t prof_start = profileStart();
+	int retval = readPageAndAdvance(aBuffer, aDataEnd);
+	profileEnd(PROF_READ_PAGE, prof_start);
+	return retval;
+}
+
+int readNextPageToBuffer(uint8_t* aBuffer, uint8_t* aPageAddr) {
+
+	// Streamed download helper, unlike readPageToMemory the final page of a
+	// fully used last block is reported as read rather than as the end
 	
-	int count = 1;
+	bool data_end = 0;
+	
+	if (MAX_BLOCKS <= read_block)
+		return -1;
+	
+	*aPageAddr = read_page;
+	if (-2 == readPageToBuffer(aBuffer, &data_end))
+		return -1;
+	return 0;
+}
+
+int seekLogicalPage(uint32_t pagenum) {
+	
+	// Position the read iterator at a particular page number (absolute rather
+	// than relative to the block being read) so the next readPageToBuffer or
+	// readNextPageToBuffer reads it
+	
+	uint32_t count = 1;
 	uint8_t last_page, byte, page;
-	uint16_t block = findFirstUsedBlock(&last_page);
+	uint16_t block;
 	
 	if (pagenum < 1)
 		return -1;
 	
+	if (!ensureBlockMap()) {
+		// Count along the map, 4 blocks at a time where all are fully used
+		uint32_t first = 1; // logical page number of the block's first page
+		
+		for (block = FIRST_BLOCK; block < map_end_block; block++) {
+			uint8_t pages;
+			
+			if (!(block % BLOCKS_PER_MAP_BYTE) &&
+				(block + BLOCKS_PER_MAP_BYTE <= final_block) &&
+				(ALL_USED_MAP_BYTE == block_map[block / BLOCKS_PER_MAP_BYTE])) {
+				uint32_t next = first +
+					(BLOCKS_PER_MAP_BYTE * MAX_PAGES_PER_BLOCK);
+				if (pagenum >= next) {
+					first = next;
+					block += BLOCKS_PER_MAP_BYTE - 1;
+					continue;
+				}
+			}
+			
+			pages = mappedUsedPages(block);
+			if (pagenum < first + pages) {
+				// Found the required page
+				read_block = block;
+				read_page = pagenum - first;
+				last_page_in_block = mappedLastPage(block);
+				return 0;
+			}
+			first += pages;
+		}
+		return -1;
+	}
+	
+	block = findFirstUsedBlock(&last_page);
 	while (block < MAX_BLOCKS) {
 
 		for (page = FIRST_PAGE; page < last_page; page++) {
 			if (count == pagenum) {
 				// Found the required page
-				bool dummy = 0;
 				read_block = block;
 				read_page = page;
-				return readPageToMemory(&dummy);
+				last_page_in_block = last_page;
+				return 0;
 			} else {
 				readData(block, page, PAGE_STATUS_ADDR, &byte, 1);
 				if (UNUSED_PAGE == byte) {
@@ -904,6 +1357,17 @@ int readLogicalPage(uint16_t pagenum) {
 	return -1;
 }
 
+int readLogicalPage(uint16_t pagenum) {
+	
+	// Read a particular page number to memory
+	
+	bool dummy = 0;
+	
+	if (seekLogicalPage(pagenum))
+		return -1;
+	return readPageToMemory(&dummy);
+}
+
 int doesDataExist() {
 	
 	// Fast check for any data, i.e stored in the first valid page in flash
@@ -986,8 +1450,6 @@ void storeCurrentConfig() {
 	
 	// Store current config data to the spare area of the first page
 	int retval;
-	uint16_t loop;
-	uint8_t* byte_ptr;
 	uint8_t fiveCycleAddress[5];
 	
 	setAddress(current_block, current_page, BAND_ID_ADDR, fiveCycleAddress);
@@ -1194,13 +1656,22 @@ uint32_t retrieveStartTimeTicksAndSamples(uint32_t* aCollectStartTime,
 			uint32_t page_count = 0;
 			uint8_t byte, page;
 			uint16_t last_block;
-			uint8_t last_used_page = MAX_PAGES_PER_BLOCK - 1;
 			uint8_t* byte_ptr = (uint8_t*) aCollectStartTime;
 			
 			// Read the start collect epoc time
 			readData(block, FIRST_PAGE, START_EPOC_ADDR, byte_ptr,
 				EPOC_TIME_SIZE);
 			
+			if (!ensureBlockMap()) {
+				// Page count & last page straight from the map
+				for (; block < map_end_block; block++) {
+					page_count += mappedUsedPages(block);
+				}
+				block = MAX_BLOCKS;
+				last_block = final_block;
+				last_page = final_block_pages - 1;
+			}
+			
 			// Find the last block
 			while (block < MAX_BLOCKS) {
 				
@@ -1239,7 +1710,10 @@ unsigned int readNextSetOfBatteryLevels(int aMaxSize, uint16_t* aBlockAddr) {
 	
 	int retval = 0;
 	uint8_t dummy;
-	uint16_t block = findNextUsedBlock(*aBlockAddr);
+	uint16_t block;
+	int mapped = !ensureBlockMap();
+	
+	block = findNextUsedBlock(*aBlockAddr);
 	
 	// Store a set of battery level values in memory ready for transfer by USB
 	
@@ -1250,7 +1724,7 @@ unsigned int readNextSetOfBatteryLevels(int aMaxSize, uint16_t* aBlockAddr) {
 			BATTERY_LEVEL_SIZE);
 		retval += BATTERY_LEVEL_SIZE;
 
-		if (isLastUsedBlock(block,&dummy)) {
+		if (mapped ? (block == final_block) : isLastUsedBlock(block,&dummy)) {
 			block = MAX_BLOCKS;
 			break;
 		}
@@ -1266,7 +1740,6 @@ unsigned int readNextSetOfTempLevels(int aMaxSize, uint8_t* aPageAddr,
 	uint8_t* aLastPageAddr, uint16_t* aBlockAddr) {
 	
 	int retval = 0;
-	bool finish = 0;
 	uint16_t block = *aBlockAddr;
 	uint8_t page = *aPageAddr;
 	uint8_t byte;
@@ -1324,10 +1797,10 @@ uint8_t readPageLowByte() {
 // Restore/backup functions (battery backed storage)
 
 void restoreFlashIndexs() {
-	uint8_t byte;
 	
 	status = status & COLLECT_LOSS_MASK;
 	
+	cancelEraseAhead();
 	current_block = BKP_ReadBackupRegister(BKP_DR7);
 	current_page = BKP_ReadBackupRegister(BKP_DR8);
 	
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Cycle count profiling of the band's hot paths (the accelerometer interrupt
+ * and the NAND program, erase & read) using the DWT cycle counter. Each path
+ * keeps its count, min, max & total plus a log2 histogram, read over USB with
+ * GET_PROFILE_CHAR.
+ * 
+ * The counter runs at the core clock, so anything timed while collecting
+ * (after waking from stop mode) is counted at that clock rather than the one
+ * reported with the stats.
+ */
+
+#include "profile.h"
+
+#ifndef PROFILE_CYCLE_COUNT
+// DWT registers, not described by this version of core_cm3.h
+#define DWT_CTRL			(*(volatile uint32_t*) 0xE0001000)
+#define DWT_CYCCNT			(*(volatile uint32_t*) 0xE0001004)
+#define DWT_CTRL_CYCCNTENA	0x00000001
+
+#define PROFILE_CYCLE_COUNT() DWT_CYCCNT
+#endif
+
+struct profile_stats profile[PROFILE_NUM_PATHS];
+
+// ----
+
+static void clearStats(struct profile_stats* aStats) {
+	uint8_t loop;
+	aStats->count = 0;
+	aStats->min_cycles = 0xFFFFFFFF;
+	aStats->max_cycles = 0;
+	aStats->total_cycles = 0;
+	for (loop = 0; loop < PROFILE_BUCKETS; loop++) {
+		aStats->buckets[loop] = 0;
+	}
+}
+
+static uint8_t bucketFor(uint32_t aCycles) {
+	uint8_t bucket = 0;
+	uint32_t limit = (uint32_t) 1 << PROFILE_FIRST_BUCKET_BITS;
+	while ((bucket < PROFILE_BUCKETS - 1) && (aCycles >= limit)) {
+		bucket++;
+		limit <<= PROFILE_BUCKET_BITS;
+	}
+	return bucket;
+}
+
+// ----
+
+void profileInit() {
+	uint8_t loop;
+	
+#ifdef DWT_CTRL
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
+	
+	for (loop = 0; loop < PROFILE_NUM_PATHS; loop++) {
+		clearStats(&profile[loop]);
+	}
+}
+
+uint32_t profileStart() {
+	return PROFILE_CYCLE_COUNT();
+}
+
+void profileEnd(profile_path aPath, uint32_t aStart) {
+	
+	// Wraps are handled by the unsigned subtraction
+	
+	uint32_t cycles = PROFILE_CYCLE_COUNT() - aStart;
+	struct profile_stats* stats = &profile[aPath];
+	uint8_t bucket = bucketFor(cycles);
+	
+	stats->count++;
+	stats->total_cycles += cycles;
+	if (cycles < stats->min_cycles)
+		stats->min_cycles = cycles;
+	if (cycles > stats->max_cycles)
+		stats->max_cycles = cycles;
+	// Buckets saturate rather than wrap
+	if (0xFFFF != stats->buckets[bucket])
+		stats->buckets[bucket]++;
+}
+
+int profileReport(uint8_t aPath, uint8_t* aBuffer, uint8_t aClear) {
+	if (aPath >= PROFILE_NUM_PATHS)
+		return -1;
+	encodeProfileStats(&profile[aPath], aBuffer);
+	if (aClear)
+		clearStats(&profile[aPath]);
+	return 0;
+}
+
+// EOF
@@ -101,7 +101,7 @@ uint8_t encodeRateAndGscale(accel_data_rate rate, accel_g_scale scale) {
 int decodeRateAndGscale(uint8_t byte, accel_data_rate* rate,
 	accel_g_scale* scale) {
 	int retval = 0;
-	uint8_t dr = byte & 0x0F;
+	uint8_t dr = byte & ACCEL_DR_MASK;
 	switch (dr) {
 		case CWA_50HZ:
 		case CWA_100HZ:
@@ -116,7 +116,7 @@ int decodeRateAndGscale(uint8_t byte, accel_data_rate* rate,
 	}
 	
 	if (!retval) {
-		uint8_t gs = byte & 0xF0;
+		uint8_t gs = byte & ACCEL_GS_MASK;
 		switch (gs) {
 			case CWA_2G:
 			case CWA_4G:
@@ -133,4 +133,278 @@ int decodeRateAndGscale(uint8_t byte, accel_data_rate* rate,
 	return retval; 
 }
 
+// ----
+
+// Compressed pages (see format in shared.h)
+
+static uint8_t bitWidth(uint16_t aValue) {
+	uint8_t width = 0;
+	while (aValue) {
+		width++;
+		aValue >>= 1;
+	}
+	return width;
+}
+
+static uint16_t zigZag(int16_t aValue) {
+	return (uint16_t) (((uint16_t) aValue << 1) ^ (uint16_t) (aValue >> 15));
+}
+
+static void putBits(struct page_packer* aPacker, uint16_t aValue,
+	uint8_t aBits) {
+	
+	while (aBits) {
+		uint8_t* byte_ptr = aPacker->page + (aPacker->bit_pos >> 3);
+		uint8_t space = 8 - (aPacker->bit_pos & 7);
+		uint8_t bits = (aBits < space) ? aBits : space;
+		
+		if (8 == space)
+			*byte_ptr = 0;
+		*byte_ptr |= ((aValue >> (aBits - bits)) & ((1 << bits) - 1)) <<
+			(space - bits);
+		aBits -= bits;
+		aPacker->bit_pos += bits;
+	}
+}
+
+static void startPage(struct page_packer* aPacker, const int16_t* aFirst) {
+	uint8_t axis;
+	
+	aPacker->bit_pos = 0;
+	for (axis = 0; axis < 3; axis++) {
+		putBits(aPacker, (uint16_t) aFirst[axis], 16);
+		aPacker->last[axis] = aFirst[axis];
+	}
+	aPacker->num_samples = 1;
+}
+
+static void finishPage(struct page_packer* aPacker) {
+	uint16_t idx = (aPacker->bit_pos + 7) >> 3;
+	
+	while (idx < PACKED_DATA_SIZE) {
+		aPacker->page[idx++] = 0;
+	}
+	aPacker->page[PACKED_COUNT_ADDR] = aPacker->num_samples >> 8;
+	aPacker->page[PACKED_COUNT_ADDR + 1] = aPacker->num_samples & 0xff;
+}
+
+void packerReset(struct page_packer* aPacker, uint8_t* aPage) {
+	aPacker->page = aPage;
+	aPacker->next_page = aPage;
+	aPacker->bit_pos = 0;
+	aPacker->num_samples = 0;
+	aPacker->group_count = 0;
+}
+
+uint8_t packerAddSample(struct page_packer* aPacker, const uint8_t* aSample) {
+	
+	/*
+	 * Add a big-endian x,y,z sample. Samples are buffered until a group is
+	 * complete, then the group is packed onto the end of the bit stream. If
+	 * the group doesn't fit the page is finished (count & padding written)
+	 * and a new page started with the group, PACK_PAGE_FULL is returned.
+	 */
+	
+	int16_t* sample_ptr = aPacker->group[aPacker->group_count];
+	uint16_t packed[PACK_GROUP_SAMPLES][3];
+	uint16_t delta_bits = 0;
+	uint8_t shift = 0, width[3] = { 0, 0, 0 };
+	uint16_t group_bits;
+	uint8_t loop, axis;
+	int16_t prev[3];
+	
+	for (axis = 0; axis < 3; axis++) {
+		sample_ptr[axis] = (int16_t) ((aSample[0] << 8) | aSample[1]);
+		aSample += 2;
+	}
+	
+	if (!aPacker->num_samples) {
+		// First sample of the page is stored as is
+		startPage(aPacker, sample_ptr);
+		return PACK_NONE;
+	}
+	
+	if (++aPacker->group_count < PACK_GROUP_SAMPLES)
+		return PACK_NONE;
+	aPacker->group_count = 0;
+	
+	// Deltas, then the low bits which are zero for the whole group
+	for (axis = 0; axis < 3; axis++)
+		prev[axis] = aPacker->last[axis];
+	for (loop = 0; loop < PACK_GROUP_SAMPLES; loop++) {
+		for (axis = 0; axis < 3; axis++) {
+			packed[loop][axis] =
+				(uint16_t) (aPacker->group[loop][axis] - prev[axis]);
+			delta_bits |= packed[loop][axis];
+			prev[axis] = aPacker->group[loop][axis];
+		}
+	}
+	if (delta_bits) {
+		while (!(delta_bits & 1) && (shift < (1 << PACK_SHIFT_BITS) - 1)) {
+			shift++;
+			delta_bits >>= 1;
+		}
+	}
+	for (loop = 0; loop < PACK_GROUP_SAMPLES; loop++) {
+		for (axis = 0; axis < 3; axis++) {
+			uint8_t bits;
+			packed[loop][axis] =
+				zigZag(((int16_t) packed[loop][axis]) >> shift);
+			bits = bitWidth(packed[loop][axis]);
+			if (bits > width[axis])
+				width[axis] = bits;
+		}
+	}
+	
+	group_bits = PACK_SHIFT_BITS + (3 * PACK_WIDTH_BITS) +
+		(PACK_GROUP_SAMPLES * (width[0] + width[1] + width[2]));
+	
+	if (aPacker->bit_pos + group_bits > PACKED_DATA_SIZE * 8) {
+		finishPage(aPacker);
+		
+		// Next page starts with the group, the rest wait for the next group
+		aPacker->page = aPacker->next_page;
+		startPage(aPacker, aPacker->group[0]);
+		for (loop = 1; loop < PACK_GROUP_SAMPLES; loop++) {
+			for (axis = 0; axis < 3; axis++)
+				aPacker->group[loop - 1][axis] = aPacker->group[loop][axis];
+		}
+		aPacker->group_count = PACK_GROUP_SAMPLES - 1;
+		return PACK_PAGE_FULL;
+	}
+	
+	putBits(aPacker, shift, PACK_SHIFT_BITS);
+	for (axis = 0; axis < 3; axis++)
+		putBits(aPacker, width[axis], PACK_WIDTH_BITS);
+	for (loop = 0; loop < PACK_GROUP_SAMPLES; loop++) {
+		for (axis = 0; axis < 3; axis++)
+			putBits(aPacker, packed[loop][axis], width[axis]);
+	}
+	for (axis = 0; axis < 3; axis++)
+		aPacker->last[axis] = prev[axis];
+	aPacker->num_samples += PACK_GROUP_SAMPLES;
+	
+	return PACK_NONE;
+}
+
+// ----
+
+// Profile stats wire format
+
+static uint8_t* putBigEndian(uint8_t* aBuffer, uint64_t aValue, uint8_t aSize) {
+	uint8_t loop;
+	for (loop = aSize; loop > 0; loop--) {
+		aBuffer[loop - 1] = aValue & 0xff;
+		aValue >>= 8;
+	}
+	return aBuffer + aSize;
+}
+
+void encodeProfileStats(const struct profile_stats* aStats, uint8_t* aBuffer) {
+	uint8_t loop;
+	aBuffer = putBigEndian(aBuffer, aStats->count, 4);
+	aBuffer = putBigEndian(aBuffer, aStats->min_cycles, 4);
+	aBuffer = putBigEndian(aBuffer, aStats->max_cycles, 4);
+	aBuffer = putBigEndian(aBuffer, aStats->total_cycles, 8);
+	for (loop = 0; loop < PROFILE_BUCKETS; loop++) {
+		aBuffer = putBigEndian(aBuffer, aStats->buckets[loop], 2);
+	}
+}
+
+#ifndef MRC_CWA
+
+static int getBits(const uint8_t* aPage, uint16_t* aBitPos, uint8_t aBits,
+	uint16_t* aValue) {
+	
+	uint16_t value = 0;
+	
+	if (*aBitPos + aBits > PACKED_DATA_SIZE * 8)
+		return -1;
+	while (aBits) {
+		uint8_t byte = aPage[*aBitPos >> 3];
+		uint8_t space = 8 - (*aBitPos & 7);
+		uint8_t bits = (aBits < space) ? aBits : space;
+		
+		value = (value << bits) |
+			((byte >> (space - bits)) & ((1 << bits) - 1));
+		aBits -= bits;
+		*aBitPos += bits;
+	}
+	*aValue = value;
+	return 0;
+}
+
+int unpackPage(const uint8_t* aPage, uint8_t* aSamples, int aMaxSamples) {
+	
+	/*
+	 * Unpack a compressed page to big-endian x,y,z samples
+	 * Returns the number of samples or < 0 if the page is malformed
+	 */
+	
+	int count = (aPage[PACKED_COUNT_ADDR] << 8) | aPage[PACKED_COUNT_ADDR + 1];
+	int num = 0;
+	uint16_t bit_pos = 0, value;
+	uint16_t last[3];
+	uint8_t loop, axis;
+	
+	if (!count || (count > aMaxSamples) || (count > MAX_SAMPLES_PER_PAGE) ||
+			((count - 1) % PACK_GROUP_SAMPLES))
+		return -1;
+	
+	for (axis = 0; axis < 3; axis++) {
+		if (getBits(aPage, &bit_pos, 16, &last[axis]))
+			return -1;
+		*aSamples++ = last[axis] >> 8;
+		*aSamples++ = last[axis] & 0xff;
+	}
+	num++;
+	
+	while (num < count) {
+		uint16_t shift, width[3];
+		
+		if (getBits(aPage, &bit_pos, PACK_SHIFT_BITS, &shift))
+			return -1;
+		for (axis = 0; axis < 3; axis++) {
+			if (getBits(aPage, &bit_pos, PACK_WIDTH_BITS, &width[axis]) ||
+					(width[axis] > 16))
+				return -1;
+		}
+		for (loop = 0; loop < PACK_GROUP_SAMPLES; loop++) {
+			for (axis = 0; axis < 3; axis++) {
+				int16_t delta;
+				if (getBits(aPage, &bit_pos, width[axis], &value))
+					return -1;
+				delta = (int16_t) ((value >> 1) ^ -(value & 1));
+				last[axis] += (uint16_t) ((uint16_t) delta << shift);
+				*aSamples++ = last[axis] >> 8;
+				*aSamples++ = last[axis] & 0xff;
+			}
+		}
+		num += PACK_GROUP_SAMPLES;
+	}
+	return num;
+}
+
+static uint64_t getBigEndian(const uint8_t** aBuffer, uint8_t aSize) {
+	uint64_t value = 0;
+	uint8_t loop;
+	for (loop = 0; loop < aSize; loop++) {
+		value = (value << 8) | *(*aBuffer)++;
+	}
+	return value;
+}
+
+void decodeProfileStats(const uint8_t* aBuffer, struct profile_stats* aStats) {
+	uint8_t loop;
+	aStats->count = (uint32_t) getBigEndian(&aBuffer, 4);
+	aStats->min_cycles = (uint32_t) getBigEndian(&aBuffer, 4);
+	aStats->max_cycles = (uint32_t) getBigEndian(&aBuffer, 4);
+	aStats->total_cycles = getBigEndian(&aBuffer, 8);
+	for (loop = 0; loop < PROFILE_BUCKETS; loop++) {
+		aStats->buckets[loop] = (uint16_t) getBigEndian(&aBuffer, 2);
+	}
+}
+
+#endif // MRC_CWA
+
 // EOF
@@ -32,6 +32,9 @@
 extern void RTCIntrHandler(void);
 extern void usbWakeUpIntrHandler();
 extern void accelIntrHandler();
+#ifdef ACCEL_DMA
+extern void accelDmaIntrHandler();
+#endif
 
 
 /******************************************************************************/
@@ -216,6 +219,15 @@ void EXTI15_10_IRQHandler(void)
 	}
 }
 
+#ifdef ACCEL_DMA
+void DMA1_Channel2_IRQHandler(void)
+{
+	if (DMA_GetITStatus(DMA1_IT_TC2) != RESET) {
+		accelDmaIntrHandler();
+	}
+}
+#endif
+
 
 /**
   * @brief  This function handles RTC Second interrupt request.
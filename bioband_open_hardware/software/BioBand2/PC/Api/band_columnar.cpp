@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MS VC++ does not appear to like this in an ifdef
+#include "stdafx.h"
+
+#include "band_if.h"
+
+// header field offsets
+#define HDR_MAGIC			0
+#define HDR_VERSION			4
+#define HDR_FLAGS			6
+#define HDR_PAGE_COUNT		8
+#define HDR_INDEX_OFFSET	12
+#define HDR_START_TIME		20
+#define HDR_REQ_TOTAL		24
+#define HDR_ACCEL_CONF		28
+#define HDR_FW_HW_VERSION	29
+#define HDR_BATTERY			30
+#define HDR_FIRST_DOWNLOAD	32
+#define HDR_END_TICK		36
+#define HDR_NUM_SAMPLES		40
+#define HDR_ACTIONED_TIME	44
+#define HDR_BAND_ID			48
+#define HDR_SUBJECT_ID		(HDR_BAND_ID + MAX_ID_LEN)
+#define HDR_TEST_ID			(HDR_SUBJECT_ID + MAX_ID_LEN)
+#define HDR_CENTRE_ID		(HDR_TEST_ID + MAX_ID_LEN)
+#define HDR_CALIBRATION		(HDR_CENTRE_ID + MAX_CENTRE_ID_LEN)
+#define HDR_SIZE			(HDR_CALIBRATION + MAX_CALIBRATION_DATA_LEN)
+
+#define HDR_FLAG_ADDITIONAL	0x01
+#define HDR_FLAG_STATUS		0x02
+
+// page block, followed by the x, y & z columns
+#define BLK_TICK			0
+#define BLK_TEMPERATURE		4
+#define BLK_STATUS			6
+#define BLK_FLAGS			7
+#define BLK_NUM_SAMPLES		8
+#define BLK_SIZE			10
+
+#define BLK_FLAG_CRC_OK		0x01
+
+// index offset, page count & magic
+#define FOOTER_INDEX_OFFSET	0
+#define FOOTER_PAGE_COUNT	8
+#define FOOTER_MAGIC_ADDR	12
+#define FOOTER_SIZE			16
+#define FOOTER_MAGIC "BBCI"
+
+static void putLE16(uint8_t* ptr, uint16_t val) {
+	ptr[0] = (uint8_t) val;
+	ptr[1] = (uint8_t) (val >> 8);
+}
+
+static void putLE32(uint8_t* ptr, uint32_t val) {
+	putLE16(ptr, (uint16_t) val);
+	putLE16(ptr + 2, (uint16_t) (val >> 16));
+}
+
+static void putLE64(uint8_t* ptr, uint64_t val) {
+	putLE32(ptr, (uint32_t) val);
+	putLE32(ptr + 4, (uint32_t) (val >> 32));
+}
+
+static uint16_t getLE16(const uint8_t* ptr) {
+	return (uint16_t) (ptr[0] | (ptr[1] << 8));
+}
+
+static uint32_t getLE32(const uint8_t* ptr) {
+	return getLE16(ptr) | ((uint32_t) getLE16(ptr + 2) << 16);
+}
+
+static uint64_t getLE64(const uint8_t* ptr) {
+	return getLE32(ptr) | ((uint64_t) getLE32(ptr + 4) << 32);
+}
+
+static void putId(uint8_t* ptr, const string& id, size_t max_len) {
+	memset(ptr, 0, max_len);
+	memcpy(ptr, id.c_str(), id.size() < max_len ? id.size() : max_len);
+}
+
+static string getId(const uint8_t* ptr, size_t max_len) {
+	size_t len = 0;
+	while (len < max_len && ptr[len])
+		len++;
+	return string((const char*) ptr, len);
+}
+
+static void clearHeader(columnar_header& header) {
+	header.version = COLUMNAR_VERSION;
+	header.page_count = 0;
+	header.additional_present = false;
+	header.battery_raw = 0;
+	header.band_id.clear();
+	header.subject_id.clear();
+	header.test_id.clear();
+	header.centre_id.clear();
+	memset(header.calibration_data, 0, MAX_CALIBRATION_DATA_LEN);
+	header.req_total_num_samples = 0;
+	header.collect_start_time = 0;
+	header.accel_conf_raw = 0;
+	header.fw_hw_version_raw = 0;
+	header.status_present = false;
+	header.first_downloaded = 0;
+	header.end_tick = 0;
+	header.num_samples = 0;
+	header.actioned_time = 0;
+}
+
+// ----
+
+ColumnarWriter::ColumnarWriter() :
+	fd_ptr(NULL),
+	last_num_samples(0) {
+	clearHeader(header);
+}
+
+ColumnarWriter::~ColumnarWriter() {
+	close();
+}
+
+int ColumnarWriter::open(const char* aFilename) {
+	if (fd_ptr) {
+		close();
+	}
+	if (!aFilename) {
+		return -E_BB_BAD_PARAM;
+	}
+	fd_ptr = fopen(aFilename,"wb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	clearHeader(header);
+	page_offsets.clear();
+	last_num_samples = 0;
+	
+	// no index yet, so a reader knows to scan the pages if never closed
+	return writeHeader(0);
+}
+
+int ColumnarWriter::writeHeader(uint64_t index_offset) {
+	uint8_t hdr[HDR_SIZE];
+	uint16_t flags = 0;
+	if (header.additional_present)
+		flags |= HDR_FLAG_ADDITIONAL;
+	if (header.status_present)
+		flags |= HDR_FLAG_STATUS;
+	
+	memcpy(hdr + HDR_MAGIC, COLUMNAR_MAGIC, 4);
+	putLE16(hdr + HDR_VERSION, header.version);
+	putLE16(hdr + HDR_FLAGS, flags);
+	putLE32(hdr + HDR_PAGE_COUNT, header.page_count);
+	putLE64(hdr + HDR_INDEX_OFFSET, index_offset);
+	putLE32(hdr + HDR_START_TIME, header.collect_start_time);
+	putLE32(hdr + HDR_REQ_TOTAL, header.req_total_num_samples);
+	hdr[HDR_ACCEL_CONF] = header.accel_conf_raw;
+	hdr[HDR_FW_HW_VERSION] = header.fw_hw_version_raw;
+	putLE16(hdr + HDR_BATTERY, header.battery_raw);
+	putLE32(hdr + HDR_FIRST_DOWNLOAD, header.first_downloaded);
+	putLE32(hdr + HDR_END_TICK, header.end_tick);
+	putLE32(hdr + HDR_NUM_SAMPLES, header.num_samples);
+	putLE32(hdr + HDR_ACTIONED_TIME, header.actioned_time);
+	putId(hdr + HDR_BAND_ID, header.band_id, MAX_ID_LEN);
+	putId(hdr + HDR_SUBJECT_ID, header.subject_id, MAX_ID_LEN);
+	putId(hdr + HDR_TEST_ID, header.test_id, MAX_ID_LEN);
+	putId(hdr + HDR_CENTRE_ID, header.centre_id, MAX_CENTRE_ID_LEN);
+	memcpy(hdr + HDR_CALIBRATION, header.calibration_data,
+		MAX_CALIBRATION_DATA_LEN);
+	
+	if (fwrite(hdr, 1, HDR_SIZE, fd_ptr) != HDR_SIZE) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	return BB_SUCCESS;
+}
+
+int ColumnarWriter::addPage(const MDataObserver& page) {
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	
+	if (page.additional_present) {
+		header.additional_present = true;
+		header.battery_raw = page.battery_raw;
+		header.band_id = page.band_id;
+		header.subject_id = page.subject_id;
+		header.test_id = page.test_id;
+		header.centre_id = page.centre_id;
+		memcpy(header.calibration_data, page.calibration_data,
+			MAX_CALIBRATION_DATA_LEN);
+		header.req_total_num_samples = page.req_total_num_samples;
+		header.collect_start_time = page.collect_start_time;
+		header.accel_conf_raw = page.accel_conf_raw;
+		header.fw_hw_version_raw = page.fw_hw_version_raw;
+	}
+	if (page.status_present) {
+		header.status_present = true;
+		header.first_downloaded = page.first_downloaded;
+		header.end_tick = page.end_tick;
+		header.num_samples = page.num_samples;
+		header.actioned_time = page.actioned_time;
+	}
+	
+	uint64_t offset = HDR_SIZE;
+	if (!page_offsets.empty())
+		offset = page_offsets.back() + BLK_SIZE + 6 * last_num_samples;
+	
+	MDataObserver::sample_span samples = page.samples();
+	size_t num = samples.size();
+	block.resize(BLK_SIZE + num * 6);
+	uint8_t* ptr = &block[0];
+	putLE32(ptr + BLK_TICK, page.current_tick);
+	putLE16(ptr + BLK_TEMPERATURE, page.temperature_raw);
+	ptr[BLK_STATUS] = page.status_raw;
+	ptr[BLK_FLAGS] = page.crc_ok ? BLK_FLAG_CRC_OK : 0;
+	putLE16(ptr + BLK_NUM_SAMPLES, (uint16_t) num);
+	
+	// samples are stored big-endian x,y,z, transpose into the columns
+	uint8_t* x_ptr = ptr + BLK_SIZE;
+	uint8_t* y_ptr = x_ptr + num * 2;
+	uint8_t* z_ptr = y_ptr + num * 2;
+	for (size_t idx = 0; idx < num; idx++) {
+		const uint8_t* raw = samples[idx].sample_raw;
+		x_ptr[0] = raw[1]; x_ptr[1] = raw[0]; x_ptr += 2;
+		y_ptr[0] = raw[3]; y_ptr[1] = raw[2]; y_ptr += 2;
+		z_ptr[0] = raw[5]; z_ptr[1] = raw[4]; z_ptr += 2;
+	}
+	
+	if (fwrite(&block[0], 1, block.size(), fd_ptr) != block.size()) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	page_offsets.push_back(offset);
+	header.page_count = (uint32_t) page_offsets.size();
+	last_num_samples = num;
+	return BB_SUCCESS;
+}
+
+int ColumnarWriter::close() {
+	if (!fd_ptr) {
+		return BB_SUCCESS;
+	}
+	
+	uint64_t index_offset = HDR_SIZE;
+	if (!page_offsets.empty())
+		index_offset = page_offsets.back() + BLK_SIZE + 6 * last_num_samples;
+	
+	int retval = BB_SUCCESS;
+	uint8_t entry[8];
+	for (size_t idx = 0; idx < page_offsets.size(); idx++) {
+		putLE64(entry, page_offsets[idx]);
+		if (fwrite(entry, 1, 8, fd_ptr) != 8)
+			retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	uint8_t footer[FOOTER_SIZE];
+	putLE64(footer + FOOTER_INDEX_OFFSET, index_offset);
+	putLE32(footer + FOOTER_PAGE_COUNT, header.page_count);
+	memcpy(footer + FOOTER_MAGIC_ADDR, FOOTER_MAGIC, 4);
+	if (fwrite(footer, 1, FOOTER_SIZE, fd_ptr) != FOOTER_SIZE)
+		retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	
+	// now the metadata & index location are known
+	if (!retval) {
+		if (fseek(fd_ptr, 0, SEEK_SET))
+			retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+		else
+			retval = writeHeader(index_offset);
+	}
+	
+	fclose(fd_ptr);
+	fd_ptr = NULL;
+	return retval;
+}
+
+// ----
+
+ColumnarReader::ColumnarReader() :
+	fd_ptr(NULL) {
+	clearHeader(header);
+}
+
+ColumnarReader::~ColumnarReader() {
+	close();
+}
+
+void ColumnarReader::close() {
+	if (fd_ptr) {
+		fclose(fd_ptr);
+		fd_ptr = NULL;
+	}
+	page_offsets.clear();
+}
+
+int ColumnarReader::open(const char* aFilename) {
+	close();
+	if (!aFilename) {
+		return -E_BB_BAD_PARAM;
+	}
+	fd_ptr = fopen(aFilename,"rb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	
+	uint8_t hdr[HDR_SIZE];
+	if (fread(hdr, 1, HDR_SIZE, fd_ptr) != HDR_SIZE ||
+			memcmp(hdr + HDR_MAGIC, COLUMNAR_MAGIC, 4) ||
+			getLE16(hdr + HDR_VERSION) != COLUMNAR_VERSION) {
+		close();
+		return -E_BB_BAD_FILE_FORMAT;
+	}
+	
+	uint16_t flags = getLE16(hdr + HDR_FLAGS);
+	header.version = getLE16(hdr + HDR_VERSION);
+	header.page_count = getLE32(hdr + HDR_PAGE_COUNT);
+	header.additional_present = (flags & HDR_FLAG_ADDITIONAL) != 0;
+	header.status_present = (flags & HDR_FLAG_STATUS) != 0;
+	header.collect_start_time = getLE32(hdr + HDR_START_TIME);
+	header.req_total_num_samples = getLE32(hdr + HDR_REQ_TOTAL);
+	header.accel_conf_raw = hdr[HDR_ACCEL_CONF];
+	header.fw_hw_version_raw = hdr[HDR_FW_HW_VERSION];
+	header.battery_raw = getLE16(hdr + HDR_BATTERY);
+	header.first_downloaded = getLE32(hdr + HDR_FIRST_DOWNLOAD);
+	header.end_tick = getLE32(hdr + HDR_END_TICK);
+	header.num_samples = getLE32(hdr + HDR_NUM_SAMPLES);
+	header.actioned_time = getLE32(hdr + HDR_ACTIONED_TIME);
+	header.band_id = getId(hdr + HDR_BAND_ID, MAX_ID_LEN);
+	header.subject_id = getId(hdr + HDR_SUBJECT_ID, MAX_ID_LEN);
+	header.test_id = getId(hdr + HDR_TEST_ID, MAX_ID_LEN);
+	header.centre_id = getId(hdr + HDR_CENTRE_ID, MAX_CENTRE_ID_LEN);
+	memcpy(header.calibration_data, hdr + HDR_CALIBRATION,
+		MAX_CALIBRATION_DATA_LEN);
+	
+	uint64_t index_offset = getLE64(hdr + HDR_INDEX_OFFSET);
+	if (index_offset) {
+		// the index & footer end the file, check they agree with the header
+		// before trusting the page count
+		uint8_t footer[FOOTER_SIZE];
+		long file_size = -1;
+		if (!fseek(fd_ptr, 0, SEEK_END))
+			file_size = ftell(fd_ptr);
+		if ((file_size < HDR_SIZE + FOOTER_SIZE) || (index_offset < HDR_SIZE) ||
+				((uint64_t) file_size != index_offset +
+				(uint64_t) header.page_count * 8 + FOOTER_SIZE) ||
+				fseek(fd_ptr, file_size - FOOTER_SIZE, SEEK_SET) ||
+				(fread(footer, 1, FOOTER_SIZE, fd_ptr) != FOOTER_SIZE) ||
+				memcmp(footer + FOOTER_MAGIC_ADDR, FOOTER_MAGIC, 4) ||
+				(getLE64(footer + FOOTER_INDEX_OFFSET) != index_offset) ||
+				(getLE32(footer + FOOTER_PAGE_COUNT) != header.page_count)) {
+			close();
+			return -E_BB_BAD_FILE_FORMAT;
+		}
+		block.resize((size_t) header.page_count * 8);
+		if (fseek(fd_ptr, (long) index_offset, SEEK_SET) ||
+				(header.page_count && fread(&block[0], 8, header.page_count,
+				fd_ptr) != header.page_count)) {
+			close();
+			return -E_BB_BAD_FILE_FORMAT;
+		}
+		page_offsets.resize(header.page_count);
+		for (uint32_t idx = 0; idx < header.page_count; idx++)
+			page_offsets[idx] = getLE64(&block[idx * 8]);
+	} else {
+		// not closed, so find the complete page blocks the hard way
+		uint64_t offset = HDR_SIZE;
+		uint64_t next_offset;
+		while (!readBlock(offset, NULL, &next_offset)) {
+			page_offsets.push_back(offset);
+			offset = next_offset;
+		}
+		header.page_count = (uint32_t) page_offsets.size();
+	}
+	return BB_SUCCESS;
+}
+
+int ColumnarReader::readBlock(uint64_t offset, columnar_page* page_ptr,
+	uint64_t* next_offset_ptr) {
+	uint8_t blk[BLK_SIZE];
+	if (fseek(fd_ptr, (long) offset, SEEK_SET) ||
+			fread(blk, 1, BLK_SIZE, fd_ptr) != BLK_SIZE) {
+		return -E_BB_BAD_FILE_FORMAT;
+	}
+	size_t num = getLE16(blk + BLK_NUM_SAMPLES);
+	size_t column_bytes = num * 2;
+	block.resize(column_bytes * 3 + 1);
+	if (fread(&block[0], 1, column_bytes * 3, fd_ptr) != column_bytes * 3) {
+		return -E_BB_BAD_FILE_FORMAT;
+	}
+	if (next_offset_ptr)
+		*next_offset_ptr = offset + BLK_SIZE + column_bytes * 3;
+	
+	if (page_ptr) {
+		page_ptr->current_tick = getLE32(blk + BLK_TICK);
+		page_ptr->temperature_raw = getLE16(blk + BLK_TEMPERATURE);
+		page_ptr->status_raw = blk[BLK_STATUS];
+		page_ptr->crc_ok = (blk[BLK_FLAGS] & BLK_FLAG_CRC_OK) != 0;
+		page_ptr->x.resize(num);
+		page_ptr->y.resize(num);
+		page_ptr->z.resize(num);
+		const uint8_t* ptr = &block[0];
+		for (size_t idx = 0; idx < num; idx++) {
+			page_ptr->x[idx] = (int16_t) getLE16(ptr + idx * 2);
+			page_ptr->y[idx] = (int16_t) getLE16(ptr + column_bytes + idx * 2);
+			page_ptr->z[idx] = (int16_t) getLE16(ptr + column_bytes * 2 +
+				idx * 2);
+		}
+	}
+	return BB_SUCCESS;
+}
+
+int ColumnarReader::readPage(int page_idx, columnar_page& page) {
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	if (page_idx < 0 || page_idx >= (int) page_offsets.size()) {
+		return -E_BB_BAD_PARAM;
+	}
+	return readBlock(page_offsets[page_idx], &page, NULL);
+}
+
+// EOF
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MS VC++ does not appear to like this in an ifdef
+#include "stdafx.h"
+
+#include "band_emulator.h"
+#include "crc16.h"
+
+#include <thread>
+#include <chrono>
+
+// as the firmware's non streamed raw read (ready_for_tx_cb), the page is
+// sent in TRANSFER_SIZE pieces up to TAIL_START then the tail together with
+// the next leader or Done
+#define TRANSFER_SIZE 60
+#define TAIL_START 2100
+
+#define DONE_STR "Done"
+#define DONE_LEN 4
+
+#define EMULATOR_HW_VER 1.2f
+#define EMULATOR_FW_VER 1.8f
+#define EMULATOR_FW_DATE "emulator"
+
+// nominal rate of the synthetic capture, for the page ticks
+#define SYNTHETIC_RATE_HZ 100
+
+static void storeLe32(uint8_t* ptr, uint32_t val) {
+	ptr[0] = val & 0xFF;
+	ptr[1] = (val >> 8) & 0xFF;
+	ptr[2] = (val >> 16) & 0xFF;
+	ptr[3] = (val >> 24) & 0xFF;
+}
+
+static void storeLe16(uint8_t* ptr, uint16_t val) {
+	ptr[0] = val & 0xFF;
+	ptr[1] = (val >> 8) & 0xFF;
+}
+
+static void storeId(uint8_t* ptr, const char* id, int len) {
+	memset(ptr, 0, len);
+	memcpy(ptr, id, strlen(id) < (size_t) len ? strlen(id) : len);
+}
+
+BandEmulator::BandEmulator() :
+	tx_pos(0),
+	raw(RAW_IDLE),
+	raw_page(0),
+	raw_offset(0),
+	raw_done(0),
+	first_download(0),
+	latency(0),
+	responding(true),
+	packet(STREAM_PACKET_SIZE),
+	hw_ver(EMULATOR_HW_VER),
+	fw_ver(EMULATOR_FW_VER) {
+	
+	memset(&config, 0, sizeof(config));
+	crc16Init();
+}
+
+BandEmulator::~BandEmulator() {
+}
+
+void BandEmulator::createImage(uint32_t num_pages, time_t collect_start_time) {
+
+	// ~ticks per page, the RTC runs at RTC_CLOCK_BASE / RTC_SCALAR
+	const uint32_t page_ticks = (uint32_t) ((uint64_t) SAMPLES_PER_PAGE *
+		RTC_CLOCK_BASE / (RTC_SCALAR * SYNTHETIC_RATE_HZ));
+	uint32_t seed = 1;
+	
+	image.assign((size_t) num_pages * FLASH_PAGE, 0xFF);
+	page_nums.resize(num_pages);
+	
+	for (uint32_t page = 0; page < num_pages; page++) {
+		uint8_t* ptr = &image[(size_t) page * FLASH_PAGE];
+		page_nums[page] = page % MAX_PAGES_PER_BLOCK;
+		
+		// at rest with a little noise, big-endian as read from the
+		// accelerometer (1g = default_g_divisor)
+		for (int loop = 0; loop < SAMPLES_PER_PAGE; loop++) {
+			for (int axis = 0; axis < 3; axis++) {
+				seed = seed * 1103515245 + 12345;
+				int16_t val = (int16_t) ((seed >> 16) % 256) - 128;
+				if (2 == axis)
+					val += (int16_t) default_g_divisor;
+				*ptr++ = (uint8_t) ((val >> 8) & 0xFF);
+				*ptr++ = (uint8_t) (val & 0xFF);
+			}
+		}
+		
+		ptr = &image[(size_t) page * FLASH_PAGE];
+		uint8_t crc_hi = CRC16_INITIAL_VALUE, crc_lo = CRC16_INITIAL_VALUE;
+		crc16Update(&crc_hi, &crc_lo, ptr, SAMPLES_PER_PAGE * BYTES_PER_SAMPLE);
+		ptr[SAMPLES_PER_PAGE * BYTES_PER_SAMPLE] = crc_hi;
+		ptr[SAMPLES_PER_PAGE * BYTES_PER_SAMPLE + 1] = crc_lo;
+		
+		ptr[BAD_BLOCK_ADDR] = VALID_BLOCK_INDICATOR;
+		// no samples dropped, stored on every page since fw1.8 (see
+		// programSpareArea)
+		ptr[PAGE_STATUS_ADDR] = OK_USED_STATUS | OVERRUN_COUNT_MASK;
+		storeLe16(ptr + OVERRUN_COUNT_ADDR, 0);
+		storeLe32(ptr + CURRENT_TICK_ADDR, page * page_ticks);
+		// ~20C, see convTempBinToCelsius
+		storeLe16(ptr + TEMP_LEVEL_ADDR, 0x0780);
+		
+		// no debug, the firmware always stores the length (see
+		// programSpareArea)
+		if (!page_nums[page])
+			ptr[VERSION_ADDR + VERSION_SIZE] = 0;
+		else if (1 == page_nums[page])
+			ptr[ACTION_EPOC_ADDR + EPOC_TIME_SIZE] = 0;
+		else
+			ptr[TEMP_LEVEL_ADDR + TEMP_LEVEL_SIZE] = 0;
+	}
+	
+	uint32_t num_samples = num_pages * SAMPLES_PER_PAGE;
+	if (num_pages) {
+		uint8_t* ptr = &image[0];
+		storeLe16(ptr + BATTERY_LEVEL_ADDR, 0x0800);
+		storeId(ptr + BAND_ID_ADDR, "EMULATE", MAX_ID_LEN);
+		storeId(ptr + SUBJECT_ID_ADDR, "SUBJECT", MAX_ID_LEN);
+		storeId(ptr + TEST_ID_ADDR, "BENCH", MAX_ID_LEN);
+		storeId(ptr + CENTRE_ID_ADDR, "EM", MAX_CENTRE_ID_LEN);
+		memset(ptr + CALIBRATION_ADDR, 0, MAX_CALIBRATION_DATA_LEN);
+		// stored plus one
+		storeLe32(ptr + MAX_SAMPLES_ADDR, num_samples + 1);
+		storeLe32(ptr + START_EPOC_ADDR, (uint32_t) collect_start_time);
+	}
+	if (num_pages > 1) {
+		uint8_t* ptr = &image[FLASH_PAGE];
+		storeLe32(ptr + END_TICK_ADDR, (num_pages - 1) * page_ticks);
+		storeLe32(ptr + END_SAMPLES_ADDR, num_samples);
+		storeLe32(ptr + ACTION_EPOC_ADDR, (uint32_t) collect_start_time);
+	}
+	
+	memset(&config, 0, sizeof(config));
+	config.max_samples = num_samples;
+	config.collect_start_time = (uint32_t) collect_start_time;
+	config.actioned_time = (uint32_t) collect_start_time;
+	config.number_of_ticks = num_pages ? (num_pages - 1) * page_ticks : 0;
+	config.mode = CWA_REAL_MODE;
+	config.flash_ok = 1;
+	storeId(config.band_id, "EMULATE", MAX_ID_LEN);
+}
+
+int BandEmulator::loadImage(const char* aFilename) {
+	char record[max_transfer_page];
+	
+	FILE* fd_ptr = fopen(aFilename, "rb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	
+	image.clear();
+	page_nums.clear();
+	while (fread(record, 1, max_transfer_page, fd_ptr) ==
+			(size_t) max_transfer_page) {
+		page_nums.push_back(((uint8_t) record[2] << 8) | (uint8_t) record[3]);
+		image.insert(image.end(), record + PAGE_LEADER,
+			record + max_transfer_page);
+	}
+	fclose(fd_ptr);
+	
+	if (page_nums.empty()) {
+		return -E_BB_BAD_FILE_FORMAT;
+	}
+	
+	memset(&config, 0, sizeof(config));
+	config.max_samples = getPageCount() * SAMPLES_PER_PAGE;
+	config.mode = CWA_REAL_MODE;
+	config.flash_ok = 1;
+	if (!page_nums[0]) {
+		const uint8_t* ptr = &image[START_EPOC_ADDR];
+		config.collect_start_time = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+			((uint32_t) ptr[3] << 24);
+		memcpy(config.band_id, &image[BAND_ID_ADDR], MAX_ID_LEN);
+	}
+	return (int) getPageCount();
+}
+
+int BandEmulator::setPacketSize(int packet_size) {
+	if ((packet_size <= 0) || (packet_size > max_stream_read)) {
+		return -E_BB_BAD_PARAM;
+	}
+	packet = packet_size;
+	return BB_SUCCESS;
+}
+
+// ----
+
+void BandEmulator::queueReply(const void* data, int len) {
+	replies.push_back(string((const char*) data, len));
+}
+
+int BandEmulator::writeBulk(const char* data, int len,
+	unsigned int timeout_ms) {
+	
+	if ((len <= 0) || !responding) {
+		return len > 0 ? len : 0;
+	}
+	if (raw != RAW_IDLE) {
+		// the band only sends while a download is in progress
+		return len;
+	}
+	
+	switch (data[0]) {
+		case GO_CHAR:
+			if (config.max_samples)
+				queueReply("CWA1\n", 5);
+			else
+				queueReply("CWAz\n", 5);
+			break;
+		
+		case SEND_META_CHAR:
+		case SEND_FULL_META_CHAR: {
+				char reply[sizeof(config) + 1];
+				reply[0] = CONFIG_CHAR;
+				memcpy(reply + 1, &config, sizeof(config));
+				queueReply(reply, sizeof(reply));
+			} break;
+		
+		case GET_VERSION_CHAR: {
+				// new version format, first byte 0 then the floats
+				char reply[9 + sizeof(EMULATOR_FW_DATE)];
+				reply[0] = 0;
+				memcpy(reply + 1, &hw_ver, 4);
+				memcpy(reply + 5, &fw_ver, 4);
+				memcpy(reply + 9, EMULATOR_FW_DATE, sizeof(EMULATOR_FW_DATE));
+				queueReply(reply, sizeof(reply));
+			} break;
+		
+		case READ_RAW_CHAR:
+			startRaw(1, false);
+			break;
+		
+		case STREAM_RAW_CHAR:
+			startRaw(1, true);
+			break;
+		
+		case READ_RAW_FROM_CHAR:
+			if (len < 6) {
+				queueReply(ERROR_MSG, ERROR_MSG_LEN);
+			} else {
+				const uint8_t* ptr = (const uint8_t*) data + 1;
+				startRaw(((uint32_t) ptr[0] << 24) | (ptr[1] << 16) |
+					(ptr[2] << 8) | ptr[3], ptr[4] != 0);
+			}
+			break;
+		
+		case GET_FIRST_DOWNLD_CHAR: {
+				char reply[sizeof(uint32_t) + 1] = { 0 };
+				memcpy(reply, &first_download, sizeof(uint32_t));
+				queueReply(reply, sizeof(reply));
+			} break;
+		
+		case SET_FIRST_DOWNLD_CHAR:
+			if (len > (int) sizeof(uint32_t))
+				memcpy(&first_download, data + 1, sizeof(uint32_t));
+			queueReply(OK_MSG, OK_MSG_LEN);
+			break;
+		
+		case GET_IS_COMPLETE_CHAR: {
+				uint8_t val = config.max_samples ? COMPLETE_CAPTURE :
+					NO_CAPTURE_TO_CHECK;
+				queueReply(&val, 1);
+			} break;
+		
+		case SET_LED_COLOUR_CHAR:
+			queueReply(OK_MSG, OK_MSG_LEN);
+			break;
+		
+		case RETURN_CHAR:
+			break;
+		
+		default:
+			queueReply(ERROR_MSG, ERROR_MSG_LEN);
+			break;
+	}
+	return len;
+}
+
+int BandEmulator::readBulk(char* data, int len, unsigned int timeout_ms) {
+	int total = 0;
+	
+	if (!responding) {
+		// as a read of a band which has stopped replying
+		this_thread::sleep_for(chrono::milliseconds(timeout_ms));
+		return 0;
+	}
+	if (latency)
+		this_thread::sleep_for(chrono::microseconds(latency));
+	
+	while (total < len) {
+		if ((tx_pos == tx_send.size()) && !nextSend())
+			break;
+		
+		// one packet, a short (or zero length) packet ends the transfer
+		int size = (int) (tx_send.size() - tx_pos);
+		if (size > packet)
+			size = packet;
+		bool short_packet = (size < packet);
+		if (size > len - total) {
+			size = len - total;
+			short_packet = false;
+		}
+		memcpy(data + total, tx_send.data() + tx_pos, size);
+		tx_pos += size;
+		total += size;
+		if (short_packet)
+			break;
+	}
+	return total;
+}
+
+// ----
+
+void BandEmulator::startRaw(uint32_t first_page, bool stream) {
+	if (!first_page)
+		first_page = 1;
+	raw_page = first_page - 1;
+	raw_offset = 0;
+	raw_done = 0;
+	if (raw_page >= getPageCount()) {
+		// nothing after the pages the PC already holds
+		queueReply(DONE_STR, DONE_LEN);
+		return;
+	}
+	if (stream) {
+		raw = RAW_STREAM;
+	} else {
+		char tmp[PAGE_LEADER];
+		leader(tmp, raw_page, false);
+		queueReply(tmp, PAGE_LEADER);
+		raw = RAW_PAGES;
+	}
+}
+
+void BandEmulator::leader(char* ptr, uint32_t page, bool stream) {
+	memset(ptr, 0, PAGE_LEADER);
+	// the streamed leader only has room for the low byte
+	if (!stream)
+		ptr[2] = (page_nums[page] >> 8) & 0xFF;
+	ptr[3] = page_nums[page] & 0xFF;
+}
+
+bool BandEmulator::nextSend() {
+	tx_pos = 0;
+	if (!replies.empty()) {
+		tx_send.swap(replies.front());
+		replies.pop_front();
+		return true;
+	}
+	switch (raw) {
+		case RAW_PAGES:
+			nextPagesSend();
+			return true;
+		case RAW_STREAM:
+			nextStreamSend();
+			return true;
+		default:
+			tx_send.clear();
+			return false;
+	}
+}
+
+void BandEmulator::nextPagesSend() {
+	const char* page_ptr = (const char*) &image[(size_t) raw_page * FLASH_PAGE];
+	
+	if (raw_offset < TAIL_START) {
+		tx_send.assign(page_ptr + raw_offset, TRANSFER_SIZE);
+		raw_offset += TRANSFER_SIZE;
+		return;
+	}
+	
+	// last 12 bytes & the next page leader or Done
+	tx_send.assign(page_ptr + TAIL_START, FLASH_PAGE - TAIL_START);
+	raw_page++;
+	raw_offset = 0;
+	if (raw_page < getPageCount()) {
+		char tmp[PAGE_LEADER];
+		leader(tmp, raw_page, false);
+		tx_send.append(tmp, PAGE_LEADER);
+	} else {
+		tx_send.append(DONE_STR, DONE_LEN);
+		raw = RAW_IDLE;
+	}
+}
+
+void BandEmulator::nextStreamSend() {
+
+	// full size packets of the leaders & pages back to back, then Done in a
+	// final short (maybe zero length) packet
+	tx_send.clear();
+	while ((int) tx_send.size() < packet) {
+		int room = packet - (int) tx_send.size();
+		if (raw_page < getPageCount()) {
+			if (raw_offset < PAGE_LEADER) {
+				char tmp[PAGE_LEADER];
+				leader(tmp, raw_page, true);
+				int size = PAGE_LEADER - raw_offset;
+				if (size > room)
+					size = room;
+				tx_send.append(tmp + raw_offset, size);
+				raw_offset += size;
+			} else {
+				const char* page_ptr = (const char*)
+					&image[(size_t) raw_page * FLASH_PAGE];
+				int size = max_transfer_page - raw_offset;
+				if (size > room)
+					size = room;
+				tx_send.append(page_ptr + raw_offset - PAGE_LEADER, size);
+				raw_offset += size;
+				if (raw_offset == (uint32_t) max_transfer_page) {
+					raw_page++;
+					raw_offset = 0;
+				}
+			}
+		} else if (raw_done < DONE_LEN) {
+			int size = DONE_LEN - raw_done;
+			if (size > room)
+				size = room;
+			tx_send.append(DONE_STR + raw_done, size);
+			raw_done += size;
+		} else {
+			break;
+		}
+	}
+	if ((int) tx_send.size() < packet)
+		raw = RAW_IDLE;
+}
+
+// EOF
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BAND_EMULATOR
+#define _BAND_EMULATOR
+
+#include "band_if.h"
+
+/**
+ * In-process stand in for a band on USB, set as the transport of a BioBandIf
+ * (see BioBandIf::setTransport) to exercise the PC side without a band. It
+ * answers the link, meta data, version & download time commands and serves
+ * the raw downloads (READ_RAW_CHAR, STREAM_RAW_CHAR & READ_RAW_FROM_CHAR)
+ * from a flash image, packet for packet as the firmware sends them. Any
+ * other command gets an ERROR reply.
+ *
+ * The emulator is not thread safe, it is driven by the one BioBandIf.
+ */
+class BandEmulator : public MBandTransport
+{
+public:
+	BandEmulator();
+	virtual ~BandEmulator();
+	
+	/**
+	 * Fill the flash image with a synthetic capture, a config page, a status
+	 * page and then pages of samples with valid crcs
+	 * \param num_pages is the number of pages in the capture
+	 * \param collect_start_time is the start time stored in the config page
+	 */
+	void createImage(uint32_t num_pages, time_t collect_start_time);
+	
+	/**
+	 * Load the flash image from a raw file recorded by readRawFromBand
+	 * \param aFilename is the raw file to read
+	 * \return the number of pages loaded otherwise < 0 if there is an error
+	 */
+	int loadImage(const char* aFilename);
+	
+	/**
+	 * Set the delay before each bulk read returns, modelling the USB round
+	 * trip and the band's turnaround
+	 * \param latency_us is the delay in microseconds, 0 for none
+	 */
+	void setLatency(unsigned int latency_us) { latency = latency_us; }
+	
+	/**
+	 * Stop (or resume) replying, modelling a hung band. The commands are
+	 * ignored and each bulk read waits out its timeout and returns nothing.
+	 * \param aResponding is false to stop replying
+	 */
+	void setResponding(bool aResponding) { responding = aResponding; }
+	
+	/**
+	 * Set the maximum packet size of the band's bulk in endpoint. A bulk read
+	 * continues over full size packets until a short packet.
+	 * \param packet_size is the size in bytes (default STREAM_PACKET_SIZE)
+	 * \return 0 indicates successful setting, < 0 if there is an error
+	 */
+	int setPacketSize(int packet_size);
+	
+	/**
+	 * Set the firmware version reported to the PC, which selects the download
+	 * kinds the PC will use (default the current firmware)
+	 */
+	void setFwVersion(float aFw) { fw_ver = aFw; }
+	
+	/**
+	 * Returns the number of pages in the flash image
+	 */
+	uint32_t getPageCount() { return (uint32_t) page_nums.size(); }
+	
+	/**
+	 * Returns the bytes a complete raw download of the image sends
+	 */
+	uint64_t getRawSize() {
+		return (uint64_t) getPageCount() * max_transfer_page + 4;
+	}
+	
+	// MBandTransport
+	virtual int writeBulk(const char* data, int len, unsigned int timeout_ms);
+	virtual int readBulk(char* data, int len, unsigned int timeout_ms);
+
+private:
+	typedef enum {
+		RAW_IDLE,
+		RAW_PAGES,
+		RAW_STREAM
+	} raw_mode;
+	
+	void queueReply(const void* data, int len);
+	void startRaw(uint32_t first_page, bool stream);
+	void leader(char* ptr, uint32_t page, bool stream);
+	bool nextSend();
+	void nextPagesSend();
+	void nextStreamSend();
+	
+	// FLASH_PAGE bytes for each page & the page number in its block
+	vector<uint8_t> image;
+	vector<uint16_t> page_nums;
+	struct config_info config;
+	
+	// the band's replies, each one as USB_Send_Data would send it
+	list<string> replies;
+	string tx_send;
+	size_t tx_pos;
+	
+	raw_mode raw;
+	uint32_t raw_page;
+	uint32_t raw_offset;
+	uint32_t raw_done;
+	uint32_t first_download;
+	
+	unsigned int latency;
+	bool responding;
+	int packet;
+	float hw_ver;
+	float fw_ver;
+};
+
+#endif
+
+// EOF
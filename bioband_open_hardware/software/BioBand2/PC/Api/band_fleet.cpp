@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MS VC++ does not appear to like this in an ifdef
+#include "stdafx.h"
+
+#include "band_fleet.h"
+
+#include <chrono>
+
+#define DEBUG(X) if (debug_flag) { X }
+
+#define FLEET_RAW_EXT ".raw"
+#define DEFAULT_PROGRESS_INTERVAL_MS 1000
+
+// Never overwrite an earlier download, add _1, _2 etc. to the name instead
+static string uniqueRawFilename(const string& base) {
+	string filename = base + FLEET_RAW_EXT;
+	int val = 1;
+	FILE* fd_ptr = fopen(filename.c_str(),"r");
+	while (fd_ptr) {
+		// room for any int
+		char tmp[sizeof("_-2147483648")];
+		fclose(fd_ptr);
+		snprintf(tmp,sizeof(tmp),"_%d",val++);
+		filename = base + tmp + FLEET_RAW_EXT;
+		fd_ptr = fopen(filename.c_str(),"r");
+	}
+	return filename;
+}
+
+bool BandFleet::pageCounter::evSamplesCallback() {
+	pages++;
+	reset();
+	return false;
+}
+
+BandFleet::BandFleet() :
+	progress_interval_ms(DEFAULT_PROGRESS_INTERVAL_MS),
+	record_download_time(true),
+	debug_flag(0) {
+}
+
+BandFleet::~BandFleet() {
+	cleanup();
+}
+
+int BandFleet::connectAll() {
+	if (!bands.empty()) {
+		return -E_BB_BAND_ALREADY_CONNECTED;
+	}
+	
+	list<string> serial_numbers;
+	{
+		BioBandIf finder;
+		int ret = finder.getBandSerialNumbers(serial_numbers);
+		if (ret < 0)
+			return ret;
+	}
+	if (serial_numbers.empty()) {
+		return -E_BB_BAND_NOT_CONNECTED;
+	}
+	
+	// the usb library enumeration is not thread safe, so connect each band in
+	// turn before any of the downloads start
+	list<string>::iterator iter;
+	for (iter = serial_numbers.begin(); iter != serial_numbers.end(); iter++) {
+		fleet_band* band_ptr = new fleet_band;
+		if (debug_flag)
+			band_ptr->band_if.enableDebug();
+		if (band_ptr->band_if.connectUsb(iter->c_str()) < 0 ||
+				!band_ptr->band_if.isValid()) {
+			fprintf(stderr,"Failed to connect to %s\n",iter->c_str());
+			delete band_ptr;
+			continue;
+		}
+		DEBUG(printf("Fleet connected %s\n",iter->c_str());)
+		band_ptr->serial_num = *iter;
+		band_ptr->pages_expected = 0;
+		band_ptr->result = 0;
+		band_ptr->finished = false;
+		band_ptr->reported = false;
+		bands.push_back(band_ptr);
+	}
+	if (bands.empty()) {
+		return -E_BB_BAND_NOT_CONNECTED;
+	}
+	return (int) bands.size();
+}
+
+int BandFleet::setAsyncTransfers(int transfers_in_flight) {
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		int ret = bands[idx]->band_if.setAsyncTransfers(transfers_in_flight);
+		if (ret != BB_SUCCESS)
+			return ret;
+	}
+	return BB_SUCCESS;
+}
+
+void BandFleet::setStreamDownload(int aEnable) {
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		bands[idx]->band_if.setStreamDownload(aEnable);
+	}
+}
+
+void BandFleet::setProgressInterval(int interval_ms) {
+	if (interval_ms > 0)
+		progress_interval_ms = interval_ms;
+}
+
+void BandFleet::downloadBand(fleet_band* band_ptr) {
+	BioBandIf& band_if = band_ptr->band_if;
+	
+	int pages = band_if.getPageCount();
+	if (pages > 0)
+		band_ptr->pages_expected = pages;
+	
+	FILE* fd_ptr = fopen(band_ptr->raw_filename.c_str(),"wb");
+	if (!fd_ptr) {
+		band_ptr->result = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	} else {
+		band_ptr->result = band_if.setRawDataCallbackPtr(&band_ptr->counter);
+		if (!band_ptr->result) {
+			band_ptr->result = band_if.readRawFromBand(fd_ptr);
+			if (band_ptr->result >= 0 && record_download_time)
+				band_if.setFirstDownloadTime(time(NULL));
+		}
+		fclose(fd_ptr);
+	}
+	band_ptr->finished = true;
+}
+
+int BandFleet::fillProgress(vector<band_progress>& progress,
+	int& pages_expected) {
+	int pages_received = 0;
+	pages_expected = 0;
+	progress.resize(bands.size());
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		fleet_band* band_ptr = bands[idx];
+		band_progress& entry = progress[idx];
+		entry.serial_num = band_ptr->serial_num;
+		entry.raw_filename = band_ptr->raw_filename;
+		entry.finished = band_ptr->finished;
+		entry.pages_received = band_ptr->counter.pages;
+		entry.pages_expected = band_ptr->pages_expected;
+		// the result is written before finished is set
+		entry.result = entry.finished ? band_ptr->result : 0;
+		pages_received += entry.pages_received;
+		pages_expected += entry.pages_expected;
+	}
+	return pages_received;
+}
+
+int BandFleet::download(const char* out_dir, MFleetObserver* obs_ptr) {
+	if (bands.empty()) {
+		return -E_BB_BAND_NOT_CONNECTED;
+	}
+	
+	vector<thread> threads;
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		fleet_band* band_ptr = bands[idx];
+		string base;
+		if (out_dir && *out_dir) {
+			base = out_dir;
+			base += "/";
+		}
+		base += band_ptr->serial_num;
+		band_ptr->raw_filename = uniqueRawFilename(base);
+		band_ptr->pages_expected = 0;
+		band_ptr->result = 0;
+		band_ptr->counter.pages = 0;
+		band_ptr->finished = false;
+		band_ptr->reported = false;
+		DEBUG(printf("Fleet %s -> %s\n",band_ptr->serial_num.c_str(),
+			band_ptr->raw_filename.c_str());)
+		threads.push_back(thread(&BandFleet::downloadBand, this, band_ptr));
+	}
+	
+	vector<band_progress> progress;
+	int pages_expected = 0;
+	size_t finished = 0;
+	while (finished < bands.size()) {
+		this_thread::sleep_for(chrono::milliseconds(progress_interval_ms));
+		int pages_received = fillProgress(progress, pages_expected);
+		finished = 0;
+		for (size_t idx = 0; idx < bands.size(); idx++) {
+			if (!progress[idx].finished)
+				continue;
+			finished++;
+			if (!bands[idx]->reported) {
+				bands[idx]->reported = true;
+				if (obs_ptr)
+					obs_ptr->evBandFinished(progress[idx]);
+			}
+		}
+		if (obs_ptr)
+			obs_ptr->evFleetProgress(progress, pages_received, pages_expected);
+	}
+	
+	int downloaded = 0;
+	for (size_t idx = 0; idx < threads.size(); idx++) {
+		threads[idx].join();
+		if (bands[idx]->result >= 0)
+			downloaded++;
+	}
+	return downloaded;
+}
+
+void BandFleet::cleanup() {
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		bands[idx]->band_if.cleanup();
+		delete bands[idx];
+	}
+	bands.clear();
+}
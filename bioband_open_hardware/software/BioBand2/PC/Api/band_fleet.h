@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BAND_FLEET
+#define _BAND_FLEET
+
+#include "band_if.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+/**
+ * Progress of a single band in a fleet download
+ */
+struct band_progress
+{
+	string serial_num;
+	// from the band's config, 0 if it could not be read
+	int pages_expected;
+	int pages_received;
+	bool finished;
+	// total bytes received otherwise < 0 if there is an error
+	int result;
+	string raw_filename;
+};
+
+/**
+ * Fleet download observer, all the callbacks are invoked on the thread that
+ * called BandFleet::download so the observer needs no locking
+ */
+struct MFleetObserver
+{
+	virtual ~MFleetObserver() {}
+	
+	/**
+	 * Notifies the client of the progress of every band, invoked periodically
+	 * while the download is in progress and once more at the end
+	 * \param bands is the progress of each band
+	 * \param pages_received is the total pages received over all the bands
+	 * \param pages_expected is the total pages expected over all the bands
+	 */
+	virtual void evFleetProgress(const vector<band_progress>& bands,
+		int pages_received, int pages_expected) = 0;
+	
+	/**
+	 * Notifies the client that a band has completed its download
+	 * \param band is the final progress of the band
+	 */
+	virtual void evBandFinished(const band_progress& band) = 0;
+};
+
+/**
+ * Downloads all the bands attached to the PC (e.g. in a docking station)
+ * concurrently, one thread per band. Each band's raw data is written to its
+ * own <serial number>.raw file.
+ */
+class BandFleet
+{
+public:
+	BandFleet();
+	virtual ~BandFleet();
+	
+	/**
+	 * Connect to every band attached to USB
+	 * \return the number of bands connected otherwise < 0 if there is an error
+	 */
+	int connectAll();
+	
+	/**
+	 * Download the raw data from all the connected bands concurrently
+	 * \param out_dir is the directory for the raw files, NULL for the current
+	 * directory
+	 * \param obs_ptr is the optional progress observer
+	 * \return the number of bands successfully downloaded otherwise < 0 if
+	 * there is an error
+	 */
+	int download(const char* out_dir, MFleetObserver* obs_ptr);
+	
+	/**
+	 * Select asynchronous USB transfers for every band in the fleet, see
+	 * BioBandIf::setAsyncTransfers
+	 * \return 0 indicates successful setting, < 0 if there is an error
+	 */
+	int setAsyncTransfers(int transfers_in_flight);
+	
+	/**
+	 * Select the streamed raw download for every band in the fleet, see
+	 * BioBandIf::setStreamDownload
+	 */
+	void setStreamDownload(int aEnable);
+	
+	/**
+	 * Set how often evFleetProgress is invoked during a download
+	 * \param interval_ms is the interval in milliseconds
+	 */
+	void setProgressInterval(int interval_ms);
+	
+	/**
+	 * Record the download time on each band after a successful download
+	 * (as done by the mrc -raw option), enabled by default
+	 */
+	void setRecordDownloadTime(bool record) { record_download_time = record; }
+	
+	/**
+	 * Returns the number of connected bands
+	 */
+	int bandCount() { return (int) bands.size(); }
+	
+	/**
+	 * Disconnect from all the bands
+	 */
+	void cleanup();
+	
+	void enableDebug() { debug_flag = 1; }
+	void disableDebug() { debug_flag = 0; }
+	
+private:
+	// counts the pages decoded for one band
+	struct pageCounter : public MDataObserver
+	{
+		pageCounter() : pages(0) {}
+		bool evSamplesCallback();
+		void evDoneCallback() {}
+		atomic<int> pages;
+	};
+	
+	struct fleet_band {
+		BioBandIf band_if;
+		string serial_num;
+		string raw_filename;
+		pageCounter counter;
+		atomic<int> pages_expected;
+		int result;
+		atomic<bool> finished;
+		bool reported;
+	};
+	
+	void downloadBand(fleet_band* band_ptr);
+	int fillProgress(vector<band_progress>& progress, int& pages_expected);
+	
+	vector<fleet_band*> bands;
+	int progress_interval_ms;
+	bool record_download_time;
+	int debug_flag;
+};
+
+#endif
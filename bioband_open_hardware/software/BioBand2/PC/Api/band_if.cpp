@@ -31,6 +31,33 @@
 #include "stdafx.h"
 
 #include "band_if.h"
+#include "crc16.h"
+
+#include <limits.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CONV_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#define CONV_AVX2
+#include <immintrin.h>
+#endif
+
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 #define READ_DIAG_OUTPUT
 
@@ -43,6 +70,38 @@ const unsigned char ENDPOINT_UP = 0x81;
 #define FINISHED 1
 
 #define DEFAULT_READ_TIMEOUT 50000
+// erase takes a long time, so extend the normal read timeout
+#define ERASE_READ_TIMEOUT 1000000
+// once LATENCY_MIN_REPLIES replies to an op have been seen its read timeout
+// is LATENCY_TIMEOUT_FACTOR times the slowest, within MIN_READ_TIMEOUT and
+// the default for the op
+#define LATENCY_MIN_REPLIES 4
+#define LATENCY_TIMEOUT_FACTOR 4
+#define MIN_READ_TIMEOUT 1000
+
+#ifdef USBLIB1
+#define USB_READ_TIMED_OUT LIBUSB_ERROR_TIMEOUT
+#else
+#define USB_READ_TIMED_OUT (-ETIMEDOUT)
+#endif
+
+static double msSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() -
+		start).count();
+}
+
+// first firmware version supporting STREAM_RAW_CHAR
+#define STREAM_MIN_FW 1.4f
+// first firmware version supporting ACCEL_COMPRESS_MASK
+#define COMPRESS_MIN_FW 1.5f
+// first firmware version supporting GET_PROFILE_CHAR
+#define PROFILE_MIN_FW 1.6f
+// first firmware version supporting READ_RAW_FROM_CHAR
+#define RESUME_MIN_FW 1.7f
+
+#define MAX_ASYNC_TRANSFERS 32
+// multiple of the endpoint packet size
+#define ASYNC_TRANSFER_SIZE 4096
 #define CMJ_USB_DEBUG 0
 
 
@@ -50,19 +109,145 @@ const unsigned char ENDPOINT_UP = 0x81;
 
 // conversion funcs
 
-double convAccValueToGValue(uint8_t*& aSamplePtr) {
+double convAccValueToGValue(uint8_t*& aSamplePtr, double divisor) {
 	
 	// values are big-endian order
-	// assume accelerometer is set for +/-8g scale // TODO ***** enable other full G scales ***
 	int16_t v=(int16_t) *aSamplePtr++;
 	v<<=8;
 	v&=0xff00;
 	v|=(uint8_t) *aSamplePtr++;
-	double float_val = (double)v / 4096;
+	double float_val = (double)v / divisor;
 		
 	return float_val;
 }
 
+double convGScaleToDivisor(uint8_t accel_conf_raw) {
+	
+	// the accelerometer is 16 bit left justified so full scale is +/-32768
+	double divisor = default_g_divisor;
+	accel_data_rate rate;
+	accel_g_scale scale;
+	if (!decodeRateAndGscale(accel_conf_raw, &rate, &scale)) {
+		switch (scale) {
+			case CWA_2G:
+				divisor = 16384;
+				break;
+			case CWA_4G:
+				divisor = 8192;
+				break;
+			default:
+				// older bands do not store a config and always ran at 8g
+				break;
+		}
+	}
+	return divisor;
+}
+
+// Batch conversions - the divisors are all powers of two so multiplying by
+// the reciprocal gives exactly the same result as convAccValueToGValue
+
+static inline int16_t bigEndianToInt16(const uint8_t* ptr) {
+	return (int16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+int convAccSamplesToGValues(const uint8_t* raw_ptr, int num_samples,
+	double* g_vals, double divisor) {
+	
+	if (!raw_ptr || !g_vals || num_samples <= 0)
+		return 0;
+	
+	const int num_vals = num_samples * 3;
+	const double scale = 1 / divisor;
+	int idx = 0;
+	
+#if defined(CONV_AVX2)
+	const __m256i swap_mask = _mm256_setr_epi8(
+		1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+		1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m256d scale_vec = _mm256_set1_pd(scale);
+	for (; idx + 16 <= num_vals; idx += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (raw_ptr + idx * 2));
+		v = _mm256_shuffle_epi8(v, swap_mask);
+		__m128i lo = _mm256_castsi256_si128(v);
+		__m128i hi = _mm256_extracti128_si256(v, 1);
+		__m256i lo32 = _mm256_cvtepi16_epi32(lo);
+		__m256i hi32 = _mm256_cvtepi16_epi32(hi);
+		_mm256_storeu_pd(g_vals + idx, _mm256_mul_pd(
+			_mm256_cvtepi32_pd(_mm256_castsi256_si128(lo32)), scale_vec));
+		_mm256_storeu_pd(g_vals + idx + 4, _mm256_mul_pd(
+			_mm256_cvtepi32_pd(_mm256_extracti128_si256(lo32, 1)), scale_vec));
+		_mm256_storeu_pd(g_vals + idx + 8, _mm256_mul_pd(
+			_mm256_cvtepi32_pd(_mm256_castsi256_si128(hi32)), scale_vec));
+		_mm256_storeu_pd(g_vals + idx + 12, _mm256_mul_pd(
+			_mm256_cvtepi32_pd(_mm256_extracti128_si256(hi32, 1)), scale_vec));
+	}
+#elif defined(CONV_SSE2)
+	const __m128d scale_vec = _mm_set1_pd(scale);
+	for (; idx + 8 <= num_vals; idx += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (raw_ptr + idx * 2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		// sign extend to 32 bits
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_pd(g_vals + idx, _mm_mul_pd(_mm_cvtepi32_pd(lo), scale_vec));
+		_mm_storeu_pd(g_vals + idx + 2, _mm_mul_pd(
+			_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, 0x4E)), scale_vec));
+		_mm_storeu_pd(g_vals + idx + 4, _mm_mul_pd(_mm_cvtepi32_pd(hi), scale_vec));
+		_mm_storeu_pd(g_vals + idx + 6, _mm_mul_pd(
+			_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, 0x4E)), scale_vec));
+	}
+#endif
+	
+	for (; idx < num_vals; idx++)
+		g_vals[idx] = bigEndianToInt16(raw_ptr + idx * 2) * scale;
+	
+	return num_vals;
+}
+
+int convAccSamplesToGValues(const uint8_t* raw_ptr, int num_samples,
+	float* g_vals, double divisor) {
+	
+	if (!raw_ptr || !g_vals || num_samples <= 0)
+		return 0;
+	
+	const int num_vals = num_samples * 3;
+	const float scale = (float) (1 / divisor);
+	int idx = 0;
+	
+#if defined(CONV_AVX2)
+	const __m256i swap_mask = _mm256_setr_epi8(
+		1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+		1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m256 scale_vec = _mm256_set1_ps(scale);
+	for (; idx + 16 <= num_vals; idx += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (raw_ptr + idx * 2));
+		v = _mm256_shuffle_epi8(v, swap_mask);
+		__m256i lo32 = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+		__m256i hi32 = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		_mm256_storeu_ps(g_vals + idx,
+			_mm256_mul_ps(_mm256_cvtepi32_ps(lo32), scale_vec));
+		_mm256_storeu_ps(g_vals + idx + 8,
+			_mm256_mul_ps(_mm256_cvtepi32_ps(hi32), scale_vec));
+	}
+#elif defined(CONV_SSE2)
+	const __m128 scale_vec = _mm_set1_ps(scale);
+	for (; idx + 8 <= num_vals; idx += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (raw_ptr + idx * 2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(g_vals + idx, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale_vec));
+		_mm_storeu_ps(g_vals + idx + 4,
+			_mm_mul_ps(_mm_cvtepi32_ps(hi), scale_vec));
+	}
+#endif
+	
+	for (; idx < num_vals; idx++)
+		g_vals[idx] = bigEndianToInt16(raw_ptr + idx * 2) * scale;
+	
+	return num_vals;
+}
+
 double convADCToVoltage(uint16_t adc) {
 	
 	/* The ADC input voltage is (10/32)*battery voltage.
@@ -98,7 +283,9 @@ double convTempBinToCelsius(uint16_t temp_bin_val) {
 time_t convTicksToTime(time_t start_time, uint32_t number_ticks) {
 	time_t ret = start_time;
 	
-	uint32_t secs = (RTC_SCALAR * number_ticks)/ RTC_CLOCK_BASE;
+	// 64 bit as the product overflows after about 1.5 days of ticks
+	uint32_t secs = (uint32_t) (((uint64_t) RTC_SCALAR * number_ticks) /
+		RTC_CLOCK_BASE);
 	ret += secs;
 	
 	return ret;
@@ -115,8 +302,10 @@ void convHwFwVerToBytes(uint8_t ver_raw, uint8_t& hwb, uint8_t& fwb) {
 
 void MDataObserver::reset() {
 	crc_ok = false;
-	raw_sample_list.clear();
+	num_raw_samples = 0;
 	status_raw = UNUSED_PAGE;
+	compressed = false;
+	overruns = 0;
 	current_tick = 0;
 	temperature_raw = 0;
 	dbg_raw.clear();
@@ -140,23 +329,39 @@ void MDataObserver::reset() {
 
 void MDataObserver::addRawSample(uint8_t* bytesPtr) {
 	
-	sample s;
-	memcpy(s.sample_raw, bytesPtr, BYTES_PER_SAMPLE);
-	raw_sample_list.push_back(s);
+	// a page never holds more than MAX_SAMPLES_PER_PAGE so no need to grow
+	if (num_raw_samples < MAX_SAMPLES_PER_PAGE) {
+		memcpy(raw_samples[num_raw_samples].sample_raw, bytesPtr,
+			BYTES_PER_SAMPLE);
+		num_raw_samples++;
+	}
+}
+
+void MDataObserver::sample::giveGValues(double& x, double& y, double& z,
+	double divisor) const {
+	uint8_t* ptr = (uint8_t*) sample_raw;
+	x = convAccValueToGValue(ptr, divisor);
+	y = convAccValueToGValue(ptr, divisor);
+	z = convAccValueToGValue(ptr, divisor);
+}
+
+int MDataObserver::giveGValues(double* g_vals) const {
+	// the sample store is contiguous so can be treated as one byte array
+	return convAccSamplesToGValues(raw_samples[0].sample_raw, num_raw_samples,
+		g_vals, g_divisor);
 }
 
-void MDataObserver::sample::giveGValues(double& x, double& y, double& z) {
-	uint8_t* ptr = sample_raw;
-	x = convAccValueToGValue(ptr);
-	y = convAccValueToGValue(ptr);
-	z = convAccValueToGValue(ptr);
+int MDataObserver::giveGValues(float* g_vals) const {
+	return convAccSamplesToGValues(raw_samples[0].sample_raw, num_raw_samples,
+		g_vals, g_divisor);
 }
 
 // --------------------------------------------------------------------------
 
 BioBandIf::BioBandIf():
 	current_state(ESTABLISH_LINK),
-	dev_handle(NULL),
+	transport_ptr(NULL),
+	usb_transport(NULL),
 	iBadBlocksPtr(NULL),
 	iLevelsPtr(NULL),
 	read_page_ptr(NULL),
@@ -165,10 +370,13 @@ BioBandIf::BioBandIf():
 	iDebugDataPtr(NULL) {
 		
 	data_count = 1;
+	raw_decode.data_count = 1;
+	raw_decode.status_page_found = false;
 	page_idx = 0;
 	pg_count = 0;
-	crc_hi = 0xFF;
-	crc_lo = 0xFF;
+	crc_hi = CRC16_INITIAL_VALUE;
+	crc_lo = CRC16_INITIAL_VALUE;
+	crc16Init();
 	wait_for_start = 1;
 	total_rec = 0;
 	
@@ -178,18 +386,38 @@ BioBandIf::BioBandIf():
 	
 	memset(&received_config_data,0,sizeof(received_config_data));
 	full_config_defined = 0;
+	summary_defined = 0;
 	
 	new_band_id_length = 0;
 	read_timeout = DEFAULT_READ_TIMEOUT;
+	memset(latency,0,sizeof(latency));
 	
 	debug_flag = 0;
 	first_download = 0;
+	
+	hw_ver = 0;
+	fw_ver = 0;
+	read_size = SIMPLE_TX_DATA_SIZE;
+	
+	async_transfers = 0;
+	decode_threads = 0;
+	decode_pool = NULL;
+	stream_download = 0;
+	stream_raw = 0;
+	raw_first_page = 1;
+	raw_base_offset = 0;
+	raw_index_ptr = NULL;
+#ifdef USBLIB1
+	raw_queue = NULL;
+#endif
+	
+	profile_request = 0;
+	memset(&profile_read,0,sizeof(profile_read));
+	profile_clock_hz = 0;
 }
 
 BioBandIf::~BioBandIf() {
-	if (dev_handle) {
-		closeUsb();
-	}
+	closeUsb();
 	if (read_page_ptr)
 		delete[] read_page_ptr;
 }
@@ -200,24 +428,191 @@ void BioBandIf::setBandDebugLeds() {
 
 // -----------------------------------------------------------------------------
 
+// Parallel page decode
+//
+// The thread reading the pages copies each one into a ring of slots and the
+// workers check the slots in turn. The reading thread then hands the checked
+// pages to the observer strictly in the order they were read, the page
+// numbers restart in every block so the order is kept by the ring.
+
+#define MAX_DECODE_THREADS 32
+
+class BioBandIf::RawDecodePool {
+public:
+	RawDecodePool(BioBandIf& aBandIf, int num_threads);
+	~RawDecodePool();
+	
+	// queue a page, first delivering the oldest one if the ring is full
+	void submit(const char* page_ptr, uint16_t page_num, bool start_found);
+	
+	// deliver the pages checked so far, or with wait_all every page queued,
+	// returns true once the observer has asked to stop
+	bool deliver(bool wait_all);
+	
+private:
+	struct decode_slot {
+		char data[max_transfer_page];
+		uint16_t page_num;
+		bool start_found;
+		bool checked;
+		page_check check;
+	};
+	
+	static const size_t pool_pages = 64;
+	
+	void worker();
+	bool deliverNext(bool wait);
+	
+	BioBandIf& band_if;
+	decode_slot* slots;
+	// sequence numbers of the next page to queue, check & deliver
+	uint64_t next_submit;
+	uint64_t next_check;
+	uint64_t next_deliver;
+	bool stopping;
+	bool stop_requested;
+	
+	mutex lock;
+	condition_variable work_cond;
+	condition_variable checked_cond;
+	vector<thread> workers;
+};
+
+BioBandIf::RawDecodePool::RawDecodePool(BioBandIf& aBandIf,
+	int num_threads) :
+	band_if(aBandIf),
+	next_submit(0),
+	next_check(0),
+	next_deliver(0),
+	stopping(false),
+	stop_requested(false) {
+	
+	slots = new decode_slot[pool_pages];
+	for (int loop = 0; loop < num_threads; loop++)
+		workers.push_back(thread(&RawDecodePool::worker, this));
+}
+
+BioBandIf::RawDecodePool::~RawDecodePool() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	work_cond.notify_all();
+	for (size_t idx = 0; idx < workers.size(); idx++)
+		workers[idx].join();
+	delete[] slots;
+}
+
+void BioBandIf::RawDecodePool::submit(const char* page_ptr,
+	uint16_t page_num, bool start_found) {
+	
+	if (next_submit - next_deliver == pool_pages)
+		deliverNext(true);
+	
+	// the slot is not seen by the workers until next_submit moves past it
+	decode_slot& slot = slots[next_submit % pool_pages];
+	memcpy(slot.data, page_ptr, max_transfer_page);
+	slot.page_num = page_num;
+	slot.start_found = start_found;
+	slot.checked = false;
+	{
+		lock_guard<mutex> guard(lock);
+		next_submit++;
+	}
+	work_cond.notify_one();
+}
+
+bool BioBandIf::RawDecodePool::deliver(bool wait_all) {
+	while (next_deliver < next_submit) {
+		if (!deliverNext(wait_all))
+			break;
+	}
+	return stop_requested;
+}
+
+bool BioBandIf::RawDecodePool::deliverNext(bool wait) {
+	decode_slot& slot = slots[next_deliver % pool_pages];
+	{
+		unique_lock<mutex> guard(lock);
+		if (!wait && !slot.checked)
+			return false;
+		while (!slot.checked)
+			checked_cond.wait(guard);
+	}
+	
+	// once the observer asks to stop the remaining pages are dropped
+	if (!stop_requested) {
+		if (slot.start_found) {
+			band_if.deliverRawPage(slot.data, slot.page_num, slot.check,
+				band_if.sample_obs_ptr, band_if.raw_decode);
+		} else {
+			printf("Ignoring data\n");
+		}
+		if (band_if.sample_obs_ptr->evSamplesCallback())
+			stop_requested = true;
+	}
+	next_deliver++;
+	return true;
+}
+
+void BioBandIf::RawDecodePool::worker() {
+	unique_lock<mutex> guard(lock);
+	
+	while (true) {
+		while (!stopping && (next_check == next_submit))
+			work_cond.wait(guard);
+		if (stopping)
+			break;
+		decode_slot& slot = slots[next_check++ % pool_pages];
+		guard.unlock();
+		if (slot.start_found)
+			band_if.checkRawPage(slot.data, slot.page_num, slot.check);
+		guard.lock();
+		slot.checked = true;
+		checked_cond.notify_one();
+	}
+}
+
+void BioBandIf::startDecodePool() {
+	// the debug dump stays in order by decoding on the reading thread
+	if (decode_threads && (raw_fd != stdout))
+		decode_pool = new RawDecodePool(*this, decode_threads);
+}
+
+void BioBandIf::stopDecodePool() {
+	if (decode_pool) {
+		decode_pool->deliver(true);
+		delete decode_pool;
+		decode_pool = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------------
+
 // USB methods
 
 #ifdef USBLIB1
 
 // Libusb 1.0 code
 
-int BioBandIf::getBandSerialNumbers(list<string>& serial_numbers) {
+LibusbTransport::LibusbTransport(int aDebugFlag) :
+	debug_flag(aDebugFlag),
+	dev_handle(NULL),
+	ctx(NULL) {
+}
+
+LibusbTransport::~LibusbTransport() {
+	close();
+}
+
+int LibusbTransport::getSerialNumbers(list<string>& serial_numbers) {
 	int band_count = 0;
 	libusb_device **devs;
 	ssize_t cnt;
 
-    if (NULL != dev_handle) {
-        fprintf(stderr, "Device already connected\n");
-        return -E_BB_BAND_ALREADY_CONNECTED;
-	}
-	
     if (libusb_init(&ctx) < 0) {
         fprintf(stderr, "libusb_init failed\n");
+        ctx = NULL;
         return -E_BB_USB_GENERIC_FAILURE;
     }
     
@@ -267,19 +662,15 @@ int BioBandIf::getBandSerialNumbers(list<string>& serial_numbers) {
 	return band_count;
 }
 
-int BioBandIf::connectUsb(const char* aSerialNum) {
+int LibusbTransport::open(const char* aSerialNum) {
 	int retval = 0;
 	libusb_device **devs;
 	ssize_t cnt;
 
-    if (NULL != dev_handle) {
-        fprintf(stderr, "Device already connected\n");
-        return -E_BB_BAND_ALREADY_CONNECTED;
-	}
-	
     retval = libusb_init(&ctx);
     if (retval < 0) {
         fprintf(stderr, "libusb_init failed %d\n",retval);
+        ctx = NULL;
         return retval;
     }
     
@@ -336,7 +727,6 @@ int BioBandIf::connectUsb(const char* aSerialNum) {
 	libusb_free_device_list(devs, 1);
 
     if (dev_handle==NULL) {
-		libusb_exit(ctx);
     	return -E_BB_GENERIC_FAILURE;
 	}
 	
@@ -351,7 +741,6 @@ int BioBandIf::connectUsb(const char* aSerialNum) {
 	retval = libusb_claim_interface(dev_handle, 0);
 	if(retval < 0) {
 			fprintf(stderr, "cannot claim interface\n");
-			libusb_exit(ctx);
 			return retval;
 	}
 	DEBUG(printf("claimed interface\n");)
@@ -359,11 +748,23 @@ int BioBandIf::connectUsb(const char* aSerialNum) {
 	return retval;
 }
 
-int BioBandIf::writeUsb(const int len) {
+void LibusbTransport::close() {
+	if(dev_handle) {
+		libusb_close(dev_handle);
+		dev_handle=NULL;
+	}
+	if (ctx) {
+		libusb_exit(ctx);
+		ctx = NULL;
+	}
+}
+
+int LibusbTransport::writeBulk(const char* data, int len,
+	unsigned int timeout_ms) {
 	int actual = 0;
 	
 	int r = libusb_bulk_transfer(dev_handle, ENDPOINT_DOWN,
-								(unsigned char*) writechars, len, &actual, 10);
+		(unsigned char*) data, len, &actual, timeout_ms);
 	if( r < 0 ) {
 		perror("USB bulk write");
 		DEBUG(printf("Write failed %d\n", r);)
@@ -371,48 +772,227 @@ int BioBandIf::writeUsb(const int len) {
 	return actual;
 }
 
-int BioBandIf::readUsb() {
+int LibusbTransport::readBulk(char* data, int len, unsigned int timeout_ms) {
 	int rdlen, retval = libusb_bulk_transfer(dev_handle, ENDPOINT_UP,
-						(unsigned char*) readchars, SIMPLE_TX_DATA_SIZE,
-						&rdlen, read_timeout);
+						(unsigned char*) data, len, &rdlen, timeout_ms);
 	if (!retval)
 		retval = rdlen;
 	return retval;
 }
 
-void BioBandIf::flushUsb() {
-	char c;
-	int retval=0,count=0;
+// Asynchronous raw download
+//
+// The thread that invoked readRawFromBand keeps async_transfers bulk reads
+// queued and frames the pages as the transfers complete (inside
+// libusb_handle_events). Complete pages are handed through raw_queue to a
+// worker thread which does the crc check, decode and observer callbacks.
+
+void LIBUSB_CALL BioBandIf::asyncTransferCb(struct libusb_transfer* transfer) {
+	BioBandIf* band_if = (BioBandIf*) transfer->user_data;
+	band_if->asyncTransferComplete(transfer);
+}
+
+void BioBandIf::asyncTransferComplete(struct libusb_transfer* transfer) {
+	async_in_flight--;
 	
-	do {
-		retval=libusb_bulk_transfer(dev_handle, ENDPOINT_UP,
-			(unsigned char *)&c, 1, &count, 1);
-		DEBUG(printf("flushUsb() %d\n",count);)
-	} while (!retval);
+	switch (transfer->status) {
+		case LIBUSB_TRANSFER_COMPLETED:
+		case LIBUSB_TRANSFER_TIMED_OUT:
+			// a timed out transfer keeps what arrived before the timeout
+			if (!async_done && !async_result && !async_stopped &&
+					(transfer->actual_length > 0)) {
+				int ret = processRawChunk((char*) transfer->buffer,
+					transfer->actual_length);
+				if (FINISHED == ret)
+					async_done = true;
+				else if (ret)
+					async_result = ret;
+			} else if ((LIBUSB_TRANSFER_TIMED_OUT == transfer->status) &&
+					!async_done && !async_result && !async_stopped) {
+				fprintf(stderr,
+					"No response from band (press reset on breakout board)\n");
+				async_result = -E_BB_NO_RESPONSE_FROM_BAND;
+			}
+			break;
+		case LIBUSB_TRANSFER_CANCELLED:
+			break;
+		case LIBUSB_TRANSFER_NO_DEVICE:
+			async_result = LIBUSB_ERROR_NO_DEVICE;
+			break;
+		default:
+			DEBUG(printf("async transfer status %d\n",transfer->status);)
+			if (!async_done)
+				async_result = -E_BB_USB_READ_FAILURE;
+			break;
+	}
+	
+	if (!async_done && !async_result && !async_stopped) {
+		if (libusb_submit_transfer(transfer) < 0)
+			async_result = -E_BB_USB_GENERIC_FAILURE;
+		else
+			async_in_flight++;
+	}
 }
 
-void BioBandIf::closeUsb() {
-	if(dev_handle) {
-		libusb_close(dev_handle);
-		dev_handle=NULL;
-		libusb_exit(ctx);
+void BioBandIf::asyncDecodeWorker() {
+	bool running = true;
+	
+	// once the observer asks to stop, the reading thread stops queuing
+	// transfers and the pages already read are dropped
+	while (running) {
+		raw_page_item* item = raw_queue->waitFront();
+		switch (item->kind) {
+			case RAW_PAGE_ITEM:
+				if (async_stopped)
+					break;
+				if (decode_pool) {
+					decode_pool->submit(item->data, item->page_num,
+						item->start_found);
+					if (decode_pool->deliver(false))
+						async_stopped = true;
+					break;
+				}
+				if (item->start_found) {
+					decodeRawPage(item->data, item->page_num, sample_obs_ptr,
+						raw_decode);
+				} else {
+					printf("Ignoring data\n");
+				}
+				if (sample_obs_ptr->evSamplesCallback())
+					async_stopped = true;
+				break;
+			case RAW_DONE_ITEM:
+				if (decode_pool)
+					decode_pool->deliver(true);
+				sample_obs_ptr->evDoneCallback();
+				running = false;
+				break;
+			default:
+				if (decode_pool)
+					decode_pool->deliver(true);
+				running = false;
+				break;
+		}
+		raw_queue->pop();
+	}
+}
+
+int BioBandIf::asyncRawLoop() {
+	struct libusb_transfer* transfers[MAX_ASYNC_TRANSFERS];
+	int num_transfers = 0;
+	bool cancelled = false;
+	
+	raw_queue = new SpscQueue<raw_page_item, raw_queue_pages>;
+	async_done = false;
+	async_result = 0;
+	async_in_flight = 0;
+	async_stopped = false;
+	
+	DEBUG(printf("async raw read, %d transfers\n",async_transfers);)
+	
+	thread worker(&BioBandIf::asyncDecodeWorker, this);
+	
+	for (int loop = 0; loop < async_transfers; loop++) {
+		struct libusb_transfer* transfer = libusb_alloc_transfer(0);
+		if (!transfer) {
+			async_result = -E_BB_USB_GENERIC_FAILURE;
+			break;
+		}
+		transfers[num_transfers++] = transfer;
+		libusb_fill_bulk_transfer(transfer, usb_transport->handle(),
+			ENDPOINT_UP, new unsigned char[ASYNC_TRANSFER_SIZE],
+			ASYNC_TRANSFER_SIZE, asyncTransferCb, this, read_timeout);
+		if (libusb_submit_transfer(transfer) < 0) {
+			async_result = -E_BB_USB_GENERIC_FAILURE;
+			break;
+		}
+		async_in_flight++;
+	}
+	
+	while (async_in_flight > 0) {
+		if ((async_done || async_result || async_stopped) && !cancelled) {
+			// anything still queued is surplus
+			for (int loop = 0; loop < num_transfers; loop++)
+				libusb_cancel_transfer(transfers[loop]);
+			cancelled = true;
+		}
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(usb_transport->context(), &tv,
+			NULL);
+	}
+	
+	if (!async_done) {
+		// let the worker finish off what it has and stop
+		raw_page_item* item = raw_queue->waitClaim();
+		item->kind = RAW_ABORT_ITEM;
+		raw_queue->publish();
+	}
+	worker.join();
+	
+	for (int loop = 0; loop < num_transfers; loop++) {
+		delete[] transfers[loop]->buffer;
+		libusb_free_transfer(transfers[loop]);
 	}
+	delete raw_queue;
+	raw_queue = NULL;
+	
+	return async_done ? FINISHED : async_result;
+}
+
+// As above for a transport set by setTransport, the calling thread does the
+// (blocking) reads in place of the queued transfers
+
+int BioBandIf::asyncTransportLoop(int kind) {
+	int ret = 0;
+	chrono::steady_clock::time_point last_reply = chrono::steady_clock::now();
+	
+	raw_queue = new SpscQueue<raw_page_item, raw_queue_pages>;
+	async_stopped = false;
+	
+	thread worker(&BioBandIf::asyncDecodeWorker, this);
+	
+	while (!ret && !async_stopped) {
+		int rdlen = readReply(kind, last_reply);
+		if (rdlen > 0) {
+			ret = processRawChunk(readchars, rdlen);
+		} else if ((rdlen < 0) && (USB_READ_TIMED_OUT != rdlen)) {
+			ret = -E_BB_USB_READ_FAILURE;
+		} else if (noResponse(kind, last_reply)) {
+			ret = -E_BB_NO_RESPONSE_FROM_BAND;
+		}
+	}
+	
+	if (FINISHED != ret) {
+		raw_page_item* item = raw_queue->waitClaim();
+		item->kind = RAW_ABORT_ITEM;
+		raw_queue->publish();
+	}
+	worker.join();
+	
+	delete raw_queue;
+	raw_queue = NULL;
+	
+	return ret;
 }
 
 #else
 
 // Libusb 0.1 code
 
-int BioBandIf::getBandSerialNumbers(list<string>& serial_numbers) {
+LibusbTransport::LibusbTransport(int aDebugFlag) :
+	debug_flag(aDebugFlag),
+	dev_handle(NULL) {
+}
+
+LibusbTransport::~LibusbTransport() {
+	close();
+}
+
+int LibusbTransport::getSerialNumbers(list<string>& serial_numbers) {
 	int band_count = 0;
     struct usb_bus* bus;
     struct usb_device* dev;
 
-    if (NULL != dev_handle) {
-        fprintf(stderr, "Device already connected\n");
-        return -E_BB_BAND_ALREADY_CONNECTED;
-	}
-	
     usb_init();
     
 	DEBUG(usb_set_debug(4);)
@@ -452,18 +1032,13 @@ int BioBandIf::getBandSerialNumbers(list<string>& serial_numbers) {
     return band_count;
 }
 
-int BioBandIf::connectUsb(const char* aSerialNum) {
+int LibusbTransport::open(const char* aSerialNum) {
 	int retval = 0;
 	int band_count = 0;
     struct usb_bus* bus;
     struct usb_device* dev;
     struct usb_device* found_dev = NULL;
 
-    if (NULL != dev_handle) {
-        fprintf(stderr, "Device already connected\n");
-        return -E_BB_BAND_ALREADY_CONNECTED;
-	}
-	
     usb_init();
     
 	DEBUG(usb_set_debug(4);)
@@ -520,41 +1095,97 @@ int BioBandIf::connectUsb(const char* aSerialNum) {
 			band_count);
 		return -E_BB_NO_SERIAL_NUMBER_MATCH;
 	}
+	if (!dev_handle)
+		return -E_BB_USB_GENERIC_FAILURE;
 	
 #ifdef _WIN32
 
 	/* Microsoft appears to require the following */
-    if (dev_handle) {
-		if (usb_set_configuration(dev_handle, MY_CONFIG) < 0)
-		{
-			fprintf(stderr, "error: setting config #%d failed\n",MY_CONFIG);
-			usb_close(dev_handle);
-			dev_handle = NULL;
-			return -E_BB_USB_GENERIC_FAILURE;
-		}
-		else
-		{
-			DEBUG(printf("success: set configuration #%d\n", MY_CONFIG);)
-		}
+	if (usb_set_configuration(dev_handle, MY_CONFIG) < 0)
+	{
+		fprintf(stderr, "error: setting config #%d failed\n",MY_CONFIG);
+		usb_close(dev_handle);
+		dev_handle = NULL;
+		return -E_BB_USB_GENERIC_FAILURE;
+	}
+	else
+	{
+		DEBUG(printf("success: set configuration #%d\n", MY_CONFIG);)
 	}
 #endif
 
-    if (dev_handle) {
-		if (usb_claim_interface(dev_handle, 0) < 0)
-		{
-			fprintf(stderr, "error: claiming interface #%d failed\n", MY_INTF);
-			usb_close(dev_handle);
-			dev_handle = NULL;
-			retval = -E_BB_USB_GENERIC_FAILURE;
-		}
-		else
-		{
-			DEBUG(printf("success: claim_interface #%d\n", MY_INTF);)
-		}
+	if (usb_claim_interface(dev_handle, 0) < 0)
+	{
+		fprintf(stderr, "error: claiming interface #%d failed\n", MY_INTF);
+		usb_close(dev_handle);
+		dev_handle = NULL;
+		return -E_BB_USB_GENERIC_FAILURE;
 	}
+	else
+	{
+		DEBUG(printf("success: claim_interface #%d\n", MY_INTF);)
+	}
+		
+	return BB_SUCCESS;
+}
 
-	if(dev_handle)
-		flushUsb();
+void LibusbTransport::close() {
+	if(dev_handle) {
+		/* do a write to avoid strange hangup (with libusb 0.1) */
+		char nothing = 0;
+		writeBulk(&nothing, 0, 10);
+
+		usb_release_interface(dev_handle, 0);
+		usb_close(dev_handle);
+		dev_handle=NULL;
+	}
+}
+
+int LibusbTransport::writeBulk(const char* data, int len,
+	unsigned int timeout_ms) {
+	int r = usb_bulk_write(dev_handle, ENDPOINT_DOWN, (char*) data, len,
+		timeout_ms);
+
+	if( r < 0 ) {
+		perror("USB bulk write");
+		DEBUG(printf("Write failed %d\n", r);)
+	}
+	return len;
+}
+
+int LibusbTransport::readBulk(char* data, int len, unsigned int timeout_ms) {
+	return usb_bulk_read(dev_handle, ENDPOINT_UP, data, len, timeout_ms);
+}
+
+#endif // !USBLIB1
+
+// Common to both libusb versions
+
+int BioBandIf::getBandSerialNumbers(list<string>& serial_numbers) {
+    if (NULL != usb_transport) {
+        fprintf(stderr, "Device already connected\n");
+        return -E_BB_BAND_ALREADY_CONNECTED;
+	}
+	
+	LibusbTransport usb(debug_flag);
+	return usb.getSerialNumbers(serial_numbers);
+}
+
+int BioBandIf::connectUsb(const char* aSerialNum) {
+    if (NULL != transport_ptr) {
+        fprintf(stderr, "Device already connected\n");
+        return -E_BB_BAND_ALREADY_CONNECTED;
+	}
+	forgetBandDetails();
+	
+	usb_transport = new LibusbTransport(debug_flag);
+	int retval = usb_transport->open(aSerialNum);
+	if (retval) {
+		closeUsb();
+		return retval;
+	}
+	transport_ptr = usb_transport;
+	flushUsb();
 		
 	return retval;
 }
@@ -569,20 +1200,11 @@ int BioBandIf::writeUsb(const int len) {
 	printf("\")\n");
 #endif
 
-	int r = usb_bulk_write(dev_handle, ENDPOINT_DOWN, writechars, len, 10);
-
-	if( r < 0 ) {
-		perror("USB bulk write");
-		DEBUG(printf("Write failed %d\n", r);)
-	}
-	return len;
+	return transport_ptr->writeBulk(writechars, len, 10);
 }
 
 int BioBandIf::readUsb() {
-	int retval;
-	
-	retval= usb_bulk_read(dev_handle, ENDPOINT_UP, readchars,
-		SIMPLE_TX_DATA_SIZE, read_timeout);
+	int retval = transport_ptr->readBulk(readchars, read_size, read_timeout);
 
 #if CMJ_USB_DEBUG
 	printf("BioBandIf::readUsb(\"");
@@ -605,34 +1227,66 @@ int BioBandIf::readUsb() {
 }
 
 void BioBandIf::flushUsb() {
-	char c;
 	int count=0;
 	
+	// full size reads, so whatever is left goes in a read or two
 	do {
-		count=usb_bulk_read(dev_handle, ENDPOINT_UP, &c, 1, 1);
+		count=transport_ptr->readBulk(readchars, max_stream_read, 1);
 		DEBUG(printf("flushUsb() %d\n",count);)
 	} while (count>0);
 }
 
 void BioBandIf::closeUsb() {
-	if(dev_handle) {
-		/* do a write to avoid strange hangup (with libusb 0.1) */
-		writeUsb(0);
+	transport_ptr = NULL;
+	if (usb_transport) {
+		delete usb_transport;
+		usb_transport = NULL;
+	}
+}
 
-		usb_release_interface(dev_handle, 0);
-		usb_close(dev_handle);
-		dev_handle=NULL;
+int BioBandIf::readReply(int kind,
+	chrono::steady_clock::time_point& last_reply) {
+	
+	// a read of the reply awaited, the latency of a reply is recorded against
+	// the request kind
+	chrono::steady_clock::time_point read_start = chrono::steady_clock::now();
+	int rdlen = readUsb();
+	if (rdlen > 0) {
+		double ms = msSince(read_start);
+		latency[kind].replies++;
+		latency[kind].total_ms += ms;
+		if (ms > latency[kind].max_ms)
+			latency[kind].max_ms = ms;
+		last_reply = chrono::steady_clock::now();
+	} else if (USB_READ_TIMED_OUT == rdlen) {
+		latency[kind].timeouts++;
 	}
+	return rdlen;
 }
 
-#endif // !USBLIB1
+bool BioBandIf::noResponse(int kind,
+	chrono::steady_clock::time_point last_reply) {
+	
+	// after an empty read, whether the band has now been silent for longer
+	// than the read timeout
+	if (msSince(last_reply) < read_timeout)
+		return false;
+	
+	fprintf(stderr,"No response from band (press reset on breakout board)\n");
+	// the band may only be slower than seen so far, the next attempt waits
+	// for the default timeout
+	latency[kind].replies = 0;
+	latency[kind].total_ms = 0;
+	latency[kind].max_ms = 0;
+	return true;
+}
 
 // -----------------------------------------------------------------------------
 
 // Protocol methods
 
 void BioBandIf::cleanup() {
-	if(dev_handle) {
+	if(transport_ptr) {
 		writechars[0] = RETURN_CHAR;
 		writechars[1] = 0;
 		writeUsb(2);
@@ -849,9 +1503,27 @@ int BioBandIf::instructTheTag(struct config_info* msg) {
 		if (msg && msg->max_samples) {
 			DEBUG(printf("Data present\n");)
 			page_num = 0;
-			writeSingleChar(READ_RAW_CHAR);
+			if (stream_raw) {
+				// full size packets, so read whole multiples of them
+				read_size = max_stream_read;
+			}
+			if (raw_first_page > 1) {
+				// first page to send big-endian & the download kind
+				writechars[0] = READ_RAW_FROM_CHAR;
+				writechars[1] = (raw_first_page >> 24) & 0xFF;
+				writechars[2] = (raw_first_page >> 16) & 0xFF;
+				writechars[3] = (raw_first_page >> 8) & 0xFF;
+				writechars[4] = raw_first_page & 0xFF;
+				writechars[5] = stream_raw ? 1 : 0;
+				writeUsb(6);
+			} else if (stream_raw) {
+				writeSingleChar(STREAM_RAW_CHAR);
+			} else {
+				writeSingleChar(READ_RAW_CHAR);
+			}
 			current_state = READ_RAW;
-			status_page_found = false;
+			// only the status page at the very start of the capture is real
+			raw_decode.status_page_found = (raw_first_page > 1);
 			wait_for_start = 1;
 			pg_count = 0;
 			page_idx = 0;
@@ -935,8 +1607,6 @@ int BioBandIf::instructTheTag(struct config_info* msg) {
 	case ERASE_FLASH_OP:
 		writeSingleChar(ERASE_FLASH_CHAR);
 		current_state = ERASE_FLASH;
-		// erase takes a long time, so extend the normal read timeout
-		read_timeout = 1000000;
 		//keep_going = 0;
 		break;
 		
@@ -1032,10 +1702,19 @@ int BioBandIf::instructTheTag(struct config_info* msg) {
 		break;
 		
 	case GET_IS_COMPLETE_OP:
+	case READ_SUMMARY_OP:
+		// the band returns to standby for config after the reply
 		writeSingleChar(GET_IS_COMPLETE_CHAR);
 		current_state = GET_IS_COMPLETE;
 		break;
 		
+	case GET_PROFILE_OP:
+		writechars[0] = GET_PROFILE_CHAR;
+		writechars[1] = profile_request;
+		writeUsb(2);
+		current_state = GET_PROFILE;
+		break;
+		
 	default:
 		fprintf(stderr,"Unknown user_op %d\n",user_op);
 		return -E_BB_GENERIC_FAILURE;
@@ -1058,7 +1737,8 @@ int BioBandIf::stateMachine(int rdlen) {
 			
 				if (!strncmp("CWA",readchars + loop,3)) {
 					DEBUG(printf("Link established %s\n",readchars);)
-					if (READ_CONFIG_ONLY == user_op)
+					if ((READ_CONFIG_ONLY == user_op) ||
+							(READ_SUMMARY_OP == user_op))
 						writechars[0] = SEND_FULL_META_CHAR;
 					else
 						writechars[0] = SEND_META_CHAR;
@@ -1097,9 +1777,11 @@ int BioBandIf::stateMachine(int rdlen) {
 						fprintf(stderr,"No config data?\n");
 					}
 				
-					if (READ_CONFIG_ONLY == user_op) {
+					if ((READ_CONFIG_ONLY == user_op) ||
+							(READ_SUMMARY_OP == user_op))
 						full_config_defined = 1;
-						
+					
+					if (READ_CONFIG_ONLY == user_op) {
 						// nothing more to do except put the tag back in wait
 						// for config mode
 						writechars[0] = RETURN_CHAR;
@@ -1232,7 +1914,6 @@ int BioBandIf::stateMachine(int rdlen) {
 #endif
 		
 	case READ_PAGE: {
-			uint16_t loop2;
 			int read_idx = 0;
 			
 			total_rec += rdlen;
@@ -1280,16 +1961,14 @@ int BioBandIf::stateMachine(int rdlen) {
 
 				if (page_idx < 341) {
 
-					for (loop2 = 0; loop2 < 6; loop2++) {
-						uint8_t v = (uint8_t) readchars[read_idx++];
-						if (current_page_ptr) {
-							*current_page_ptr = v;
-							current_page_ptr++;
-						}
-						uint8_t i = crc_hi ^ v;
-						crc_hi = crc_lo ^ table_crc_hi[i];
-						crc_lo = table_crc_lo[i];
+					if (current_page_ptr) {
+						memcpy(current_page_ptr, readchars + read_idx,
+							BYTES_PER_SAMPLE);
+						current_page_ptr += BYTES_PER_SAMPLE;
 					}
+					crc16Update(&crc_hi, &crc_lo,
+						(uint8_t*) readchars + read_idx, BYTES_PER_SAMPLE);
+					read_idx += BYTES_PER_SAMPLE;
 					data_count++;
 					page_idx++;
 				}
@@ -1304,6 +1983,8 @@ int BioBandIf::stateMachine(int rdlen) {
 						uint8_t low = (uint8_t) readchars[read_idx++];
 						uint8_t badblock = (uint8_t) readchars[read_idx++];
 						uint8_t status = (uint8_t) readchars[read_idx++];
+						// the overrun count isn't sent with the page
+						status &= ~OVERRUN_COUNT_MASK;
 						if (status != OK_USED_STATUS) {
 							fprintf(stderr,"Bad status: 0x%02x\n",status);
 							if (!(status & COLLECT_OK_MASK)) {
@@ -1335,8 +2016,8 @@ int BioBandIf::stateMachine(int rdlen) {
 						read_page_ptr = NULL;
 						return FINISHED;
 					}
-					crc_hi = 0xFF;
-					crc_lo = 0xFF;
+					crc_hi = CRC16_INITIAL_VALUE;
+					crc_lo = CRC16_INITIAL_VALUE;
 					page_idx = 0;
 					wait_for_start = 1;
 				}
@@ -1467,68 +2148,8 @@ int BioBandIf::stateMachine(int rdlen) {
 		} break;
 #endif
 
-	case READ_RAW: {
-			
-			total_rec += rdlen;
-			if (raw_fd && raw_fd != stdout) {
-				fwrite(readchars,1,rdlen,raw_fd);
-			}
-			if (buffer_idx + rdlen < max_transfer_page) {
-				memcpy(data_buffer + buffer_idx, readchars, rdlen);
-				
-				buffer_idx += rdlen;
-				checkRawStart();
-				
-			} else {
-				int diff1 = max_transfer_page - buffer_idx;
-				
-				if (diff1) {
-					memcpy(data_buffer + buffer_idx, readchars, diff1);
-#if 0
-					printf("diff1 %d\n",diff1);
-					char* ptr = data_buffer + buffer_idx;
-					if (raw_fd == stdout) {
-						printf("~~0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n",
-							(uint8_t) ptr[0],(uint8_t) ptr[1],
-							(uint8_t) ptr[2],(uint8_t) ptr[3],
-							(uint8_t) ptr[4],(uint8_t) ptr[5]);
-					}
-#endif
-				}
-				
-				processRawData();
-				if (sample_obs_ptr->evSamplesCallback()) {
-					// TODO - need to send a command to the band to stop it
-					// sending further data
-				}
-				
-				// copy left over to start of buffer
-				buffer_idx = 0;
-				int move_val = rdlen - diff1;
-				if (move_val) {
-					memcpy(data_buffer, readchars + diff1, move_val);
-					buffer_idx += move_val;
-#if 0
-					char* ptr = data_buffer;
-					if (raw_fd == stdout) {
-						printf("**");
-						for(int mlp = 0; mlp < move_val; mlp++) {
-							printf("0x%02x ", (uint8_t) ptr[mlp]);
-						}
-						printf("\n");
-					}
-#endif
-				}
-				
-				if (!strcmp(data_buffer,"Done")) {
-					
-					DEBUG(printf("\n%d pages\n",pg_count);)
-					DEBUG(printf("%d bytes processed\n", total_rec);)
-					sample_obs_ptr->evDoneCallback();
-					return FINISHED;
-				}
-			}
-		} break;
+	case READ_RAW:
+		return processRawChunk(readchars, rdlen);
 
 	case SET_CONFIG:
 		if(rdlen>0) {
@@ -1635,7 +2256,6 @@ int BioBandIf::stateMachine(int rdlen) {
 			DEBUG(printf("result <%s>\n",readchars);)
 			if (strcmp("OK",readchars))
 				return -E_BB_REQUEST_FAILED;
-			read_timeout = DEFAULT_READ_TIMEOUT;
 			return FINISHED;
 		}
 		break;
@@ -1669,10 +2289,28 @@ int BioBandIf::stateMachine(int rdlen) {
 		if(rdlen >= 1) {
 			is_complete = readchars[0];
 			DEBUG(printf("is_complete <0x%02x>\n",is_complete);)
+			if (READ_SUMMARY_OP == user_op)
+				summary_defined = 1;
 			return FINISHED;
 		}
 		break;
 		
+	case GET_PROFILE:
+		if (rdlen >= PROFILE_REPLY_SIZE) {
+			const uint8_t* ptr = (const uint8_t*) readchars;
+			decodeProfileStats(ptr, &profile_read);
+			ptr += PROFILE_STATS_SIZE;
+			profile_clock_hz = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) |
+				ptr[3];
+			DEBUG(printf("profile %u count %u\n",profile_request,
+				profile_read.count);)
+			return FINISHED;
+		} else if (rdlen >= ERROR_MSG_LEN) {
+			DEBUG(printf("profile result <%s>\n",readchars);)
+			return -E_BB_REQUEST_FAILED;
+		}
+		break;
+		
 	default:
 		fprintf(stderr,"Unknown state %d rec <%s>\n",current_state,readchars);
 		break;
@@ -1686,20 +2324,36 @@ int BioBandIf::enterEventLoop(op_state op) {
     int ret = 0;
 	int rdlen;
     int num_reads = 0;
-    int num_nothing = 0;
+	chrono::steady_clock::time_point last_reply;
     
-	if (!dev_handle) {
+	if (!transport_ptr) {
 		fprintf(stderr,"Not connected to the device\n");
 		return -E_BB_BAND_NOT_CONNECTED;
 	}
 
 	user_op = op;
+	
+	switch (op) {
+		case SET_ID_OP:
+		case ERASE_FLASH_OP:
+		case COLLECT_OP:
+		case NO_BKP_OP:
+		case SET_ACCEL_CONFIG_OP:
+		case SET_CALIB_DATA_OP:
+		case SET_FIRST_DOWNLD_OP:
+			// the band is being modified, so what was read from it is stale
+			forgetBandDetails();
+			break;
+		default:
+			break;
+	}
     
     DEBUG(printf("Establishing link with Bioband (op %d)\n",op);)
 
 	writechars[0] = 'g';
 	writechars[1] = 0;
 	writeUsb(2);
+	last_reply = chrono::steady_clock::now();
 	
 	keep_going = 1;
 	
@@ -1708,9 +2362,13 @@ int BioBandIf::enterEventLoop(op_state op) {
 	// on different hardware configurations, need consistent approach.
 	
 	while (keep_going) {
+		
+		// the timeout for the reply awaited
+		int kind = (ESTABLISH_LINK == current_state) ? link_latency : op;
+		read_timeout = readTimeoutFor(kind);
    
-		rdlen = readUsb();
-		if (rdlen < 0) {
+		rdlen = readReply(kind, last_reply);
+		if ((rdlen < 0) && (USB_READ_TIMED_OUT != rdlen)) {
 			/* special case: if we're in state START */
 			/* we're expecting the Band to disappear, so allow the error
 			 * through */
@@ -1738,41 +2396,138 @@ int BioBandIf::enterEventLoop(op_state op) {
 		if (rdlen>0) {
 			
 			readchars[rdlen] = '\0';
-			num_nothing = 0;
 			ret = stateMachine(rdlen);
 			if (ret) {
 				break;
 			}
+#ifdef USBLIB1
+			if (async_transfers && current_state == READ_RAW) {
+				// the page data is read through queued transfers
+				ret = (transport_ptr == usb_transport) ? asyncRawLoop() :
+					asyncTransportLoop(kind);
+				break;
+			}
+#endif
 			if (current_state==START || current_state==BATTERY_BURN_MODE) {
 				break;
 			}
-		} else if (!rdlen) {
-			num_nothing++;
-			if (num_nothing > 500) {
+		} else if (!rdlen || (USB_READ_TIMED_OUT == rdlen)) {
+			if (noResponse(kind, last_reply)) {
 				ret = -E_BB_NO_RESPONSE_FROM_BAND;
 				DEBUG(printf("current_state %d\n",current_state);)
-				fprintf(stderr,
-					"No response from band (press reset on breakout board)\n");
 				break;
 			}
 		}
     	//printf("read <%s>(%d)\n",readchars,rdlen);
 	   
 	}
+	// FINISHED and the state machine's codes end the loop quietly, only a
+	// band which stopped replying is reported
+	bool no_response = (-E_BB_NO_RESPONSE_FROM_BAND == ret);
 	if (ret > 0)
 		ret = 0;
 	
 	flushUsb();
 	
 	current_state = ESTABLISH_LINK;
+	read_size = SIMPLE_TX_DATA_SIZE;
 
-    return ret;
+    return no_response ? -E_BB_NO_RESPONSE_FROM_BAND : ret;
 }
 
 // ----
 
-void BioBandIf::checkRawStart() {
-	if (wait_for_start && buffer_idx >= PAGE_LEADER) {
+int BioBandIf::processRawChunk(const char* chunk, int len) {
+	
+	// position in the raw file of the start of the chunk
+	uint64_t stream_pos = raw_base_offset + total_rec;
+	total_rec += len;
+	if (raw_fd && raw_fd != stdout) {
+		fwrite(chunk,1,len,raw_fd);
+	}
+	
+	while (len > 0) {
+		if (!buffer_idx && (len >= 4) && !strncmp(chunk,"Done",4)) {
+			
+			DEBUG(printf("\n%d pages\n",pg_count);)
+			DEBUG(printf("%d bytes processed\n", total_rec);)
+#ifdef USBLIB1
+			if (raw_queue) {
+				raw_page_item* item = raw_queue->waitClaim();
+				item->kind = RAW_DONE_ITEM;
+				raw_queue->publish();
+				return FINISHED;
+			}
+#endif
+			if (decode_pool)
+				decode_pool->deliver(true);
+			sample_obs_ptr->evDoneCallback();
+			return FINISHED;
+		}
+		
+		if (!buffer_idx && (len >= max_transfer_page)) {
+			// a whole page in the chunk, decode it where it is
+			checkRawStart(chunk, max_transfer_page);
+			if (raw_index_ptr && !wait_for_start)
+				raw_index_ptr->addPage(stream_pos, chunk);
+			dispatchRawPage(chunk);
+			chunk += max_transfer_page;
+			len -= max_transfer_page;
+			stream_pos += max_transfer_page;
+			continue;
+		}
+		
+		// the chunk may complete the current page and start the next
+		int copy_len = max_transfer_page - buffer_idx;
+		if (copy_len > len)
+			copy_len = len;
+		memcpy(data_buffer + buffer_idx, chunk, copy_len);
+		buffer_idx += copy_len;
+		chunk += copy_len;
+		len -= copy_len;
+		stream_pos += copy_len;
+		
+		checkRawStart(data_buffer, buffer_idx);
+		if (buffer_idx == max_transfer_page) {
+			if (raw_index_ptr && !wait_for_start) {
+				raw_index_ptr->addPage(stream_pos - max_transfer_page,
+					data_buffer);
+			}
+			dispatchRawPage(data_buffer);
+			buffer_idx = 0;
+		}
+	}
+	return 0;
+}
+
+void BioBandIf::dispatchRawPage(const char* page_ptr) {
+#ifdef USBLIB1
+	if (raw_queue) {
+		raw_page_item* item = raw_queue->waitClaim();
+		item->kind = RAW_PAGE_ITEM;
+		item->start_found = !wait_for_start;
+		item->page_num = page_num;
+		memcpy(item->data, page_ptr, max_transfer_page);
+		raw_queue->publish();
+		wait_for_start = 1;
+		return;
+	}
+#endif
+	if (decode_pool) {
+		decode_pool->submit(page_ptr, page_num, !wait_for_start);
+		wait_for_start = 1;
+		decode_pool->deliver(false);
+		return;
+	}
+	processRawData(page_ptr);
+	if (sample_obs_ptr->evSamplesCallback()) {
+		// TODO - need to send a command to the band to stop it
+		// sending further data
+	}
+}
+
+void BioBandIf::checkRawStart(const char* page_ptr, int avail) {
+	if (wait_for_start && avail >= PAGE_LEADER) {
 		
 		int read_idx = 0;
 		uint8_t zero_count = 0;
@@ -1781,8 +2536,8 @@ void BioBandIf::checkRawStart() {
 		
 		// simplistic start of page checking, we expect 00pp00
 		//  (where p = page number)
-		while (read_idx < buffer_idx) {
-			uint8_t val = (uint8_t) data_buffer[read_idx++];
+		while (read_idx < avail) {
+			uint8_t val = (uint8_t) page_ptr[read_idx++];
 			if ((zero_count == 2) && (byte_count < 4)) {
 				page_num <<= 8;
 				page_num &= 0xff00;
@@ -1809,324 +2564,382 @@ void BioBandIf::checkRawStart() {
 	}
 }
 
-void BioBandIf::processRawData() {
-	int read_idx = 0;
-	
+void BioBandIf::processRawData(const char* page_ptr) {
 	if (wait_for_start) {
 		printf("Ignoring data\n");
 	} else {
-		bool validate_page = false;
-		uint8_t badblock = (uint8_t)
-			data_buffer[BAD_BLOCK_ADDR + PAGE_LEADER];
-		uint8_t status = (uint8_t)
-			data_buffer[PAGE_STATUS_ADDR + PAGE_LEADER];
-		sample_obs_ptr->status_raw = status;
-		if (status != OK_USED_STATUS) {
-			DEBUG(printf("Page: %d Status: 0x%02x\n",page_num,status);)
-			if (!(status & COLLECT_OK_MASK)) {
-				if (status & PAGE_OK_MASK) {
-					DEBUG(printf("Potential data loss before this page\n");)
-					validate_page = true;
-				} else {
-					DEBUG(printf("Partial page\n");)
-					DEBUG(printf(
-						"Definate data loss part way through this page\n");)
-						
-					read_idx = PAGE_LEADER;
-					page_idx = 0;
-					while (page_idx < 341) {
-						uint8_t ff_count = 0;
-						char* ptr = data_buffer + read_idx;
-						for (int loop2 = 0; loop2 < 6; loop2++) {
-							if ((uint8_t) ptr[loop2] == 0xff)
-								ff_count++;
-						}
-						if (ff_count == 6)
-							break;
-							
-						sample_obs_ptr->addRawSample(
-							(uint8_t*) data_buffer + read_idx);
+		decodeRawPage(page_ptr, page_num, sample_obs_ptr, raw_decode);
+	}
+
+	wait_for_start = 1;
+}
+
+void BioBandIf::decodeRawPage(const char* page_buffer, uint16_t page_number,
+	MDataObserver* obs, decode_state& state) {
+	
+	page_check check;
+	checkRawPage(page_buffer, page_number, check);
+	deliverRawPage(page_buffer, page_number, check, obs, state);
+}
+
+void BioBandIf::checkRawPage(const char* page_buffer, uint16_t page_number,
+	page_check& check) {
+	
+	int read_idx = 0;
+	int page_idx = 0;
+	int page_samples = SAMPLES_PER_PAGE;
+	uint8_t crc_hi, crc_lo;
+	const uint8_t* sample_ptr = (const uint8_t*) page_buffer + PAGE_LEADER;
+	
+	check.num_samples = 0;
+	check.sample_count = 0;
+	check.crc_checked = false;
+	check.crc_ok = false;
+	check.overruns = 0;
+	
+	bool validate_page = false;
+	uint8_t badblock = (uint8_t)
+		page_buffer[BAD_BLOCK_ADDR + PAGE_LEADER];
+	uint8_t status = (uint8_t)
+		page_buffer[PAGE_STATUS_ADDR + PAGE_LEADER];
+	if ((status != UNUSED_PAGE) && (status & OVERRUN_COUNT_MASK)) {
+		const uint8_t* count_ptr = (const uint8_t*) page_buffer +
+			OVERRUN_COUNT_ADDR + PAGE_LEADER;
+		status &= ~OVERRUN_COUNT_MASK;
+		check.overruns = count_ptr[0] | (count_ptr[1] << 8);
+	}
+	check.compressed = (status != UNUSED_PAGE) && (status & COMPRESSED_MASK);
+	if (check.compressed) {
+		status &= ~COMPRESSED_MASK;
+		page_samples = unpackPage((const uint8_t*) page_buffer + PAGE_LEADER,
+			check.unpacked, MAX_SAMPLES_PER_PAGE);
+		if (page_samples < 0) {
+			fprintf(stderr," Failed to unpack compressed page %d\n",
+				page_number);
+			page_samples = 0;
+		}
+		sample_ptr = check.unpacked;
+	}
+	check.status = status;
+	if (status != OK_USED_STATUS) {
+		DEBUG(printf("Page: %d Status: 0x%02x\n",page_number,status);)
+		if (!(status & COLLECT_OK_MASK)) {
+			if (status & PAGE_OK_MASK) {
+				DEBUG(printf("Potential data loss before this page\n");)
+				validate_page = true;
+			} else {
+				DEBUG(printf("Partial page\n");)
+				DEBUG(printf(
+					"Definate data loss part way through this page\n");)
 					
-						if (raw_fd == stdout) {
-							printf("%02d 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n",
-								data_count,
-								(uint8_t) ptr[0],(uint8_t) ptr[1],
-								(uint8_t) ptr[2],(uint8_t) ptr[3],
-								(uint8_t) ptr[4],(uint8_t) ptr[5]);
-						}
-										
-						data_count++;
-						page_idx++;
-						read_idx += BYTES_PER_SAMPLE;
+				// the stored samples end at the first erased one
+				read_idx = 0;
+				page_idx = 0;
+				while (page_idx < page_samples) {
+					uint8_t ff_count = 0;
+					const uint8_t* ptr = sample_ptr + read_idx;
+					for (int loop2 = 0; loop2 < 6; loop2++) {
+						if (ptr[loop2] == 0xff)
+							ff_count++;
 					}
-					int missing = 341 - page_idx;
-					DEBUG(printf("Missing %d samples\n", missing);)
-					data_count += missing;	
-
+					if (ff_count == 6)
+						break;
+					page_idx++;
+					read_idx += BYTES_PER_SAMPLE;
 				}
-			} else {
-				fprintf(stderr,"Programming error\n");
+				check.num_samples = page_idx;
+				DEBUG(printf("Missing %d samples\n", page_samples - page_idx);)
+				// the missing samples are still counted
+				check.sample_count = page_samples;
 			}
-		} else if (badblock != VALID_BLOCK_INDICATOR) {
-			fprintf(stderr,"Bad block!\n");
 		} else {
-			validate_page = true;
+			fprintf(stderr,"Programming error\n");
 		}
-		if (validate_page) {
-			// check CRC
-			read_idx = PAGE_LEADER;
-			page_idx = 0;
-			crc_hi = 0xFF;
-			crc_lo = 0xFF;
-			while (page_idx < 341) {
-
-				char* ptr = data_buffer + read_idx;
-				if (raw_fd == stdout) {
-					printf("%02d 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n",
-						data_count,
-						(uint8_t) ptr[0],(uint8_t) ptr[1],
-						(uint8_t) ptr[2],(uint8_t) ptr[3],
-						(uint8_t) ptr[4],(uint8_t) ptr[5]);
-				}
-								
-				sample_obs_ptr->addRawSample((uint8_t*) data_buffer + read_idx);
-				
-				for (int loop2 = 0; loop2 < 3; loop2++) {
-					for (int loop3 = 0; loop3 < 2; loop3++) {
-					
-						uint8_t v1 = (uint8_t) data_buffer[read_idx++];							
-						uint8_t cv = crc_hi ^ v1;
-						crc_hi = crc_lo ^ table_crc_hi[cv];
-						crc_lo = table_crc_lo[cv];
-					}
-				}
-				data_count++;
-				page_idx++;
+	} else if (badblock != VALID_BLOCK_INDICATOR) {
+		fprintf(stderr,"Bad block!\n");
+	} else {
+		validate_page = true;
+	}
+	if (validate_page) {
+		// check CRC (for compressed pages this covers the packed data)
+		crc_hi = CRC16_INITIAL_VALUE;
+		crc_lo = CRC16_INITIAL_VALUE;
+		crc16Update(&crc_hi, &crc_lo, (uint8_t*) page_buffer + PAGE_LEADER,
+			SAMPLES_PER_PAGE * BYTES_PER_SAMPLE);
+		check.num_samples = page_samples;
+		check.sample_count = page_samples;
+
+		// process checksum
+		read_idx = PAGE_LEADER + SAMPLES_PER_PAGE * BYTES_PER_SAMPLE;
+		uint8_t high = (uint8_t) page_buffer[read_idx++];
+		uint8_t low = (uint8_t) page_buffer[read_idx++];
+		check.crc_checked = true;
+		check.crc_ok = (crc_hi == high) && (crc_lo == low);
+		if (!check.crc_ok) {
+			fprintf(stderr,
+				" CRC ERROR [0x%02x 0x%02x, 0x%02x 0x%02x]"
+				" pg %d\n", crc_hi,crc_lo,high,low,page_number);
+		}
+	}
+}
+		
+void BioBandIf::deliverRawPage(const char* page_buffer, uint16_t page_number,
+	const page_check& check, MDataObserver* obs, decode_state& state) {
+	
+	const uint8_t* sample_ptr = check.compressed ? check.unpacked :
+		(const uint8_t*) page_buffer + PAGE_LEADER;
+	
+	obs->overruns = check.overruns;
+	obs->compressed = check.compressed;
+	obs->status_raw = check.status;
+	if (check.crc_checked)
+		obs->crc_ok = check.crc_ok;
+	if (raw_fd == stdout) {
+		for (int idx = 0; idx < check.num_samples; idx++) {
+			const uint8_t* ptr = sample_ptr + idx * BYTES_PER_SAMPLE;
+			printf("%02d 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n",
+				state.data_count + idx,
+				ptr[0],ptr[1],ptr[2],ptr[3],ptr[4],ptr[5]);
+		}
+		if (check.crc_checked && check.crc_ok)
+			printf("CRC Ok\n");
+	}
+	state.data_count += check.sample_count;
+	
+	{
+		// Here be dragons .. currently a maintenance issue
+		
+		// TODO This needs to be a tied to a file that is shared with the
+		// Bioband, so both storing and retrieval code can be easily altered
+		// in one place
+		
+		// It would be good if the future design could be abstracted from
+		// the concept of pages as the underlying hardware is likely to
+		// change with the eventual obsolescence of the current flash chips
+		
+		uint8_t* byte_ptr = (uint8_t*)
+			&page_buffer[CURRENT_TICK_ADDR + PAGE_LEADER];
+		
+		uint32_t* ct_ptr = (uint32_t*) byte_ptr;
+		obs->current_tick = (uint32_t) *ct_ptr;
+		if (raw_fd == stdout)
+			printf("current_tick 0x%08x\n",*ct_ptr);
+		byte_ptr += BIOBAND_TICK_SIZE;
+		
+		uint16_t* tl_ptr = (uint16_t*) byte_ptr;
+		obs->temperature_raw = *tl_ptr;
+		if (raw_fd == stdout) {
+			double tl_fl = convTempBinToCelsius(*tl_ptr);
+			printf("tl 0x%04x (%.02fC)\n",*tl_ptr,tl_fl);
+		}
+		byte_ptr += TEMP_LEVEL_SIZE;
+		
+		if (!page_number) {
+			
+			obs->additional_present = true;
+			
+			uint16_t* bl_ptr = (uint16_t*) byte_ptr;
+			obs->battery_raw = *bl_ptr;
+			if (raw_fd == stdout) {
+				double bl_fl = convADCToVoltage(*bl_ptr);
+				printf("bl 0x%04x (%.02fV)\n",*bl_ptr,bl_fl);
 			}
-
-			// process checksum
-			uint8_t high = (uint8_t) data_buffer[read_idx++];
-			uint8_t low = (uint8_t) data_buffer[read_idx++];
-			if ((crc_hi == high)&&(crc_lo == low)) {
-				sample_obs_ptr->crc_ok = true;
+			byte_ptr += BATTERY_LEVEL_SIZE;
+		
+			if (*byte_ptr) {
+				obs->band_id = (char*) byte_ptr;
 				if (raw_fd == stdout)
-					printf("CRC Ok\n");
+					printf("band <%s>\n",byte_ptr);
 			} else {
-				sample_obs_ptr->crc_ok = false;
-				fprintf(stderr,
-					" CRC ERROR [0x%02x 0x%02x, 0x%02x 0x%02x]"
-					" pg %d\n", crc_hi,crc_lo,high,low,page_num);
+				if (raw_fd == stdout)
+					printf("no band id!\n");
 			}
+			byte_ptr += MAX_ID_LEN;
 			
-		}
-		
-		{
-			// Here be dragons .. currently a maintenance issue
+			if (*byte_ptr) {
+				obs->subject_id = (char*) byte_ptr;
+				if (raw_fd == stdout)
+					printf("sj <%s>\n",byte_ptr);
+			} else {
+				if (raw_fd == stdout)
+					printf("no sj id!\n");
+			}
+			byte_ptr += MAX_ID_LEN;
 			
-			// TODO This needs to be a tied to a file that is shared with the
-			// Bioband, so both storing and retrieval code can be easily altered
-			// in one place
+			if (*byte_ptr) {
+				obs->test_id = (char*) byte_ptr;
+				if (raw_fd == stdout)
+					printf("test <%s>\n",byte_ptr);
+			} else {
+				if (raw_fd == stdout)
+					printf("no test id!\n");
+			}
+			byte_ptr += MAX_ID_LEN;
 			
-			// It would be good if the future design could be abstracted from
-			// the concept of pages as the underlying hardware is likely to
-			// change with the eventual obsolescence of the current flash chips
+			if (*byte_ptr) {
+				obs->centre_id = (char*) byte_ptr;
+				if (raw_fd == stdout)
+					printf("centre <%s>\n",byte_ptr);
+			} else {
+				if (raw_fd == stdout)
+					printf("no centre id!\n");
+			}
+			byte_ptr += MAX_CENTRE_ID_LEN;
 			
-			uint8_t* byte_ptr = (uint8_t*)
-				&data_buffer[CURRENT_TICK_ADDR + PAGE_LEADER];
+			for (int loop = 0; loop < MAX_CALIBRATION_DATA_LEN; loop++)
+				obs->calibration_data[loop] = *byte_ptr++;
 			
-			uint32_t* ct_ptr = (uint32_t*) byte_ptr;
-			sample_obs_ptr->current_tick = (uint32_t) *ct_ptr;
+			uint32_t* sm_ptr = (uint32_t*) byte_ptr;
+			obs->req_total_num_samples = *sm_ptr;
+			// reduce by one
+			obs->req_total_num_samples--;
+			if (raw_fd == stdout)
+				printf("mx samples 0x%08x\n",*sm_ptr);
+			byte_ptr += MAX_SAMPLES_SIZE;
+		
+			uint32_t* collect_start_ptr = (uint32_t*) byte_ptr;
+			obs->collect_start_time =
+				(time_t) *collect_start_ptr;
+			if (raw_fd == stdout)
+				printf("collect_start_time 0x%08x\n",*collect_start_ptr);
+			byte_ptr += EPOC_TIME_SIZE;
+		
+			obs->accel_conf_raw = *byte_ptr;
+			obs->g_divisor = convGScaleToDivisor(*byte_ptr);
 			if (raw_fd == stdout)
-				printf("current_tick 0x%08x\n",*ct_ptr);
-			byte_ptr += BIOBAND_TICK_SIZE;
+				printf("accel config 0x%02x\n",*byte_ptr);
+			byte_ptr += ACCEL_CONFIG_SIZE;
 			
-			uint16_t* tl_ptr = (uint16_t*) byte_ptr;
-			sample_obs_ptr->temperature_raw = *tl_ptr;
-			if (raw_fd == stdout) {
-				double tl_fl = convTempBinToCelsius(*tl_ptr);
-				printf("tl 0x%04x (%.02fC)\n",*tl_ptr,tl_fl);
-			}
-			byte_ptr += TEMP_LEVEL_SIZE;
+			obs->fw_hw_version_raw = *byte_ptr;
+			if (raw_fd == stdout)
+				printf("fw hw version 0x%02x\n",*byte_ptr);
+			byte_ptr += VERSION_SIZE;
 			
-			if (!page_num) {
+		} else if (1 == page_number) {
+			if (state.status_page_found) {
+				// the status page is only stored once on the Bioband - so
+				// ignore the unused bytes here from a later second page
+				byte_ptr += EPOC_TIME_SIZE + BIOBAND_TICK_SIZE +
+					MAX_SAMPLES_SIZE + EPOC_TIME_SIZE;
+			} else {
+			
+				obs->status_present = true;
+				state.status_page_found = true;
 				
-				sample_obs_ptr->additional_present = true;
+				// these fields may or may not be present (assume 0xFFs =
+				// not), likely due to loss of battery before data written
+				// or flash block corrupted (& the data is not duplicated
+				// like the first page info).
 				
-				uint16_t* bl_ptr = (uint16_t*) byte_ptr;
-				sample_obs_ptr->battery_raw = *bl_ptr;
-				if (raw_fd == stdout) {
-					double bl_fl = convADCToVoltage(*bl_ptr);
-					printf("bl 0x%04x (%.02fV)\n",*bl_ptr,bl_fl);
-				}
-				byte_ptr += BATTERY_LEVEL_SIZE;
-			
-				if (*byte_ptr) {
-					sample_obs_ptr->band_id = (char*) byte_ptr;
+				uint32_t* download_time_ptr = (uint32_t*) byte_ptr;
+				if (*byte_ptr == 0xFF) {
+					// assume the data has not yet been downloaded
 					if (raw_fd == stdout)
-						printf("band <%s>\n",byte_ptr);
+						printf("No download_time set\n");
 				} else {
+					obs->first_downloaded =
+						(time_t) *download_time_ptr;
 					if (raw_fd == stdout)
-						printf("no band id!\n");
+						printf("first download_time 0x%08x\n",
+							*download_time_ptr);
 				}
-				byte_ptr += MAX_ID_LEN;
-				
-				if (*byte_ptr) {
-					sample_obs_ptr->subject_id = (char*) byte_ptr;
+				byte_ptr += EPOC_TIME_SIZE;
+			
+				uint32_t* etick_ptr = (uint32_t*) byte_ptr;
+				if (*byte_ptr == 0xFF) {
+					// likely the battery failed before collect finished
 					if (raw_fd == stdout)
-						printf("sj <%s>\n",byte_ptr);
+						printf("No end_tick set\n");
 				} else {
+					obs->end_tick = (uint32_t) *etick_ptr;
 					if (raw_fd == stdout)
-						printf("no sj id!\n");
+						printf("end tick 0x%08x\n",*etick_ptr);
 				}
-				byte_ptr += MAX_ID_LEN;
-				
-				if (*byte_ptr) {
-					sample_obs_ptr->test_id = (char*) byte_ptr;
+				byte_ptr += BIOBAND_TICK_SIZE;
+		
+				uint32_t* num_samples_ptr = (uint32_t*) byte_ptr;
+				if (*byte_ptr == 0xFF) {
+					// likely the battery failed before collect finished
 					if (raw_fd == stdout)
-						printf("test <%s>\n",byte_ptr);
+						printf("No num_samples set\n");
 				} else {
+					obs->num_samples = (uint32_t)
+						*num_samples_ptr;
 					if (raw_fd == stdout)
-						printf("no test id!\n");
+						printf("num samples 0x%08x\n",*num_samples_ptr);
 				}
-				byte_ptr += MAX_ID_LEN;
-				
-				if (*byte_ptr) {
-					sample_obs_ptr->centre_id = (char*) byte_ptr;
+				byte_ptr += MAX_SAMPLES_SIZE;
+		
+				uint32_t* actioned_time_ptr = (uint32_t*) byte_ptr;
+				if (*byte_ptr == 0xFF) {
+					// presumably the first flash block must have been
+					// corrupted
 					if (raw_fd == stdout)
-						printf("centre <%s>\n",byte_ptr);
+						printf("No actioned time set\n");
 				} else {
+					obs->actioned_time = (time_t)
+						*actioned_time_ptr;
 					if (raw_fd == stdout)
-						printf("no centre id!\n");
+						printf("actioned_time 0x%08x\n",
+							*actioned_time_ptr);
 				}
-				byte_ptr += MAX_CENTRE_ID_LEN;
-				
-				for (int loop = 0; loop < MAX_CALIBRATION_DATA_LEN; loop++)
-					sample_obs_ptr->calibration_data[loop] = *byte_ptr++;
-				
-				uint32_t* sm_ptr = (uint32_t*) byte_ptr;
-				sample_obs_ptr->req_total_num_samples = *sm_ptr;
-				// reduce by one
-				sample_obs_ptr->req_total_num_samples--;
-				if (raw_fd == stdout)
-					printf("mx samples 0x%08x\n",*sm_ptr);
-				byte_ptr += MAX_SAMPLES_SIZE;
-			
-				uint32_t* collect_start_ptr = (uint32_t*) byte_ptr;
-				sample_obs_ptr->collect_start_time =
-					(time_t) *collect_start_ptr;
-				if (raw_fd == stdout)
-					printf("collect_start_time 0x%08x\n",*collect_start_ptr);
 				byte_ptr += EPOC_TIME_SIZE;
-			
-				sample_obs_ptr->accel_conf_raw = *byte_ptr;
-				if (raw_fd == stdout)
-					printf("accel config 0x%02x\n",*byte_ptr);
-				byte_ptr += ACCEL_CONFIG_SIZE;
-				
-				sample_obs_ptr->fw_hw_version_raw = *byte_ptr;
-				if (raw_fd == stdout)
-					printf("fw hw version 0x%02x\n",*byte_ptr);
-				byte_ptr += VERSION_SIZE;
-				
-			} else if (1 == page_num) {
-				if (status_page_found) {
-					// the status page is only stored once on the Bioband - so
-					// ignore the unused bytes here from a later second page
-					byte_ptr += EPOC_TIME_SIZE + BIOBAND_TICK_SIZE +
-						MAX_SAMPLES_SIZE + EPOC_TIME_SIZE;
-				} else {
-				
-					sample_obs_ptr->status_present = true;
-					status_page_found = true;
-					
-					// these fields may or may not be present (assume 0xFFs =
-					// not), likely due to loss of battery before data written
-					// or flash block corrupted (& the data is not duplicated
-					// like the first page info).
-					
-					uint32_t* download_time_ptr = (uint32_t*) byte_ptr;
-					if (*byte_ptr == 0xFF) {
-						// assume the data has not yet been downloaded
-						if (raw_fd == stdout)
-							printf("No download_time set\n");
-					} else {
-						sample_obs_ptr->first_downloaded =
-							(time_t) *download_time_ptr;
-						if (raw_fd == stdout)
-							printf("first download_time 0x%08x\n",
-								*download_time_ptr);
-					}
-					byte_ptr += EPOC_TIME_SIZE;
-				
-					uint32_t* etick_ptr = (uint32_t*) byte_ptr;
-					if (*byte_ptr == 0xFF) {
-						// likely the battery failed before collect finished
-						if (raw_fd == stdout)
-							printf("No end_tick set\n");
-					} else {
-						sample_obs_ptr->end_tick = (uint32_t) *etick_ptr;
-						if (raw_fd == stdout)
-							printf("end tick 0x%08x\n",*etick_ptr);
-					}
-					byte_ptr += BIOBAND_TICK_SIZE;
-			
-					uint32_t* num_samples_ptr = (uint32_t*) byte_ptr;
-					if (*byte_ptr == 0xFF) {
-						// likely the battery failed before collect finished
-						if (raw_fd == stdout)
-							printf("No num_samples set\n");
-					} else {
-						sample_obs_ptr->num_samples = (uint32_t)
-							*num_samples_ptr;
-						if (raw_fd == stdout)
-							printf("num samples 0x%08x\n",*num_samples_ptr);
-					}
-					byte_ptr += MAX_SAMPLES_SIZE;
-			
-					uint32_t* actioned_time_ptr = (uint32_t*) byte_ptr;
-					if (*byte_ptr == 0xFF) {
-						// presumably the first flash block must have been
-						// corrupted
-						if (raw_fd == stdout)
-							printf("No actioned time set\n");
-					} else {
-						sample_obs_ptr->actioned_time = (time_t)
-							*actioned_time_ptr;
-						if (raw_fd == stdout)
-							printf("actioned_time 0x%08x\n",
-								*actioned_time_ptr);
-					}
-					byte_ptr += EPOC_TIME_SIZE;
-				}
-			
 			}
+		
+		}
+		
+		if (*byte_ptr) {
+			uint8_t dbg_sz = *byte_ptr++;
 			
-			if (*byte_ptr) {
-				uint8_t dbg_sz = *byte_ptr++;
-				if (raw_fd == stdout)
-					printf("dbg %d: <",dbg_sz);
-				for(uint8_t lp = 0; lp < dbg_sz; lp++) {
-					uint8_t val = *byte_ptr++;
-					sample_obs_ptr->dbg_raw.push_back(val);
-					if (val > 0x1F && val < 0x7F) {
-						if (raw_fd == stdout)
-							printf("%c",val);
-					} else {
-						if (raw_fd == stdout) {
-							if (val)
-								printf("0x%02x ",val);
-							else
-								printf(" ");
-						}
+			// whatever the length says, the debug stops at the overrun count
+			// (or the end of the page for older firmware)
+			uint8_t status = (uint8_t)
+				page_buffer[PAGE_STATUS_ADDR + PAGE_LEADER];
+			const uint8_t* dbg_end = (const uint8_t*) page_buffer +
+				PAGE_LEADER + (((status != UNUSED_PAGE) &&
+				!(status & OVERRUN_COUNT_MASK)) ? FLASH_PAGE :
+				OVERRUN_COUNT_ADDR);
+			if (dbg_sz > dbg_end - byte_ptr)
+				dbg_sz = (uint8_t) (dbg_end - byte_ptr);
+			if (raw_fd == stdout)
+				printf("dbg %d: <",dbg_sz);
+			for(uint8_t lp = 0; lp < dbg_sz; lp++) {
+				uint8_t val = *byte_ptr++;
+				obs->dbg_raw.push_back(val);
+				if (val > 0x1F && val < 0x7F) {
+					if (raw_fd == stdout)
+						printf("%c",val);
+				} else {
+					if (raw_fd == stdout) {
+						if (val)
+							printf("0x%02x ",val);
+						else
+							printf(" ");
 					}
 				}
-				if (raw_fd == stdout)
-					printf(">\n");
 			}
+			if (raw_fd == stdout)
+				printf(">\n");
+		}
+	}
+	
+	MDataObserver::page_view view;
+	view.page_num = page_number;
+	view.page = (const uint8_t*) page_buffer + PAGE_LEADER;
+	view.spare = view.page + PAGE_SIZE;
+	view.sample_bytes = sample_ptr;
+	view.num_samples = check.num_samples;
+	view.crc_ok = obs->crc_ok;
+	view.status_raw = obs->status_raw;
+	view.compressed = obs->compressed;
+	view.current_tick = obs->current_tick;
+	view.temperature_raw = obs->temperature_raw;
+	if (!obs->evPageCallback(view)) {
+		for (int loop = 0; loop < check.num_samples; loop++) {
+			obs->addRawSample((uint8_t*) sample_ptr +
+				loop * BYTES_PER_SAMPLE);
 		}
 	}
-
-	wait_for_start = 1;
 }
 
 // -----------------------------------------------------------------------------
@@ -2134,7 +2947,7 @@ void BioBandIf::processRawData() {
 // Interface methods
 
 bool BioBandIf::isValid() {
-	return dev_handle;
+	return transport_ptr != NULL;
 }
 
 const string BioBandIf::errorToString(int aErrCode) {
@@ -2194,6 +3007,15 @@ const string BioBandIf::errorToString(int aErrCode) {
 			case -E_BB_MISSING_CALLBACK_PTR:
 				errStr = "Programming error - Missing callback pointer";
 				break;
+			case -E_BB_NOT_SUPPORTED:
+				errStr = "Not supported by this build or Bioband";
+				break;
+			case -E_BB_BAD_FILE_FORMAT:
+				errStr = "File is not in the expected format";
+				break;
+			case -E_BB_FILE_TOO_LARGE:
+				errStr = "File is too large";
+				break;
 			default:
 				// programming error
 				fprintf(stderr,"Unknown Bioband code (%d)\n",aErrCode);
@@ -2409,6 +3231,10 @@ int BioBandIf::readAllSamples(MDataObserver* aCallbackPtr) {
 #endif
 
 int BioBandIf::readRawFromBand(FILE* write_fd_ptr) {
+	return readRawFromBand(write_fd_ptr, 0);
+}
+
+int BioBandIf::readRawFromBand(FILE* write_fd_ptr, uint32_t pages_held) {
 	int retval;
 	raw_fd = NULL;
 	if (debug_flag)
@@ -2419,9 +3245,37 @@ int BioBandIf::readRawFromBand(FILE* write_fd_ptr) {
 	if (!sample_obs_ptr) {
 		return -E_BB_MISSING_CALLBACK_PTR;
 	}
-	DEBUG(printf("readRawFromBand\n");)
+	DEBUG(printf("readRawFromBand from page %u\n", pages_held + 1);)
+	if (pages_held) {
+		if (fw_ver < RESUME_MIN_FW) {
+			float hw, fw;
+			string fw_date;
+			getHwFwVersions(hw, fw, fw_date);
+			if (fw_ver < RESUME_MIN_FW)
+				return -E_BB_NOT_SUPPORTED;
+		}
+	} else if (raw_index_ptr) {
+		raw_index_ptr->clear();
+	}
+	stream_raw = 0;
+	if (stream_download) {
+		if (fw_ver < STREAM_MIN_FW) {
+			float hw, fw;
+			string fw_date;
+			getHwFwVersions(hw, fw, fw_date);
+		}
+		stream_raw = (fw_ver >= STREAM_MIN_FW);
+		DEBUG(printf("Streamed download %s\n", stream_raw ? "yes" : "no");)
+	}
+	raw_first_page = pages_held + 1;
+	raw_base_offset = (uint64_t) pages_held * max_transfer_page;
+	startDecodePool();
 	retval = enterEventLoop(READ_RAW_OP);
+	stopDecodePool();
+	raw_first_page = 1;
+	raw_base_offset = 0;
 	raw_fd = NULL;
+	raw_index_ptr = NULL;
 	
 	sample_obs_ptr = NULL;
 	
@@ -2448,7 +3302,8 @@ int BioBandIf::readRawFromFile(FILE* read_fd_ptr) {
 	buffer_idx = 0;
 	total_rec = 0;
 	collect_time = 0;
-	status_page_found = false;
+	raw_decode.status_page_found = false;
+	startDecodePool();
 	
 	while (!feof(read_fd_ptr)) {
 		buffer_idx = fread(data_buffer,1,max_transfer_page,read_fd_ptr);
@@ -2458,15 +3313,25 @@ int BioBandIf::readRawFromFile(FILE* read_fd_ptr) {
 			if (!strcmp(data_buffer,"Done")) {			
 				DEBUG(printf("\n%d pages\n",pg_count);)
 				DEBUG(printf("%d bytes processed\n", total_rec);)
+				if (decode_pool)
+					decode_pool->deliver(true);
 				sample_obs_ptr->evDoneCallback();
 				break;
 			}
 		}
-		checkRawStart();
-		processRawData();
+		checkRawStart(data_buffer, buffer_idx);
+		if (decode_pool) {
+			decode_pool->submit(data_buffer, page_num, !wait_for_start);
+			wait_for_start = 1;
+			if (decode_pool->deliver(false))
+				break;
+			continue;
+		}
+		processRawData(data_buffer);
 		if (sample_obs_ptr->evSamplesCallback())
 			break;
 	}
+	stopDecodePool();
 		
 	sample_obs_ptr = NULL;
 
@@ -2475,6 +3340,408 @@ int BioBandIf::readRawFromFile(FILE* read_fd_ptr) {
 	return retval;
 }
 
+// Read only view of a whole file
+class mappedFile {
+public:
+	mappedFile() : data(NULL), size(0)
+#ifdef _WIN32
+		, file_handle(INVALID_HANDLE_VALUE), map_handle(NULL)
+#endif
+	{}
+	~mappedFile() { close(); }
+	
+	int open(const char* aFilename);
+	void close();
+	
+	const char* data;
+	size_t size;
+	
+private:
+#ifdef _WIN32
+	HANDLE file_handle;
+	HANDLE map_handle;
+#endif
+};
+
+#ifdef _WIN32
+
+int mappedFile::open(const char* aFilename) {
+	file_handle = CreateFileA(aFilename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) {
+		close();
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	size = (size_t) file_size.QuadPart;
+	if (!size) {
+		return BB_SUCCESS;
+	}
+	map_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0,
+		NULL);
+	if (map_handle) {
+		data = (const char*) MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!data) {
+		close();
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	return BB_SUCCESS;
+}
+
+void mappedFile::close() {
+	if (data)
+		UnmapViewOfFile(data);
+	if (map_handle)
+		CloseHandle(map_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+	data = NULL;
+	size = 0;
+	map_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else // LINUX
+
+int mappedFile::open(const char* aFilename) {
+	int fd = ::open(aFilename, O_RDONLY);
+	if (fd < 0) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0) {
+		::close(fd);
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	size = (size_t) file_stat.st_size;
+	if (size) {
+		void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			size = 0;
+		} else {
+			data = (const char*) addr;
+			// the pages are walked front to back
+			madvise(addr, size, MADV_SEQUENTIAL);
+		}
+	}
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (size && !data) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	return BB_SUCCESS;
+}
+
+void mappedFile::close() {
+	if (data)
+		munmap((void*) data, size);
+	data = NULL;
+	size = 0;
+}
+
+#endif
+
+int BioBandIf::replayMappedRange(const char* first_page, size_t num_pages,
+	MDataObserver* obs, decode_state& state) {
+	
+	const char* page_ptr = first_page;
+	for (size_t idx = 0; idx < num_pages; idx++) {
+		const uint8_t* leader = (const uint8_t*) page_ptr;
+		
+		// expect 00pp00 (where p = page number), as checkRawStart
+		if (!leader[0] && !leader[1] && !leader[4] && !leader[5]) {
+			uint16_t page_number = (uint16_t) ((leader[2] << 8) | leader[3]);
+			decodeRawPage(page_ptr, page_number, obs, state);
+		} else {
+			fprintf(stderr," Ignoring data (page %d of the range)\n",
+				(int) idx);
+		}
+		if (obs->evSamplesCallback())
+			return FINISHED;
+		page_ptr += max_transfer_page;
+	}
+	return 0;
+}
+
+// The samples replayMappedRange would count for a range, from the leader and
+// status of each page as checkRawPage sees them, so that the next range can
+// carry on the count without decoding this one
+int BioBandIf::countMappedRange(const char* first_page, size_t num_pages) {
+	int total = 0;
+	const char* page_ptr = first_page;
+	for (size_t idx = 0; idx < num_pages; idx++, page_ptr += max_transfer_page) {
+		const uint8_t* leader = (const uint8_t*) page_ptr;
+		if (leader[0] || leader[1] || leader[4] || leader[5])
+			continue;
+		
+		const uint8_t* page = leader + PAGE_LEADER;
+		uint8_t status = page[PAGE_STATUS_ADDR];
+		if (UNUSED_PAGE == status)
+			continue;
+		status &= ~OVERRUN_COUNT_MASK;
+		int page_samples = SAMPLES_PER_PAGE;
+		if (status & COMPRESSED_MASK) {
+			status &= ~COMPRESSED_MASK;
+			page_samples = (page[PACKED_COUNT_ADDR] << 8) |
+				page[PACKED_COUNT_ADDR + 1];
+			if ((page_samples > MAX_SAMPLES_PER_PAGE) ||
+					((page_samples - 1) % PACK_GROUP_SAMPLES))
+				page_samples = 0;
+		}
+		if (status != OK_USED_STATUS) {
+			if (!(status & COLLECT_OK_MASK))
+				total += page_samples;
+		} else if (page[BAD_BLOCK_ADDR] == VALID_BLOCK_INDICATOR) {
+			total += page_samples;
+		}
+	}
+	return total;
+}
+
+int BioBandIf::readRawFromMappedFile(const char* aFilename) {
+	if (!sample_obs_ptr) {
+		return -E_BB_MISSING_CALLBACK_PTR;
+	}
+	vector<MDataObserver*> range_obs(1, sample_obs_ptr);
+	int retval = readRawFromMappedFile(aFilename, range_obs);
+	sample_obs_ptr = NULL;
+	return retval;
+}
+
+int BioBandIf::readRawFromMappedFile(const char* aFilename,
+	const vector<MDataObserver*>& range_obs) {
+	
+	if (!aFilename) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	if (range_obs.empty()) {
+		return -E_BB_MISSING_CALLBACK_PTR;
+	}
+	for (size_t idx = 0; idx < range_obs.size(); idx++) {
+		if (!range_obs[idx])
+			return -E_BB_MISSING_CALLBACK_PTR;
+	}
+	
+	mappedFile raw_file;
+	int retval = raw_file.open(aFilename);
+	if (retval) {
+		return retval;
+	}
+	if (raw_file.size > (size_t) INT_MAX) {
+		return -E_BB_FILE_TOO_LARGE;
+	}
+	
+	size_t num_pages = raw_file.size / max_transfer_page;
+	size_t tail = raw_file.size % max_transfer_page;
+	bool done_found = (tail >= 4) &&
+		!strncmp(raw_file.data + num_pages * max_transfer_page, "Done", 4);
+	DEBUG(printf("%d pages mapped\n",(int) num_pages);)
+	
+	size_t num_ranges = range_obs.size();
+	if (num_ranges > num_pages)
+		num_ranges = num_pages ? num_pages : 1;
+	
+	vector<decode_state> states(num_ranges);
+	vector<int> results(num_ranges, 0);
+	vector<thread> threads;
+	
+	// each range counts its samples, so the ranges after it can carry on
+	// the count from it, before it is decoded
+	vector<int> range_samples(num_ranges, -1);
+	mutex count_lock;
+	condition_variable counted;
+	
+	size_t first = 0;
+	for (size_t idx = 0; idx < num_ranges; idx++) {
+		size_t count = num_pages / num_ranges +
+			(idx < num_pages % num_ranges ? 1 : 0);
+		states[idx].data_count = 1;
+		// the status page is only held once, at the start of the capture,
+		// so a later range must not take a page 1 to be it
+		states[idx].status_page_found = (idx != 0);
+		const char* first_page = raw_file.data + first * max_transfer_page;
+		if (num_ranges == 1) {
+			results[idx] = replayMappedRange(first_page, count,
+				range_obs[idx], states[idx]);
+		} else {
+			threads.push_back(thread([=, &states, &results, &range_samples,
+					&count_lock, &counted] {
+				int samples = (idx + 1 < num_ranges) ?
+					countMappedRange(first_page, count) : 0;
+				{
+					unique_lock<mutex> guard(count_lock);
+					range_samples[idx] = samples;
+					counted.notify_all();
+					for (size_t prev = 0; prev < idx; prev++) {
+						while (range_samples[prev] < 0)
+							counted.wait(guard);
+						states[idx].data_count += range_samples[prev];
+					}
+				}
+				results[idx] = replayMappedRange(first_page, count,
+					range_obs[idx], states[idx]);
+			}));
+		}
+		first += count;
+	}
+	for (size_t idx = 0; idx < threads.size(); idx++) {
+		threads[idx].join();
+	}
+	
+	for (size_t idx = 0; idx < num_ranges; idx++) {
+		// a stopped range has not been completed
+		bool complete = !results[idx] &&
+			(idx + 1 < num_ranges || done_found);
+		if (complete)
+			range_obs[idx]->evDoneCallback();
+	}
+	
+	DEBUG(printf("\n%d pages\n",(int) num_pages);)
+	return (int) raw_file.size;
+}
+
+int BioBandIf::readRawWindow(const char* aFilename, const RawIndex& index,
+	time_t from_time, time_t to_time) {
+	
+	if (!aFilename) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	if (!sample_obs_ptr) {
+		return -E_BB_MISSING_CALLBACK_PTR;
+	}
+	MDataObserver* obs = sample_obs_ptr;
+	sample_obs_ptr = NULL;
+	
+	size_t first;
+	size_t count;
+	int retval = index.findWindow(from_time, to_time, first, count);
+	if (retval) {
+		return retval;
+	}
+	
+	mappedFile raw_file;
+	retval = raw_file.open(aFilename);
+	if (retval) {
+		return retval;
+	}
+	
+	decode_state state;
+	state.data_count = 1;
+	// only the status page at the very start of the capture is real
+	state.status_page_found = first > 1;
+	
+	int total = 0;
+	for (size_t idx = first; idx < first + count; idx++) {
+		const raw_index_entry& entry = index[idx];
+		if (entry.offset + max_transfer_page > raw_file.size) {
+			// index does not belong to this file
+			return -E_BB_BAD_FILE_FORMAT;
+		}
+		decodeRawPage(raw_file.data + entry.offset, entry.page_num, obs,
+			state);
+		total += max_transfer_page;
+		if (obs->evSamplesCallback())
+			return total;
+	}
+	obs->evDoneCallback();
+	return total;
+}
+
+int BioBandIf::setTransport(MBandTransport* aTransportPtr) {
+	if (usb_transport) {
+		return -E_BB_BAND_ALREADY_CONNECTED;
+	}
+	forgetBandDetails();
+	transport_ptr = aTransportPtr;
+	if (transport_ptr)
+		flushUsb();
+	return BB_SUCCESS;
+}
+
+int BioBandIf::setAsyncTransfers(int transfers_in_flight) {
+#ifdef USBLIB1
+	if ((transfers_in_flight < 0) ||
+			(transfers_in_flight > MAX_ASYNC_TRANSFERS)) {
+		return -E_BB_BAD_PARAM;
+	}
+	async_transfers = transfers_in_flight;
+	return BB_SUCCESS;
+#else
+	if (transfers_in_flight) {
+		DEBUG(printf("Async transfers need libusb 1.0\n");)
+		return -E_BB_NOT_SUPPORTED;
+	}
+	return BB_SUCCESS;
+#endif
+}
+
+int BioBandIf::setDecodeThreads(int num_threads) {
+	if ((num_threads < 0) || (num_threads > MAX_DECODE_THREADS)) {
+		return -E_BB_BAD_PARAM;
+	}
+	decode_threads = num_threads;
+	return BB_SUCCESS;
+}
+
+int BioBandIf::getUsbLatencyStats(vector<usb_latency_stats>& stats) {
+	// in op_state order, then the link request
+	static const char* latency_names[] = {
+		"collect", "read bad blocks", "read battery levels",
+		"read temperature levels", "set id", "get version", "get device time",
+		"erase flash", "set led", "read page", "read next page", "go to sleep",
+		"read config", "read raw", "wipe bkp", "read debug",
+		"set accel config", "read accel config", "read flash accel config",
+		"set calibration", "set first download", "get first download",
+		"get is complete", "get profile", "read summary", "link"
+	};
+	static_assert(sizeof(latency_names) / sizeof(latency_names[0]) ==
+		link_latency + 1, "latency_names must match op_state");
+	
+	// the link request first, then the operations used
+	stats.clear();
+	for (int loop = 0; loop <= link_latency; loop++) {
+		int kind = loop ? loop - 1 : link_latency;
+		if (!latency[kind].replies && !latency[kind].timeouts && loop)
+			continue;
+		usb_latency_stats entry;
+		entry.op = latency_names[kind];
+		fillLatencyStats(kind, entry);
+		stats.push_back(entry);
+	}
+	return BB_SUCCESS;
+}
+
+void BioBandIf::resetUsbLatencyStats() {
+	memset(latency,0,sizeof(latency));
+}
+
+void BioBandIf::fillLatencyStats(int kind, usb_latency_stats& stats) {
+	const latency_record& record = latency[kind];
+	stats.replies = record.replies;
+	stats.timeouts = record.timeouts;
+	stats.mean_ms = record.replies ? record.total_ms / record.replies : 0;
+	stats.max_ms = record.max_ms;
+	stats.read_timeout_ms = readTimeoutFor(kind);
+}
+
+unsigned int BioBandIf::readTimeoutFor(int kind) {
+	unsigned int timeout = (ERASE_FLASH_OP == kind) ? ERASE_READ_TIMEOUT :
+		DEFAULT_READ_TIMEOUT;
+	const latency_record& record = latency[kind];
+	if (record.replies >= LATENCY_MIN_REPLIES) {
+		double adaptive = record.max_ms * LATENCY_TIMEOUT_FACTOR;
+		if (adaptive < MIN_READ_TIMEOUT)
+			adaptive = MIN_READ_TIMEOUT;
+		if (adaptive < timeout)
+			timeout = (unsigned int) adaptive;
+	}
+	return timeout;
+}
+
 int BioBandIf::setRawDataCallbackPtr(MDataObserver* aCallbackPtr) {
 	int retval = BB_SUCCESS;
 	if (aCallbackPtr) {
@@ -2682,8 +3949,49 @@ int BioBandIf::getDebugBuffer(queue<uint8_t>* debug_buffer_ptr) {
 	return retval;
 }
 
-int BioBandIf::setAccelConfig(accel_data_rate dr, accel_g_scale gs) {
+int BioBandIf::getProfile(vector<profile_stats>& stats,
+	uint32_t& core_clock_hz, bool clear) {
+	
+	int retval = 0;
+	int path;
+	
+	stats.clear();
+	core_clock_hz = 0;
+	if (fw_ver < PROFILE_MIN_FW) {
+		float hw, fw;
+		string fw_date;
+		retval = getHwFwVersions(hw, fw, fw_date);
+		if (!retval && (fw_ver < PROFILE_MIN_FW))
+			retval = -E_BB_NOT_SUPPORTED;
+	}
+	for (path = 0; !retval && path < PROFILE_NUM_PATHS; path++) {
+		profile_request = (uint8_t) path;
+		if (clear)
+			profile_request |= PROFILE_CLEAR_FLAG;
+		retval = enterEventLoop(GET_PROFILE_OP);
+		if (!retval) {
+			stats.push_back(profile_read);
+			core_clock_hz = profile_clock_hz;
+		}
+	}
+	return retval;
+}
+
+int BioBandIf::setAccelConfig(accel_data_rate dr, accel_g_scale gs,
+	bool compress) {
+	if (compress && (fw_ver < COMPRESS_MIN_FW)) {
+		// older firmware would take the flag as part of the g scale
+		float hw, fw;
+		string fw_date;
+		int retval = getHwFwVersions(hw, fw, fw_date);
+		if (retval)
+			return retval;
+		if (fw_ver < COMPRESS_MIN_FW)
+			return -E_BB_NOT_SUPPORTED;
+	}
 	rate_and_g_scale = encodeRateAndGscale(dr, gs);
+	if (compress)
+		rate_and_g_scale |= ACCEL_COMPRESS_MASK;
 	return enterEventLoop(SET_ACCEL_CONFIG_OP);
 }
 
@@ -2763,6 +4071,35 @@ int BioBandIf::getIfCaptureExistsAndComplete(bool& exists, bool& complete) {
 	return retval;
 }
 
+int BioBandIf::getBandSummary(band_summary& summary) {
+	int retval = 0;
+	if (!summary_defined) {
+		is_complete = 0;
+		retval = enterEventLoop(READ_SUMMARY_OP);
+		if (retval)
+			return retval;
+	}
+	
+	// the getters now answer from the config read in the session
+	summary.band_id = getBandId();
+	summary.subject_id = getSubjectDetails();
+	summary.test_id = getTestDetails();
+	summary.centre_id = getCentreId();
+	summary.battery_level = getBatteryVoltage();
+	summary.stored_size = getStoredSize();
+	summary.page_count = getPageCount();
+	getSampleTimings(summary.actioned_time, summary.sample_start_time,
+		summary.sample_end_time);
+	summary.capture_exists = (NO_CAPTURE_TO_CHECK != is_complete);
+	summary.capture_complete = (COMPLETE_CAPTURE == is_complete);
+	return retval;
+}
+
+void BioBandIf::forgetBandDetails() {
+	full_config_defined = 0;
+	summary_defined = 0;
+}
+
 
 
 // EOF
@@ -62,6 +62,8 @@
 
 #ifdef USBLIB1
 #include <libusb-1.0/libusb.h>
+#include <atomic>
+#include "spsc_queue.h"
 #else
 #include <usb.h>
 #endif // USBLIB1
@@ -76,11 +78,25 @@
 #include <string>
 #include <queue>
 #include <list>
+#include <vector>
+#include <chrono>
 using namespace std;
 
 const int max_transfer_page = PAGE_LEADER + FLASH_PAGE;
 
-double convAccValueToGValue(uint8_t*& aSamplePtr);
+// bulk read size for streamed raw downloads, a multiple of STREAM_PACKET_SIZE
+const int max_stream_read = 16384;
+
+// raw accelerometer value for 1g at the +/-8g full scale
+const double default_g_divisor = 4096;
+
+double convAccValueToGValue(uint8_t*& aSamplePtr,
+	double divisor = default_g_divisor);
+double convGScaleToDivisor(uint8_t accel_conf_raw);
+int convAccSamplesToGValues(const uint8_t* raw_ptr, int num_samples,
+	double* g_vals, double divisor = default_g_divisor);
+int convAccSamplesToGValues(const uint8_t* raw_ptr, int num_samples,
+	float* g_vals, double divisor = default_g_divisor);
 double convADCToVoltage(uint16_t adc);
 double convTempBinToCelsius(uint16_t temp_bin_val);
 time_t convTicksToTime(time_t start_time, uint32_t number_ticks);
@@ -104,6 +120,9 @@ void convHwFwVerToBytes(uint8_t ver_raw, uint8_t& hwb, uint8_t& fwb);
 #define E_BB_NO_RESPONSE_FROM_BAND -1013
 #define E_BB_FAILED_TO_OPEN_FILE_FOR_READ -1014
 #define E_BB_MISSING_CALLBACK_PTR -1015
+#define E_BB_NOT_SUPPORTED -1016
+#define E_BB_BAD_FILE_FORMAT -1017
+#define E_BB_FILE_TOO_LARGE -1018
 
 
 #define BB_UNKNOWN_STR "Unknown"
@@ -113,7 +132,7 @@ void convHwFwVerToBytes(uint8_t ver_raw, uint8_t& hwb, uint8_t& fwb);
  */
 struct MDataObserver
 {
-	MDataObserver() { reset(); }
+	MDataObserver() : g_divisor(default_g_divisor) { reset(); }
 	
 	/**
 	 * Notifies the client of a new group of samples
@@ -131,13 +150,96 @@ struct MDataObserver
 	virtual void addRawSample(uint8_t* bytesPtr);
 	
 	struct sample {
-		void giveGValues(double& x, double& y, double& z);
+		void giveGValues(double& x, double& y, double& z,
+			double divisor = default_g_divisor) const;
 		uint8_t sample_raw[BYTES_PER_SAMPLE];
 	};
 	
-	bool crc_ok;	
-	list<sample> raw_sample_list;
+	/**
+	 * Read only view over the samples of the current page, allows the samples
+	 * to be iterated in order without being removed
+	 */
+	struct sample_span {
+		sample_span(const sample* aFirst, size_t aSize) :
+			first(aFirst), count(aSize) {}
+		const sample* begin() const { return first; }
+		const sample* end() const { return first + count; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		const sample& operator[](size_t idx) const { return first[idx]; }
+	private:
+		const sample* first;
+		size_t count;
+	};
+	
+	/**
+	 * The samples of the current page, only valid until the next reset()
+	 */
+	sample_span samples() const {
+		return sample_span(raw_samples, num_raw_samples);
+	}
+	
+	/**
+	 * Convert all the samples of the current page in one go using the full g
+	 * scale recorded in the band's accelerometer config
+	 * \param g_vals is populated with x,y,z values for each sample, so must
+	 * have room for samples().size() * 3 values
+	 * \return the number of values populated
+	 */
+	int giveGValues(double* g_vals) const;
+	int giveGValues(float* g_vals) const;
+	
+	/**
+	 * Read only view of a decoded page pointing straight into the buffer it
+	 * was received (or mapped) into, only valid during evPageCallback
+	 */
+	struct page_view {
+		uint16_t page_num;
+		// the page contents, FLASH_PAGE bytes of samples then the spare area
+		const uint8_t* page;
+		const uint8_t* spare;
+		// BYTES_PER_SAMPLE per sample, the unpacked samples for a compressed
+		// page, only as many as were stored for a partial page
+		const uint8_t* sample_bytes;
+		int num_samples;
+		// as the observer members of the same name
+		bool crc_ok;
+		uint8_t status_raw;
+		bool compressed;
+		uint32_t current_tick;
+		uint16_t temperature_raw;
+		
+		sample_span samples() const {
+			return sample_span((const sample*) sample_bytes, num_samples);
+		}
+	};
+	
+	/**
+	 * Zero copy alternative to samples(), invoked for each page before
+	 * evSamplesCallback once the spare area fields and the crc have been
+	 * decoded into the observer
+	 * \param page is the view of the page
+	 * \return true if the page has been consumed, the samples are then not
+	 * copied into the observer (samples() is empty in evSamplesCallback)
+	 */
+	virtual bool evPageCallback(const page_view& page) { return false; }
+	
+	// divisor to apply to the raw values, updated whenever the accel config
+	// is read and not cleared by reset()
+	double g_divisor;
+	
+	bool crc_ok;
+	// store sized for the largest (compressed) page reused for every page,
+	// see samples()
+	sample raw_samples[MAX_SAMPLES_PER_PAGE];
+	uint16_t num_raw_samples;
+	// page status with the COMPRESSED_MASK flag moved to compressed & the
+	// OVERRUN_COUNT_MASK flag to overruns
 	uint8_t status_raw;
+	bool compressed;
+	// samples the band dropped so far in the capture as its sample buffer was
+	// full, 0 if the firmware doesn't record them (before fw1.8)
+	uint16_t overruns;
 	uint32_t current_tick;
 	uint16_t temperature_raw;
 	list<uint8_t> dbg_raw;
@@ -165,6 +267,84 @@ struct MDataObserver
 	uint32_t actioned_time;
 };
 
+class RawIndex;
+
+/**
+ * Bulk transport to a band, BioBandIf talks to the band over libusb unless a
+ * transport is set with setTransport (e.g. BandEmulator, see band_emulator.h)
+ */
+struct MBandTransport
+{
+	virtual ~MBandTransport() {}
+	
+	/**
+	 * Write to the band's bulk out endpoint
+	 * \param data is the command to send
+	 * \param len is the length of the command
+	 * \param timeout_ms is the time to wait for the band to accept it
+	 * \return the number of bytes written otherwise < 0 if there is an error
+	 */
+	virtual int writeBulk(const char* data, int len,
+		unsigned int timeout_ms) = 0;
+	
+	/**
+	 * Read from the band's bulk in endpoint. As with a USB bulk transfer the
+	 * read completes on a short packet from the band or when len is reached.
+	 * \param data is the buffer to fill
+	 * \param len is the size of the buffer
+	 * \param timeout_ms is the time to wait for the band
+	 * \return the number of bytes read, 0 if nothing was received, otherwise
+	 * < 0 if there is an error
+	 */
+	virtual int readBulk(char* data, int len, unsigned int timeout_ms) = 0;
+};
+
+/**
+ * The libusb transport BioBandIf opens with connectUsb (libusb 1.0 when built
+ * with USBLIB1, otherwise libusb 0.1)
+ */
+class LibusbTransport : public MBandTransport
+{
+public:
+	LibusbTransport(int aDebugFlag);
+	virtual ~LibusbTransport();
+	
+	/**
+	 * Open a band and claim its interface
+	 * \param aSerialNum of band to open or NULL for the first one found
+	 * \return 0 indicates a successful open otherwise < 0 if there is an error
+	 */
+	int open(const char* aSerialNum);
+	
+	/**
+	 * Retrieve all the known bands connected to USB
+	 * \param serial_numbers is the list construct to be populated
+	 * \return the number of bands found otherwise < 0 if there is an error
+	 */
+	int getSerialNumbers(list<string>& serial_numbers);
+	
+	// MBandTransport
+	virtual int writeBulk(const char* data, int len, unsigned int timeout_ms);
+	virtual int readBulk(char* data, int len, unsigned int timeout_ms);
+	
+#ifdef USBLIB1
+	// for the queued transfers of the asynchronous raw download
+	libusb_device_handle* handle() { return dev_handle; }
+	libusb_context* context() { return ctx; }
+#endif
+	
+private:
+	void close();
+	
+	int debug_flag;
+#ifdef USBLIB1
+	libusb_device_handle *dev_handle;
+	libusb_context *ctx;
+#else
+	struct usb_dev_handle *dev_handle;
+#endif
+};
+
 class BioBandIf 
 { 
 public: 
@@ -194,6 +374,16 @@ public:
 	 * \return the number of bands found otherwise < 0 if there is an error
 	 */
 	int getBandSerialNumbers(list<string>& serial_numbers);
+	
+	/**
+	 * Talk to the band through a transport other than libusb, in place of
+	 * connectUsb. Asynchronous transfers (setAsyncTransfers) read from the
+	 * transport on the calling thread while the worker thread decodes.
+	 * \param aTransportPtr is the transport, NULL to disconnect from it. The
+	 * transport is not owned and must outlive its use.
+	 * \return 0 indicates successful setting, < 0 if there is an error
+	 */
+	int setTransport(MBandTransport* aTransportPtr);
 
 	/**
 	 * Returns the state of the connection
@@ -294,6 +484,35 @@ public:
 	 */
 	int getSampleTimings(time_t& actioned_time, time_t& sample_start_time,
 		time_t& sample_end_time);
+	
+	// the values of the individual getters, see getBandSummary
+	struct band_summary {
+		string band_id;
+		string subject_id;
+		string test_id;
+		string centre_id;
+		unsigned int battery_level;
+		int stored_size;
+		// as getPageCount, an upper bound for a compressed capture
+		int page_count;
+		time_t actioned_time;
+		time_t sample_start_time;
+		time_t sample_end_time;
+		// as getIfCaptureExistsAndComplete
+		bool capture_exists;
+		bool capture_complete;
+	};
+	
+	/**
+	 * Read all the band's meta data and whether its last capture completed
+	 * in a single session with the band, for inventory scans. The result is
+	 * kept until the band is modified through this object or reconnected,
+	 * and the individual getters (getBandId etc.) answer from it meanwhile.
+	 * Needs band firmware 1.2+.
+	 * \param summary is filled with the band's details
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int getBandSummary(band_summary& summary);
 
 	// ----
 	
@@ -301,6 +520,9 @@ public:
 	 * Retrieve the number of pages of measurement data stored
 	 * Note that the request can take a long time to complete due to the need
 	 * to sequentially check the stored pages to calculate the size.
+	 * The count is worked out from the samples stored, so for a compressed
+	 * capture (see setAccelConfig) it is the pages the samples would fill
+	 * uncompressed, an upper bound on the pages actually used.
 	 * 
 	 * \return the number of pages otherwise < 0 if there is an error
 	 */
@@ -350,6 +572,18 @@ public:
 	 */
 	int readRawFromBand(FILE* write_fd_ptr);
 	
+	/**
+	 * Read only the data not yet retrieved from the band, the band starts
+	 * after the pages already held so only the new pages are written to file
+	 * and passed to the callback (firmware 1.7 or later). A raw index set by
+	 * setRawIndex is not cleared, the new pages are added at the offsets they
+	 * have when the file is appended to the pages held.
+	 * \param write_fd_ptr is the optional file descriptor to write to
+	 * \param pages_held is the number of complete pages already retrieved
+	 * \return < 0 if there is an error otherwise total bytes received
+	 */
+	int readRawFromBand(FILE* write_fd_ptr, uint32_t pages_held);
+	
 	/**
 	 * Read the data from a previous extracted band raw file.
 	 * \param read_fd_ptr is the mandatory file descriptor to read from
@@ -357,6 +591,80 @@ public:
 	 */
 	int readRawFromFile(FILE* read_fd_ptr);
 	
+	/**
+	 * Read the data from a previous extracted band raw file by mapping the
+	 * file into memory and decoding each page in place (no copying through
+	 * the usb state machine). Uses the callback set by setRawDataCallbackPtr.
+	 * \param aFilename is the raw file to read
+	 * \return < 0 if there is an error (-E_BB_FILE_TOO_LARGE if the size
+	 * does not fit the result) otherwise total bytes processed
+	 */
+	int readRawFromMappedFile(const char* aFilename);
+	
+	/**
+	 * As above but the file is split into as many contiguous page ranges as
+	 * there are observers and the ranges are decoded in parallel, one thread
+	 * per range. Each observer sees its own range in order and gets
+	 * evDoneCallback when the range is complete.
+	 * \param aFilename is the raw file to read
+	 * \param range_obs is the observer for each range
+	 * \return < 0 if there is an error otherwise total bytes processed
+	 */
+	int readRawFromMappedFile(const char* aFilename,
+		const vector<MDataObserver*>& range_obs);
+	
+	/**
+	 * Set an index to be filled with the location and time of each page
+	 * written to file by the next readRawFromBand (save it as a sidecar to
+	 * the raw file to allow time windows to be extracted later)
+	 * \param index_ptr is the index to fill, NULL for none
+	 */
+	void setRawIndex(RawIndex* index_ptr) { raw_index_ptr = index_ptr; }
+	
+	/**
+	 * Read only the pages of a raw file which were stored in a time window,
+	 * using an index to seek straight to them. Uses the callback set by
+	 * setRawDataCallbackPtr. The resolution is one page.
+	 * \param aFilename is the raw file to read
+	 * \param index is the index of the raw file
+	 * \param from_time is the start of the window
+	 * \param to_time is the end of the window
+	 * \return < 0 if there is an error otherwise total bytes processed
+	 */
+	int readRawWindow(const char* aFilename, const RawIndex& index,
+		time_t from_time, time_t to_time);
+	
+	/**
+	 * Select asynchronous USB transfers for readRawFromBand (libusb-1.0 builds
+	 * only). Several bulk transfers are kept queued on the band endpoint while
+	 * the pages are decoded, and the callback invoked, on a worker thread.
+	 * \param transfers_in_flight is the number of transfers to keep queued, 0
+	 * returns to the default synchronous reads
+	 * \return 0 indicates successful setting, < 0 if there is an error
+	 */
+	int setAsyncTransfers(int transfers_in_flight);
+	
+	/**
+	 * Spread the decoding of raw pages (the crc check, unpacking and partial
+	 * page scan) over a pool of worker threads, for readRawFromBand and
+	 * readRawFromFile. The pages are still handed to the callback in the
+	 * order they were read, on the thread which would otherwise decode them.
+	 * The debug dump of the raw data is always decoded on that thread.
+	 * \param num_threads is the number of worker threads, 0 returns to the
+	 * default of decoding each page as it is read
+	 * \return 0 indicates successful setting, < 0 if there is an error
+	 */
+	int setDecodeThreads(int num_threads);
+	
+	/**
+	 * Select the streamed raw download for readRawFromBand. The band sends the
+	 * pages back to back in full size packets, double buffering the flash
+	 * reads, and they are read with large bulk reads. Bands with firmware
+	 * older than 1.4 fall back to the original download.
+	 * \param aEnable is non zero to stream, 0 for the original download
+	 */
+	void setStreamDownload(int aEnable) { stream_download = aEnable; }
+	
 	/**
 	 * Set the callback to be invoked for each sample from the raw file
 	 * \param aCallbackPtr is the callback pointer
@@ -459,9 +767,13 @@ public:
 	 * Set accelerometer data rate and full G scale
 	 * \param dr is the data rate
 	 * \param gs is the full G scale
-	 * \return 0 indicates successful completion, < 0 if there is an error
+	 * \param compress selects compressed pages for the next collection (fw
+	 * 1.5+), roughly doubling the samples held by each flash page
+	 * \return 0 indicates successful completion, -E_BB_NOT_SUPPORTED if
+	 * compress is set for older firmware, otherwise < 0 if there is an error
 	 */
-	int setAccelConfig(accel_data_rate dr, accel_g_scale gs);
+	int setAccelConfig(accel_data_rate dr, accel_g_scale gs,
+		bool compress = false);
 	
 	/**
 	 * Read the currently set accelerometer data rate and full G scale
@@ -604,6 +916,48 @@ public:
 	 */
 	int getDebugBuffer(queue<uint8_t>* debug_buffer_ptr);
 
+	/**
+	 * Diagnostics only. Request the band's cycle count profile of its hot
+	 * paths (accelerometer interrupt, page program, block erase & page read),
+	 * firmware 1.6 onwards.
+	 * \param stats is populated with PROFILE_NUM_PATHS entries, indexed by
+	 * profile_path
+	 * \param core_clock_hz is set to the band's current core clock
+	 * \param clear resets the band's stats once they have been read
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int getProfile(vector<profile_stats>& stats, uint32_t& core_clock_hz,
+		bool clear = false);
+	
+	// latency of the band's replies to one kind of request
+	struct usb_latency_stats {
+		// the operation, "link" for the link request
+		string op;
+		// replies received & reads which timed out
+		unsigned int replies;
+		unsigned int timeouts;
+		double mean_ms;
+		double max_ms;
+		// the read timeout now in use
+		unsigned int read_timeout_ms;
+	};
+	
+	/**
+	 * Diagnostics. Returns the latency of the band's replies seen by this
+	 * object, for the link request which starts every operation and for the
+	 * replies after it of each operation used. The read timeouts adapt to
+	 * these, so a band which stops replying is given up on well before the
+	 * default timeout.
+	 * \param stats is populated with an entry per kind of request
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int getUsbLatencyStats(vector<usb_latency_stats>& stats);
+	
+	/**
+	 * Forget the latencies seen, the read timeouts return to the defaults
+	 */
+	void resetUsbLatencyStats();
+
 	/**
 	 * Testing only. Sets up 5 days worth of dummy data on the band.
 	 * \return 0 indicates successful completion, < 0 if there is an error
@@ -621,14 +975,62 @@ private:
 	int readUsb();
 	void flushUsb();
 	void closeUsb();
+	int readReply(int kind, chrono::steady_clock::time_point& last_reply);
+	bool noResponse(int kind, chrono::steady_clock::time_point last_reply);
 
 	void writeSingleChar(char val);
 	
 	int instructTheTag(struct config_info* msg);
+	void forgetBandDetails();
 	int stateMachine(int rdlen);
 	
-	void checkRawStart();
-	void processRawData();
+	int processRawChunk(const char* chunk, int len);
+	void dispatchRawPage(const char* page_ptr);
+	void checkRawStart(const char* page_ptr, int avail);
+	void processRawData(const char* page_ptr);
+	
+	// decoding state that carries between pages
+	struct decode_state {
+		bool status_page_found;
+		int data_count;
+	};
+	
+	void decodeRawPage(const char* page_buffer, uint16_t page_number,
+		MDataObserver* obs, decode_state& state);
+	
+	// result of the checks on a page which need no decoding state, so can be
+	// made on any thread (decodeRawPage is checkRawPage then deliverRawPage)
+	struct page_check {
+		uint8_t status;
+		bool compressed;
+		uint16_t overruns;
+		bool crc_checked;
+		bool crc_ok;
+		// samples stored & samples the page accounts for, the two differ
+		// for a partial page
+		int num_samples;
+		int sample_count;
+		// the samples of a compressed page
+		uint8_t unpacked[MAX_SAMPLES_PER_PAGE * BYTES_PER_SAMPLE];
+	};
+	
+	void checkRawPage(const char* page_buffer, uint16_t page_number,
+		page_check& check);
+	void deliverRawPage(const char* page_buffer, uint16_t page_number,
+		const page_check& check, MDataObserver* obs, decode_state& state);
+	
+	// checks pages on worker threads, delivering them in order (see
+	// setDecodeThreads)
+	class RawDecodePool;
+	RawDecodePool* decode_pool;
+	int decode_threads;
+	
+	void startDecodePool();
+	void stopDecodePool();
+	
+	int replayMappedRange(const char* first_page, size_t num_pages,
+		MDataObserver* obs, decode_state& state);
+	int countMappedRange(const char* first_page, size_t num_pages);
 	
 	typedef enum {
 		COLLECT_OP,
@@ -659,7 +1061,9 @@ private:
 		SET_CALIB_DATA_OP,
 		SET_FIRST_DOWNLD_OP,
 		GET_FIRST_DOWNLD_OP,
-		GET_IS_COMPLETE_OP //fw1.2
+		GET_IS_COMPLETE_OP, //fw1.2
+		GET_PROFILE_OP, //fw1.6
+		READ_SUMMARY_OP //fw1.2
 	} op_state;
 
 	int enterEventLoop(op_state op);
@@ -696,7 +1100,8 @@ private:
 		READ_DBG,
 		READ_ACCEL_CONFIG,
 		GET_FIRST_DOWNLD,
-		GET_IS_COMPLETE
+		GET_IS_COMPLETE,
+		GET_PROFILE
 	} ctrl_state;
 
 	ctrl_state current_state;
@@ -712,21 +1117,21 @@ private:
 
 	int total_rec;
 
-#ifdef USBLIB1
-	libusb_device_handle *dev_handle;
-	libusb_context *ctx;
-#else
-	struct usb_dev_handle *dev_handle;
-#endif
+	// the transport in use, usb_transport or one set by setTransport
+	MBandTransport* transport_ptr;
+	LibusbTransport* usb_transport;
 	
 	int full_config_defined;
+	// is_complete is from the same session as received_config_data
+	int summary_defined;
 	struct config_info received_config_data;
 	struct config_info sent_config_data;
 
 	int new_band_id_length;
 	uint8_t new_band_id[MAX_ID_LEN + 1];
 
-	char readchars[SIMPLE_TX_DATA_SIZE];
+	char readchars[max_stream_read + 1];
+	int read_size;
 	char writechars[SIMPLE_RX_DATA_SIZE];
 	
 	char data_buffer[max_transfer_page];
@@ -746,6 +1151,19 @@ private:
 	
 	unsigned int read_timeout;
 	
+	// latencies per op_state, then of the link request
+	struct latency_record {
+		unsigned int replies;
+		unsigned int timeouts;
+		double total_ms;
+		double max_ms;
+	};
+	static const int link_latency = READ_SUMMARY_OP + 1;
+	latency_record latency[link_latency + 1];
+	
+	unsigned int readTimeoutFor(int kind);
+	void fillLatencyStats(int kind, usb_latency_stats& stats);
+	
 	int keep_going;
 	
 	uint16_t read_page_num;
@@ -769,13 +1187,377 @@ private:
 	uint8_t calibration_data[MAX_CALIBRATION_DATA_LEN];
 	
 	uint32_t first_download;
-	bool status_page_found;
+	decode_state raw_decode;
+	RawIndex* raw_index_ptr;
+	
+	int async_transfers;
+	int stream_download;
+	int stream_raw;
+	// logical page the raw download starts from & its offset in the raw file
+	uint32_t raw_first_page;
+	uint64_t raw_base_offset;
+#ifdef USBLIB1
+	typedef enum {
+		RAW_PAGE_ITEM,
+		RAW_DONE_ITEM,
+		RAW_ABORT_ITEM
+	} raw_item_kind;
+	
+	struct raw_page_item {
+		raw_item_kind kind;
+		bool start_found;
+		uint16_t page_num;
+		char data[max_transfer_page];
+	};
+	
+	// pages buffered between the usb and decode threads
+	static const size_t raw_queue_pages = 64;
+	SpscQueue<raw_page_item, raw_queue_pages>* raw_queue;
+	
+	bool async_done;
+	int async_result;
+	int async_in_flight;
+	// set by the decode thread once the observer asks to stop
+	std::atomic<bool> async_stopped;
+	
+	int asyncRawLoop();
+	int asyncTransportLoop(int kind);
+	void asyncDecodeWorker();
+	void asyncTransferComplete(struct libusb_transfer* transfer);
+	static void LIBUSB_CALL asyncTransferCb(struct libusb_transfer* transfer);
+#endif
 	
 	uint8_t is_complete;
 	
+	uint8_t profile_request;
+	profile_stats profile_read;
+	uint32_t profile_clock_hz;
+	
 	queue<uint8_t>* iDebugDataPtr;
 };
 
+// ----
+
+// Streaming epoch statistics
+//
+// Summarises the samples into fixed length epochs as the pages arrive, using
+// running (Welford) sums so each epoch needs the same small state however
+// long it is. Epochs are aligned to the collection start and an epoch with
+// no samples (e.g. a gap in the capture) is not reported.
+
+// vector magnitude (in g) above which a sample counts as active
+const double default_activity_threshold = 1.1;
+
+struct epoch_stats
+{
+	// wall time of the start of the epoch
+	time_t start_time;
+	uint32_t epoch_secs;
+	uint32_t num_samples;
+	
+	// x, y & z in g, the variance is of the population
+	double mean[3];
+	double variance[3];
+	
+	// vector magnitude & euclidean norm minus one (negative values as 0)
+	double mean_vm;
+	double variance_vm;
+	double mean_enmo;
+	uint32_t count_above_threshold;
+	
+	// over the pages starting in the epoch
+	uint32_t num_temperatures;
+	double mean_temperature;
+};
+
+struct MEpochObserver
+{
+	virtual ~MEpochObserver() {}
+	
+	/**
+	 * Notifies the client of a completed epoch
+	 */
+	virtual void evEpochCallback(const epoch_stats& epoch) = 0;
+};
+
+class EpochStats
+{
+public:
+	/**
+	 * \param obs_ptr is the observer to notify of each epoch
+	 * \param epoch_secs is the length of an epoch in seconds
+	 * \param threshold_g is the vector magnitude counted as active
+	 */
+	EpochStats(MEpochObserver* obs_ptr, uint32_t epoch_secs = 60,
+		double threshold_g = default_activity_threshold);
+	
+	/**
+	 * Add the current page of an observer (call from evSamplesCallback)
+	 */
+	void addPage(const MDataObserver& page);
+	
+	/**
+	 * Add a page from its view, the samples are read in place (call from
+	 * evPageCallback)
+	 */
+	void addPage(const MDataObserver& page,
+		const MDataObserver::page_view& view);
+	
+	/**
+	 * Report the last, possibly partial, epoch (call from evDoneCallback)
+	 */
+	void finish();
+	
+private:
+	void addSamples(const MDataObserver& page, uint32_t tick,
+		uint16_t temperature_raw, const uint8_t* sample_bytes, int num);
+	void startEpoch(int64_t epoch_idx);
+	void reportEpoch();
+	
+	MEpochObserver* observer;
+	uint32_t epoch_len;
+	double threshold;
+	
+	time_t start_time;
+	double sample_rate;
+	uint32_t last_tick;
+	bool have_tick;
+	
+	int64_t current_epoch;
+	epoch_stats stats;
+	double m2[3];
+	double m2_vm;
+	double enmo_sum;
+	vector<double> g_vals;
+};
+
+// Observer that only gathers epoch statistics
+struct StatsObserver : public MDataObserver
+{
+	StatsObserver(EpochStats& aStats) : stats(aStats) {}
+	virtual bool evPageCallback(const page_view& page);
+	virtual bool evSamplesCallback();
+	virtual void evDoneCallback();
+	EpochStats& stats;
+};
+
+// ----
+
+// Raw file page index
+//
+// Sidecar to a raw file recording where each page record starts and the
+// tick it was stored at, so a time window can be read without scanning the
+// whole file. All values are little-endian.
+
+#define RAW_INDEX_MAGIC "BBIX"
+#define RAW_INDEX_VERSION 1
+
+struct raw_index_entry
+{
+	// of the page record (leader + page) in the raw file
+	uint64_t offset;
+	uint32_t current_tick;
+	uint16_t page_num;
+	uint8_t status_raw;
+};
+
+class RawIndex
+{
+public:
+	RawIndex();
+	
+	void clear();
+	
+	/**
+	 * Add a page record to the index
+	 * \param offset is the position of the record in the raw file
+	 * \param page_record is the leader followed by the page
+	 */
+	void addPage(uint64_t offset, const char* page_record);
+	
+	/**
+	 * Build the index by scanning an existing raw file
+	 * \param aFilename is the raw file
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int build(const char* aFilename);
+	
+	/**
+	 * Store the index in a sidecar file
+	 * \param aFilename is the file to write
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int save(const char* aFilename) const;
+	
+	/**
+	 * Load the index from a sidecar file
+	 * \param aFilename is the file to read
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int load(const char* aFilename);
+	
+	/**
+	 * Find the pages stored in a time window
+	 * \param from_time is the start of the window
+	 * \param to_time is the end of the window
+	 * \param first is set to the first entry in the window
+	 * \param count is set to the number of entries in the window
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int findWindow(time_t from_time, time_t to_time, size_t& first,
+		size_t& count) const;
+	
+	/**
+	 * Returns the time a page was stored at
+	 */
+	time_t pageTime(size_t idx) const;
+	
+	size_t size() const { return entries.size(); }
+	const raw_index_entry& operator[](size_t idx) const {
+		return entries[idx];
+	}
+	
+	// from the page holding the config, 0 if not seen
+	uint32_t collect_start_time;
+	
+private:
+	vector<raw_index_entry> entries;
+};
+
+// ----
+
+// Columnar capture file
+//
+// A compact binary alternative to the csv output. The file is a fixed size
+// header holding the capture metadata, then a block per page (tick,
+// temperature, status, crc flag and the x, y & z values as separate int16
+// columns) and finally an index of the file offset of each page block so a
+// reader can seek straight to any page. All values are little-endian.
+
+#define COLUMNAR_MAGIC "BBCF"
+#define COLUMNAR_VERSION 1
+
+struct columnar_header
+{
+	uint16_t version;
+	uint32_t page_count;
+	
+	// from the page holding the config
+	bool additional_present;
+	uint16_t battery_raw;
+	string band_id;
+	string subject_id;
+	string test_id;
+	string centre_id;
+	uint8_t calibration_data[MAX_CALIBRATION_DATA_LEN];
+	uint32_t req_total_num_samples;
+	uint32_t collect_start_time;
+	uint8_t accel_conf_raw;
+	uint8_t fw_hw_version_raw;
+	
+	// from the page holding the status
+	bool status_present;
+	uint32_t first_downloaded;
+	uint32_t end_tick;
+	uint32_t num_samples;
+	uint32_t actioned_time;
+};
+
+struct columnar_page
+{
+	uint32_t current_tick;
+	uint16_t temperature_raw;
+	uint8_t status_raw;
+	bool crc_ok;
+	vector<int16_t> x;
+	vector<int16_t> y;
+	vector<int16_t> z;
+};
+
+class ColumnarWriter
+{
+public:
+	ColumnarWriter();
+	virtual ~ColumnarWriter();
+	
+	/**
+	 * Create the file, a partly written header is output straight away and
+	 * completed by close()
+	 * \param aFilename is the file to create
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int open(const char* aFilename);
+	
+	/**
+	 * Append the current page of an observer (call from evSamplesCallback)
+	 * \param page is the observer holding the page
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int addPage(const MDataObserver& page);
+	
+	/**
+	 * Write the page index and complete the header
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int close();
+	
+	bool isOpen() { return fd_ptr != NULL; }
+	
+private:
+	int writeHeader(uint64_t index_offset);
+	
+	FILE* fd_ptr;
+	columnar_header header;
+	vector<uint64_t> page_offsets;
+	size_t last_num_samples;
+	vector<uint8_t> block;
+};
+
+class ColumnarReader
+{
+public:
+	ColumnarReader();
+	virtual ~ColumnarReader();
+	
+	/**
+	 * Open a columnar file and load its page index. If the file was never
+	 * closed (e.g. the download was interrupted) the index is rebuilt from
+	 * the page blocks.
+	 * \param aFilename is the file to read
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int open(const char* aFilename);
+	
+	/**
+	 * The metadata of the capture
+	 */
+	const columnar_header& getHeader() { return header; }
+	
+	/**
+	 * Returns the number of pages in the file
+	 */
+	int getPageCount() { return (int) page_offsets.size(); }
+	
+	/**
+	 * Read a page from the file
+	 * \param page_idx is the page to read (0 to getPageCount() - 1)
+	 * \param page is populated with the page
+	 * \return 0 indicates successful completion, < 0 if there is an error
+	 */
+	int readPage(int page_idx, columnar_page& page);
+	
+	void close();
+	
+private:
+	int readBlock(uint64_t offset, columnar_page* page_ptr,
+		uint64_t* next_offset_ptr);
+	
+	FILE* fd_ptr;
+	columnar_header header;
+	vector<uint64_t> page_offsets;
+	vector<uint8_t> block;
+};
+
 #endif
 
 // EOF
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MS VC++ does not appear to like this in an ifdef
+#include "stdafx.h"
+
+#include "band_if.h"
+
+#include <algorithm>
+
+#define INDEX_HEADER_SIZE	16
+#define INDEX_ENTRY_SIZE	16
+
+static void putLE16(uint8_t* ptr, uint16_t val) {
+	ptr[0] = (uint8_t) val;
+	ptr[1] = (uint8_t) (val >> 8);
+}
+
+static void putLE32(uint8_t* ptr, uint32_t val) {
+	putLE16(ptr, (uint16_t) val);
+	putLE16(ptr + 2, (uint16_t) (val >> 16));
+}
+
+static uint16_t getLE16(const uint8_t* ptr) {
+	return (uint16_t) (ptr[0] | (ptr[1] << 8));
+}
+
+static uint32_t getLE32(const uint8_t* ptr) {
+	return getLE16(ptr) | ((uint32_t) getLE16(ptr + 2) << 16);
+}
+
+RawIndex::RawIndex() :
+	collect_start_time(0) {
+}
+
+void RawIndex::clear() {
+	collect_start_time = 0;
+	entries.clear();
+}
+
+void RawIndex::addPage(uint64_t offset, const char* page_record) {
+	const uint8_t* page = (const uint8_t*) page_record + PAGE_LEADER;
+	raw_index_entry entry;
+	entry.offset = offset;
+	entry.page_num = (uint16_t) ((((uint8_t) page_record[2]) << 8) |
+		(uint8_t) page_record[3]);
+	entry.status_raw = page[PAGE_STATUS_ADDR];
+	entry.current_tick = getLE32(page + CURRENT_TICK_ADDR);
+	if (!entry.page_num && !collect_start_time) {
+		collect_start_time = getLE32(page + START_EPOC_ADDR);
+	}
+	entries.push_back(entry);
+}
+
+int RawIndex::build(const char* aFilename) {
+	if (!aFilename) {
+		return -E_BB_BAD_PARAM;
+	}
+	FILE* fd_ptr = fopen(aFilename,"rb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	clear();
+	
+	char record[max_transfer_page];
+	uint64_t offset = 0;
+	while (fread(record, 1, max_transfer_page, fd_ptr) == max_transfer_page) {
+		// expect 00pp00 (where p = page number), as checkRawStart
+		if (!record[0] && !record[1] && !record[4] && !record[5])
+			addPage(offset, record);
+		offset += max_transfer_page;
+	}
+	fclose(fd_ptr);
+	return BB_SUCCESS;
+}
+
+int RawIndex::save(const char* aFilename) const {
+	if (!aFilename) {
+		return -E_BB_BAD_PARAM;
+	}
+	FILE* fd_ptr = fopen(aFilename,"wb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	
+	int retval = BB_SUCCESS;
+	uint8_t hdr[INDEX_HEADER_SIZE];
+	memcpy(hdr, RAW_INDEX_MAGIC, 4);
+	putLE16(hdr + 4, RAW_INDEX_VERSION);
+	putLE16(hdr + 6, INDEX_ENTRY_SIZE);
+	putLE32(hdr + 8, collect_start_time);
+	putLE32(hdr + 12, (uint32_t) entries.size());
+	if (fwrite(hdr, 1, INDEX_HEADER_SIZE, fd_ptr) != INDEX_HEADER_SIZE)
+		retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	
+	uint8_t rec[INDEX_ENTRY_SIZE];
+	for (size_t idx = 0; !retval && idx < entries.size(); idx++) {
+		const raw_index_entry& entry = entries[idx];
+		putLE32(rec, (uint32_t) entry.offset);
+		putLE32(rec + 4, (uint32_t) (entry.offset >> 32));
+		putLE32(rec + 8, entry.current_tick);
+		putLE16(rec + 12, entry.page_num);
+		rec[14] = entry.status_raw;
+		rec[15] = 0;
+		if (fwrite(rec, 1, INDEX_ENTRY_SIZE, fd_ptr) != INDEX_ENTRY_SIZE)
+			retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+	}
+	fclose(fd_ptr);
+	return retval;
+}
+
+int RawIndex::load(const char* aFilename) {
+	if (!aFilename) {
+		return -E_BB_BAD_PARAM;
+	}
+	FILE* fd_ptr = fopen(aFilename,"rb");
+	if (!fd_ptr) {
+		return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+	}
+	clear();
+	
+	int retval = BB_SUCCESS;
+	uint8_t hdr[INDEX_HEADER_SIZE];
+	if (fread(hdr, 1, INDEX_HEADER_SIZE, fd_ptr) != INDEX_HEADER_SIZE ||
+			memcmp(hdr, RAW_INDEX_MAGIC, 4) ||
+			getLE16(hdr + 4) != RAW_INDEX_VERSION ||
+			getLE16(hdr + 6) != INDEX_ENTRY_SIZE) {
+		retval = -E_BB_BAD_FILE_FORMAT;
+	} else {
+		collect_start_time = getLE32(hdr + 8);
+		uint32_t count = getLE32(hdr + 12);
+		entries.resize(count);
+		uint8_t rec[INDEX_ENTRY_SIZE];
+		for (uint32_t idx = 0; idx < count; idx++) {
+			if (fread(rec, 1, INDEX_ENTRY_SIZE, fd_ptr) != INDEX_ENTRY_SIZE) {
+				retval = -E_BB_BAD_FILE_FORMAT;
+				entries.clear();
+				break;
+			}
+			raw_index_entry& entry = entries[idx];
+			entry.offset = getLE32(rec) | ((uint64_t) getLE32(rec + 4) << 32);
+			entry.current_tick = getLE32(rec + 8);
+			entry.page_num = getLE16(rec + 12);
+			entry.status_raw = rec[14];
+		}
+	}
+	fclose(fd_ptr);
+	return retval;
+}
+
+time_t RawIndex::pageTime(size_t idx) const {
+	return convTicksToTime(collect_start_time, entries[idx].current_tick);
+}
+
+// the ticks only go up during a capture so the pages are in time order
+struct tickBefore {
+	bool operator()(const raw_index_entry& entry, uint32_t tick) const {
+		return entry.current_tick < tick;
+	}
+	bool operator()(uint32_t tick, const raw_index_entry& entry) const {
+		return tick < entry.current_tick;
+	}
+};
+
+static uint32_t timeToTicks(time_t start_time, time_t at_time, bool round_up) {
+	if (at_time <= start_time)
+		return 0;
+	uint64_t ticks = (uint64_t) (at_time - start_time) * RTC_CLOCK_BASE;
+	if (round_up)
+		ticks += RTC_SCALAR - 1;
+	ticks /= RTC_SCALAR;
+	if (ticks > 0xFFFFFFFF)
+		ticks = 0xFFFFFFFF;
+	return (uint32_t) ticks;
+}
+
+int RawIndex::findWindow(time_t from_time, time_t to_time, size_t& first,
+	size_t& count) const {
+	
+	first = 0;
+	count = 0;
+	if (to_time < from_time) {
+		return -E_BB_BAD_PARAM;
+	}
+	
+	// the last pages may never have been written (tick all 0xFFs)
+	size_t end = entries.size();
+	while (end && entries[end - 1].status_raw == UNUSED_PAGE)
+		end--;
+	
+	// pageTime rounds down to the second, so the window covers every tick
+	// that maps to a second within it
+	uint32_t from_tick = timeToTicks(collect_start_time, from_time, true);
+	uint32_t to_tick = timeToTicks(collect_start_time, to_time + 1, true);
+	
+	vector<raw_index_entry>::const_iterator lower = lower_bound(
+		entries.begin(), entries.begin() + end, from_tick, tickBefore());
+	vector<raw_index_entry>::const_iterator upper = lower_bound(
+		lower, entries.begin() + end, to_tick, tickBefore());
+	
+	first = lower - entries.begin();
+	count = upper - lower;
+	return BB_SUCCESS;
+}
+
+// EOF
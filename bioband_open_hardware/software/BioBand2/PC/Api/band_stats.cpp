@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// MS VC++ does not appear to like this in an ifdef
+#include "stdafx.h"
+
+#include "band_if.h"
+
+#include <math.h>
+
+// used until the data rate is known from the config or the page ticks
+#define DEFAULT_SAMPLE_RATE 100.0
+
+static double dataRateToHz(uint8_t accel_conf_raw) {
+	accel_data_rate rate;
+	accel_g_scale scale;
+	decodeRateAndGscale(accel_conf_raw, &rate, &scale);
+	switch (rate) {
+		case CWA_50HZ:
+			return 50.0;
+		case CWA_100HZ:
+			return 100.0;
+		case CWA_400HZ:
+			return 400.0;
+		case CWA_1000HZ:
+			return 1000.0;
+		default:
+			return 0;
+	}
+}
+
+EpochStats::EpochStats(MEpochObserver* obs_ptr, uint32_t epoch_secs,
+	double threshold_g) :
+	observer(obs_ptr),
+	epoch_len(epoch_secs ? epoch_secs : 1),
+	threshold(threshold_g),
+	start_time(0),
+	sample_rate(0),
+	last_tick(0),
+	have_tick(false),
+	current_epoch(-1),
+	m2_vm(0),
+	enmo_sum(0) {
+	memset(&stats, 0, sizeof(stats));
+	m2[0] = m2[1] = m2[2] = 0;
+}
+
+void EpochStats::startEpoch(int64_t epoch_idx) {
+	current_epoch = epoch_idx;
+	memset(&stats, 0, sizeof(stats));
+	stats.start_time = start_time + (time_t) (epoch_idx * epoch_len);
+	stats.epoch_secs = epoch_len;
+	m2[0] = m2[1] = m2[2] = 0;
+	m2_vm = 0;
+	enmo_sum = 0;
+}
+
+void EpochStats::reportEpoch() {
+	if (current_epoch < 0 || (!stats.num_samples && !stats.num_temperatures))
+		return;
+	if (stats.num_samples) {
+		for (int axis = 0; axis < 3; axis++)
+			stats.variance[axis] = m2[axis] / stats.num_samples;
+		stats.variance_vm = m2_vm / stats.num_samples;
+		stats.mean_enmo = enmo_sum / stats.num_samples;
+	}
+	if (observer)
+		observer->evEpochCallback(stats);
+}
+
+void EpochStats::addPage(const MDataObserver& page) {
+	addSamples(page, page.current_tick, page.temperature_raw,
+		page.raw_samples[0].sample_raw, page.num_raw_samples);
+}
+
+void EpochStats::addPage(const MDataObserver& page,
+	const MDataObserver::page_view& view) {
+	
+	addSamples(page, view.current_tick, view.temperature_raw,
+		view.sample_bytes, view.num_samples);
+}
+
+void EpochStats::addSamples(const MDataObserver& page, uint32_t tick,
+	uint16_t temperature_raw, const uint8_t* sample_bytes, int num) {
+	
+	if (page.additional_present) {
+		start_time = page.collect_start_time;
+		double rate = dataRateToHz(page.accel_conf_raw);
+		if (rate > 0)
+			sample_rate = rate;
+	}
+	
+	if (!sample_rate && have_tick && tick > last_tick && num) {
+		// no config seen, so estimate from the previous page
+		double secs = (tick - last_tick) *
+			(double) RTC_SCALAR / RTC_CLOCK_BASE;
+		sample_rate = num / secs;
+	}
+	double rate = sample_rate ? sample_rate : DEFAULT_SAMPLE_RATE;
+	last_tick = tick;
+	have_tick = true;
+	
+	// seconds since the collection start of the page (& its first sample)
+	double page_secs = tick * (double) RTC_SCALAR /
+		RTC_CLOCK_BASE;
+	int64_t page_epoch = (int64_t) (page_secs / epoch_len);
+	if (page_epoch > current_epoch) {
+		reportEpoch();
+		startEpoch(page_epoch);
+	}
+	
+	// running mean of the page temperatures
+	stats.num_temperatures++;
+	stats.mean_temperature += (convTempBinToCelsius(temperature_raw) -
+		stats.mean_temperature) / stats.num_temperatures;
+	
+	if (!num)
+		return;
+	g_vals.resize(num * 3);
+	convAccSamplesToGValues(sample_bytes, num, &g_vals[0], page.g_divisor);
+	
+	for (int idx = 0; idx < num; idx++) {
+		int64_t epoch_idx = (int64_t) ((page_secs + idx / rate) / epoch_len);
+		if (epoch_idx > current_epoch) {
+			reportEpoch();
+			startEpoch(epoch_idx);
+		}
+		
+		const double* g = &g_vals[idx * 3];
+		stats.num_samples++;
+		double n = stats.num_samples;
+		for (int axis = 0; axis < 3; axis++) {
+			double delta = g[axis] - stats.mean[axis];
+			stats.mean[axis] += delta / n;
+			m2[axis] += delta * (g[axis] - stats.mean[axis]);
+		}
+		
+		double vm = sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+		double delta = vm - stats.mean_vm;
+		stats.mean_vm += delta / n;
+		m2_vm += delta * (vm - stats.mean_vm);
+		if (vm > 1.0)
+			enmo_sum += vm - 1.0;
+		if (vm > threshold)
+			stats.count_above_threshold++;
+	}
+}
+
+void EpochStats::finish() {
+	reportEpoch();
+	current_epoch = -1;
+	have_tick = false;
+}
+
+bool StatsObserver::evPageCallback(const page_view& page) {
+	stats.addPage(*this, page);
+	return true;
+}
+
+bool StatsObserver::evSamplesCallback() {
+	// the samples were taken from the page view
+	reset();
+	return false;
+}
+
+void StatsObserver::evDoneCallback() {
+	stats.finish();
+}
+
+// EOF
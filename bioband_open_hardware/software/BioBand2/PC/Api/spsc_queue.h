@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SPSC_QUEUE
+#define _SPSC_QUEUE
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Fixed size queue for handing items from exactly one producer thread to
+ * exactly one consumer thread. Items are filled and read in place to avoid
+ * copying large page buffers twice. The slots are handed over lock free, a
+ * side which has to wait (see waitClaim & waitFront) blocks until the other
+ * side publishes or pops.
+ */
+template <typename T, size_t N>
+class SpscQueue
+{
+public:
+	SpscQueue() : head(0), tail(0) {}
+	
+	/**
+	 * Producer only. Get the next free slot to fill.
+	 * \return NULL if the queue is full
+	 */
+	T* claim() {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N)
+			return NULL;
+		return &slots[h % N];
+	}
+	
+	/**
+	 * Producer only. As claim(), waiting for a free slot if the queue is full
+	 */
+	T* waitClaim() {
+		T* slot = claim();
+		if (!slot) {
+			std::unique_lock<std::mutex> guard(lock);
+			while (!(slot = claim()))
+				changed.wait(guard);
+		}
+		return slot;
+	}
+	
+	/**
+	 * Producer only. Make the slot returned by claim() visible to the consumer
+	 */
+	void publish() {
+		head.store(head.load(std::memory_order_relaxed) + 1,
+			std::memory_order_release);
+		wake();
+	}
+	
+	/**
+	 * Consumer only. Get the oldest published item.
+	 * \return NULL if the queue is empty
+	 */
+	T* front() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t)
+			return NULL;
+		return &slots[t % N];
+	}
+	
+	/**
+	 * Consumer only. As front(), waiting for an item if the queue is empty
+	 */
+	T* waitFront() {
+		T* item = front();
+		if (!item) {
+			std::unique_lock<std::mutex> guard(lock);
+			while (!(item = front()))
+				changed.wait(guard);
+		}
+		return item;
+	}
+	
+	/**
+	 * Consumer only. Release the item returned by front() back to the producer
+	 */
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1,
+			std::memory_order_release);
+		wake();
+	}
+	
+private:
+	// taking the lock orders the wake after a waiter's last check
+	void wake() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+		}
+		changed.notify_one();
+	}
+	
+
+	T slots[N];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::mutex lock;
+	std::condition_variable changed;
+};
+
+#endif
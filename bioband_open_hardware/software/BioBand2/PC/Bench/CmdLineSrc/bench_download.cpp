@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Download benchmark, runs every raw download & decode path of BioBandIf
+// against the band emulator (no band needed) and checks each one sees every
+// page of the image
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+
+#include "band_if.h"
+#include "band_emulator.h"
+
+#define DEFAULT_PAGES 4096
+#define BENCH_RAW_FILE "bench_download.raw"
+#define ASYNC_TRANSFERS 8
+
+// counts the pages decoded
+struct benchObserver : public MDataObserver
+{
+	benchObserver() : pages(0), crc_pages(0), samples(0) {}
+	bool evPageCallback(const page_view& page);
+	bool evSamplesCallback();
+	void evDoneCallback() {}
+	int pages;
+	int crc_pages;
+	uint64_t samples;
+};
+
+// takes the samples in place, as a consumer which only reads them would
+bool benchObserver::evPageCallback(const page_view& page) {
+	samples += page.num_samples;
+	return true;
+}
+
+bool benchObserver::evSamplesCallback() {
+	pages++;
+	if (crc_ok)
+		crc_pages++;
+	reset();
+	return false;
+}
+
+static int errors = 0;
+static uint32_t expected_pages = 0;
+static bool expect_crc_ok = true;
+
+static double secsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* path, int result, double secs,
+	const vector<benchObserver>& obs) {
+	
+	int pages = 0, crc_pages = 0;
+	for (size_t loop = 0; loop < obs.size(); loop++) {
+		pages += obs[loop].pages;
+		crc_pages += obs[loop].crc_pages;
+	}
+	
+	if (result < 0) {
+		printf("%-18s FAILED (%d)\n", path, result);
+		errors++;
+		return;
+	}
+	
+	double mbytes = (double) result / (1024 * 1024);
+	printf("%-18s %7.3f s %8.1f MB/s %10.0f pages/s", path, secs,
+		secs > 0 ? mbytes / secs : 0, secs > 0 ? pages / secs : 0);
+	if (((uint32_t) pages != expected_pages) ||
+			(expect_crc_ok && (crc_pages != pages))) {
+		printf("  FAILED (%d pages, %d crc ok)", pages, crc_pages);
+		errors++;
+	}
+	printf("\n");
+}
+
+static void benchDownload(BioBandIf& band, const char* path, int stream,
+	int async_transfers, int decode_threads, FILE* write_fd_ptr) {
+	
+	vector<benchObserver> obs(1);
+	band.setStreamDownload(stream);
+	if (band.setAsyncTransfers(async_transfers) != BB_SUCCESS) {
+		printf("%-18s not supported in this build\n", path);
+		return;
+	}
+	band.setDecodeThreads(decode_threads);
+	band.setRawDataCallbackPtr(&obs[0]);
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int result = band.readRawFromBand(write_fd_ptr);
+	double secs = secsSince(start);
+	band.setAsyncTransfers(0);
+	band.setDecodeThreads(0);
+	report(path, result, secs, obs);
+}
+
+static void benchFile(BioBandIf& band, int decode_threads) {
+	vector<benchObserver> obs(1);
+	FILE* fd_ptr = fopen(BENCH_RAW_FILE, "rb");
+	if (!fd_ptr) {
+		printf("Failed to open %s\n", BENCH_RAW_FILE);
+		errors++;
+		return;
+	}
+	band.setDecodeThreads(decode_threads);
+	band.setRawDataCallbackPtr(&obs[0]);
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int result = band.readRawFromFile(fd_ptr);
+	double secs = secsSince(start);
+	fclose(fd_ptr);
+	band.setDecodeThreads(0);
+	report(decode_threads ? "file, pool" : "file", result, secs, obs);
+}
+
+// how long the band interface takes to give up on a band which has stopped
+// replying, the read timeouts having adapted to the latencies seen
+static void benchNoResponse(BioBandIf& band, BandEmulator& emulator) {
+	vector<BioBandIf::usb_latency_stats> all;
+	band.getUsbLatencyStats(all);
+	BioBandIf::usb_latency_stats stats = BioBandIf::usb_latency_stats();
+	for (size_t loop = 0; loop < all.size(); loop++)
+		if (all[loop].op == "link")
+			stats = all[loop];
+	
+	emulator.setResponding(false);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	BioBandIf::band_summary summary;
+	int result = band.getBandSummary(summary);
+	double secs = secsSince(start);
+	emulator.setResponding(true);
+	
+	printf("%-18s %7.3f s (link replies %u, mean %.3f ms, timeout %u ms)",
+		"no response", secs, stats.replies, stats.mean_ms,
+		stats.read_timeout_ms);
+	if (result != -E_BB_NO_RESPONSE_FROM_BAND) {
+		printf("  FAILED (%d)", result);
+		errors++;
+	}
+	printf("\n");
+}
+
+static void benchMapped(BioBandIf& band, int num_ranges) {
+	vector<benchObserver> obs(num_ranges);
+	char path[32];
+	int result;
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (num_ranges == 1) {
+		band.setRawDataCallbackPtr(&obs[0]);
+		result = band.readRawFromMappedFile(BENCH_RAW_FILE);
+		strcpy(path, "mapped");
+	} else {
+		vector<MDataObserver*> range_obs;
+		for (int loop = 0; loop < num_ranges; loop++)
+			range_obs.push_back(&obs[loop]);
+		result = band.readRawFromMappedFile(BENCH_RAW_FILE, range_obs);
+		sprintf(path, "mapped x %d", num_ranges);
+	}
+	double secs = secsSince(start);
+	report(path, result, secs, obs);
+}
+
+int main(int argc, char* argv[]) {
+	int num_pages = DEFAULT_PAGES;
+	int latency_us = 0;
+	int packet_size = STREAM_PACKET_SIZE;
+	const char* image_file = NULL;
+	
+	if (argc > 1)
+		num_pages = atoi(argv[1]);
+	if (argc > 2)
+		latency_us = atoi(argv[2]);
+	if (argc > 3)
+		packet_size = atoi(argv[3]);
+	if (argc > 4)
+		image_file = argv[4];
+	
+	BandEmulator emulator;
+	if ((num_pages <= 0) || (latency_us < 0) ||
+			(emulator.setPacketSize(packet_size) < 0)) {
+		printf("usage: %s [pages, default %d] [latency us, default 0]"
+			" [packet size, default %d] [raw image file]\n", argv[0],
+			DEFAULT_PAGES, STREAM_PACKET_SIZE);
+		return 1;
+	}
+	
+	if (image_file) {
+		int ret = emulator.loadImage(image_file);
+		if (ret < 0) {
+			printf("Failed to load %s (%d)\n", image_file, ret);
+			return 1;
+		}
+		// a recorded capture may hold pages which fail their checks
+		expect_crc_ok = false;
+	} else {
+		emulator.createImage(num_pages, time(NULL));
+	}
+	emulator.setLatency(latency_us);
+	expected_pages = emulator.getPageCount();
+	
+	printf("%u pages (%.1f MB), latency %d us, packet %d bytes\n",
+		expected_pages,
+		(double) emulator.getRawSize() / (1024 * 1024), latency_us,
+		packet_size);
+	
+	BioBandIf band;
+	band.setTransport(&emulator);
+	
+	int threads = (int) thread::hardware_concurrency();
+	
+	benchDownload(band, "download", 0, 0, 0, NULL);
+	benchDownload(band, "streamed", 1, 0, 0, NULL);
+	benchDownload(band, "async streamed", 1, ASYNC_TRANSFERS, 0, NULL);
+	if (threads > 1) {
+		benchDownload(band, "streamed, pool", 1, 0, threads, NULL);
+		benchDownload(band, "async, pool", 1, ASYNC_TRANSFERS, threads, NULL);
+	}
+	
+	FILE* fd_ptr = fopen(BENCH_RAW_FILE, "wb");
+	if (!fd_ptr) {
+		printf("Failed to create %s\n", BENCH_RAW_FILE);
+		return 1;
+	}
+	benchDownload(band, "streamed to file", 1, 0, 0, fd_ptr);
+	fclose(fd_ptr);
+	
+	benchFile(band, 0);
+	if (threads > 1)
+		benchFile(band, threads);
+	benchMapped(band, 1);
+	if (threads > 1)
+		benchMapped(band, threads);
+	benchNoResponse(band, emulator);
+	
+	band.setTransport(NULL);
+	remove(BENCH_RAW_FILE);
+	
+	return errors ? 1 : 0;
+}
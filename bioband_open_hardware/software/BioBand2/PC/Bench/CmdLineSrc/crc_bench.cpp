@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2011, Medical Research Council
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    * Redistributions of source code must retain the above copyright notice,
+ * 		this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ * 		notice, this list of conditions and the following disclaimer in the
+ * 		documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the MRC Epidemiology Unit nor the names of its
+ * 		contributors may be used to endorse or promote products derived from
+ * 		this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Micro benchmark of the page crc, checks the crc16 module gives bit
+// identical results to the original byte at a time table calculation
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared.h"
+#include "crc16.h"
+
+#define PAGE_DATA_BYTES (SAMPLES_PER_PAGE * BYTES_PER_SAMPLE)
+#define DEFAULT_PAGES (MAX_BLOCKS * MAX_PAGES_PER_BLOCK)
+#define TEST_BUFFER 4096
+
+// The calculation as originally done in processRawData and collect()
+static void referenceCrc(uint8_t* crc_hi, uint8_t* crc_lo,
+	const uint8_t* data, uint32_t len) {
+	
+	for (uint32_t loop = 0; loop < len; loop++) {
+		uint8_t i = *crc_hi ^ data[loop];
+		*crc_hi = *crc_lo ^ table_crc_hi[i];
+		*crc_lo = table_crc_lo[i];
+	}
+}
+
+static int checkBitExact() {
+	static uint8_t buffer[TEST_BUFFER];
+	int errors = 0;
+	
+	srand(1);
+	for (int loop = 0; loop < TEST_BUFFER; loop++)
+		buffer[loop] = (uint8_t) rand();
+	
+	// every length and start alignment up to a page and a bit
+	for (uint32_t len = 0; len <= PAGE_DATA_BYTES + 16; len++) {
+		for (uint32_t offset = 0; offset < 8; offset++) {
+			uint8_t ref_hi = CRC16_INITIAL_VALUE, ref_lo = CRC16_INITIAL_VALUE;
+			uint8_t hi = CRC16_INITIAL_VALUE, lo = CRC16_INITIAL_VALUE;
+			referenceCrc(&ref_hi, &ref_lo, buffer + offset, len);
+			crc16Update(&hi, &lo, buffer + offset, len);
+			if ((hi != ref_hi) || (lo != ref_lo)) {
+				if (errors < 10) {
+					printf("Mismatch len %u offset %u: 0x%02x%02x != 0x%02x%02x\n",
+						len, offset, hi, lo, ref_hi, ref_lo);
+				}
+				errors++;
+			}
+		}
+	}
+	
+	// incremental updates as used for the half page writes on the band
+	for (uint32_t split = 0; split <= PAGE_DATA_BYTES; split += 7) {
+		uint8_t ref_hi = CRC16_INITIAL_VALUE, ref_lo = CRC16_INITIAL_VALUE;
+		uint8_t hi = CRC16_INITIAL_VALUE, lo = CRC16_INITIAL_VALUE;
+		referenceCrc(&ref_hi, &ref_lo, buffer, PAGE_DATA_BYTES);
+		crc16Update(&hi, &lo, buffer, split);
+		crc16Update(&hi, &lo, buffer + split, PAGE_DATA_BYTES - split);
+		if ((hi != ref_hi) || (lo != ref_lo))
+			errors++;
+	}
+	
+	return errors;
+}
+
+static double timePages(bool reference, const uint8_t* pages, int num_pages,
+	int total_pages, uint32_t& result) {
+	
+	clock_t start = clock();
+	result = 0;
+	for (int loop = 0; loop < total_pages; loop++) {
+		const uint8_t* page = pages + (loop % num_pages) * PAGE_DATA_BYTES;
+		uint8_t hi = CRC16_INITIAL_VALUE, lo = CRC16_INITIAL_VALUE;
+		if (reference)
+			referenceCrc(&hi, &lo, page, PAGE_DATA_BYTES);
+		else
+			crc16Update(&hi, &lo, page, PAGE_DATA_BYTES);
+		result += (hi << 8) | lo;
+	}
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char* argv[]) {
+	int total_pages = DEFAULT_PAGES;
+	
+	if (argc > 1) {
+		total_pages = atoi(argv[1]);
+		if (total_pages <= 0) {
+			printf("usage: %s [number of pages, default %d]\n", argv[0],
+				DEFAULT_PAGES);
+			return 1;
+		}
+	}
+	
+	crc16Init();
+	
+	int errors = checkBitExact();
+	printf("Bit exact check: %s (%d mismatches)\n", errors ? "FAILED" : "ok",
+		errors);
+	
+	// a working set of pages that stays in cache, as a dock pc would see
+	const int num_pages = 64;
+	uint8_t* pages = new uint8_t[num_pages * PAGE_DATA_BYTES];
+	for (int loop = 0; loop < num_pages * PAGE_DATA_BYTES; loop++)
+		pages[loop] = (uint8_t) rand();
+	
+	uint32_t ref_result, result;
+	double ref_secs = timePages(true, pages, num_pages, total_pages, ref_result);
+	double secs = timePages(false, pages, num_pages, total_pages, result);
+	double mbytes = (double) total_pages * PAGE_DATA_BYTES / (1024 * 1024);
+	
+	printf("%d pages (%.1f MB)\n", total_pages, mbytes);
+	printf("table:     %.3f s  %.1f MB/s\n", ref_secs,
+		ref_secs > 0 ? mbytes / ref_secs : 0);
+	printf("slicing-8: %.3f s  %.1f MB/s\n", secs,
+		secs > 0 ? mbytes / secs : 0);
+	
+	if (result != ref_result) {
+		printf("Page results differ!\n");
+		errors++;
+	}
+	
+	delete[] pages;
+	
+	return errors ? 1 : 0;
+}
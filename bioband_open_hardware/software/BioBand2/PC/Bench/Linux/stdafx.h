@@ -0,0 +1 @@
+/* Dummy header (needed at the top of cwa_config.cpp for MS VC++ reasons) */
@@ -289,8 +289,8 @@ bool rawData::evSamplesCallback() {
 		summary_output = false;
 	}
 	
-	if (!raw_sample_list.empty()) {
-		num_samples_received += raw_sample_list.size();
+	if (!samples().empty()) {
+		num_samples_received += samples().size();
 		if (expected_total) {
 			uint64_t expected_num = expected_total;
 			uint64_t tmp_num = num_samples_received;
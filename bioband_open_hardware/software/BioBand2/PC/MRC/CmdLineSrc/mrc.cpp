@@ -31,6 +31,13 @@
 #include "stdafx.h"
 
 #include "band_if.h"
+#include "band_fleet.h"
+
+#include <stdarg.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
 
 #define SAMPLE_KEY 'S'
 #define SAMPLE_AND_TEMP_KEY 'T'
@@ -41,6 +48,13 @@
 #define DBG_EXT ".dbg"
 #define CSV_EXT ".csv"
 #define RAW_EXT ".raw"
+#define COLUMNAR_EXT ".bbc"
+#define INDEX_EXT ".idx"
+
+// csv text is written out in blocks of this size
+#define CSV_BUFFER_SIZE (256 * 1024)
+// longest single item added to the csv buffer
+#define CSV_MAX_ITEM 256
 
 // TODO check why cleanup needed, destructor not being called
 BioBandIf bandif;
@@ -59,12 +73,26 @@ static void displayHelp() {
 	printf("Raw file command options\n");
 	printf("\t-raw [filename] read raw image of data from band to file or screen\n");
 	printf("\t-uraw read raw image from band and produce a uniquely named raw file\n");
+	printf("\t-resume <filename> add only the pages not yet read to a raw file\n"
+		"\t\tfrom an earlier -raw/-uraw (band firmware 1.7+)\n");
 	printf("\t-fraw <filename> read raw image of band data from file\n");
+	printf("\t-fmap <filename> as -fraw but maps the file into memory\n");
+	printf("\t-fwin <filename> <from> <to> read only the part of a raw file\n"
+		"\t\tstored between two times (secs since 1970), uses the .idx file\n"
+		"\t\tsaved by -raw/-uraw if present\n");
 	printf("\t-rbl <filename> store raw battery levels to file\n");
 	printf("\t-rtl <filename> store raw temperature levels to file\n");
 	printf("\t-rdbg <filename> store raw debug to file\n");
 	printf("\t-rcsv <filename> store csv output to file\n");
+	printf("\t-rbin <filename> store compact binary columnar output to file\n");
+	printf("\t-rstats <filename> [secs] store activity statistics per epoch\n"
+		"\t\t(default 60 secs) to csv file\n");
 	printf("\t-rsum produce summary of raw data\n");
+	printf("\t-async <n> keep n usb transfers queued for raw reads (libusb 1.0)\n");
+	printf("\t-decode <n> decode raw pages on n worker threads\n");
+	printf("\t-stream use the streamed raw download (band firmware 1.4+)\n");
+	printf("\t-fleet [dir] read raw images from all attached bands at once to\n"
+		"\t\t<serial>.raw files\n");
 	printf("\t-uall create uniquely named files for bl,tl,dbg & csv from band\n");
 	printf("Band sampling command options\n");
 	printf("\t-l collection time (in mins)\n");
@@ -91,9 +119,12 @@ static void displayHelp() {
 	printf("\t-rp <page number (between 1 and value given by -gsp)> read page "
 		"number\n");
 	printf("\t-gbl get current battery level\n");
+	printf("\t-gsum get the band summary (ids, battery, pages & capture state)"
+		" in one go\n");
 	printf("\t-gv get the versions\n");
 	//printf("\t-gm get accelerometer measurement\n");
-	printf("\t-sac <rate 50,100,400,1000> <scale 2,4,8> set accelerometer config\n");
+	printf("\t-sac <rate 50,100,400,1000> <scale 2,4,8> [c] set accelerometer config\n"
+		"\t\t(c to store compressed pages, band firmware 1.5+)\n");
 	printf("\t-rac read current accelerometer data rate and g scale\n");
 	printf("\t-raf read accelerometer data rate and g scale for previous run\n");
 	printf("\t-scal set calibration data, 2 * unsigned values (gain & offset)"
@@ -106,6 +137,8 @@ static void displayHelp() {
 	//printf("\t-drd debug read of all stored accelerometer values to screen\n");
 	printf("\t-nobkp reset bkp domain on band\n");
 	printf("\t-bug read dbg info from band\n");
+	printf("\t-prof read the cycle count profile from band (firmware 1.6+)\n");
+	printf("\t-profc read the cycle count profile from band and clear it\n");
 	//printf("\t-rdbg read debug from band\n");
 	printf("\n");
 }
@@ -145,27 +178,151 @@ static int getLocalTime(char* aString, size_t aLen,
 
 // ----
 
+// Buffered csv output. The text is built up in memory and written to the file
+// in large blocks, rather than by an fprintf per field and a flush per page.
+struct csvBuffer {
+	
+	csvBuffer() : fd_ptr(NULL), used(0) {}
+	~csvBuffer() { flush(); }
+	
+	void setFile(FILE* aFdPtr);
+	void flush();
+	
+	void add(const char* str);
+	void addf(const char* format, ...);
+	void addUint(uint64_t val);
+	void addFixed(int32_t val, uint32_t divisor, int decimals);
+	void addGValue(int16_t raw, double divisor);
+	
+	FILE* fd_ptr;
+	size_t used;
+	char buffer[CSV_BUFFER_SIZE];
+	
+private:
+	void reserve(size_t len) {
+		if (used + len > CSV_BUFFER_SIZE)
+			flush();
+	}
+};
+
+void csvBuffer::setFile(FILE* aFdPtr) {
+	flush();
+	fd_ptr = aFdPtr;
+}
+
+void csvBuffer::flush() {
+	if (fd_ptr && used) {
+		fwrite(buffer, 1, used, fd_ptr);
+		fflush(fd_ptr);
+	}
+	used = 0;
+}
+
+void csvBuffer::add(const char* str) {
+	size_t len = strlen(str);
+	reserve(len);
+	memcpy(buffer + used, str, len);
+	used += len;
+}
+
+void csvBuffer::addf(const char* format, ...) {
+	reserve(CSV_MAX_ITEM);
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer + used, CSV_MAX_ITEM, format, args);
+	va_end(args);
+	if (len > 0)
+		used += (len < CSV_MAX_ITEM) ? len : CSV_MAX_ITEM - 1;
+}
+
+void csvBuffer::addUint(uint64_t val) {
+	char digits[20];
+	int count = 0;
+	do {
+		digits[count++] = (char) ('0' + val % 10);
+		val /= 10;
+	} while (val);
+	reserve(count);
+	while (count)
+		buffer[used++] = digits[--count];
+}
+
+// Same text as printf("%.<decimals>f", val / divisor) without going through
+// floating point. The quotient is rounded half to even as printf does, which
+// is exact for the power of 2 divisors used here. A negative value keeps its
+// sign even if it rounds to zero (e.g. -0.000), again as printf.
+void csvBuffer::addFixed(int32_t val, uint32_t divisor, int decimals) {
+	uint64_t scale = 1;
+	for (int loop = 0; loop < decimals; loop++)
+		scale *= 10;
+	uint64_t magnitude = (val < 0) ? (uint64_t) -(int64_t) val : val;
+	uint64_t scaled = magnitude * scale;
+	uint64_t quot = scaled / divisor;
+	uint64_t rem = scaled % divisor;
+	if (rem * 2 > divisor || (rem * 2 == divisor && (quot & 1)))
+		quot++;
+	
+	reserve(22 + decimals);
+	if (val < 0)
+		buffer[used++] = '-';
+	addUint(quot / scale);
+	if (decimals) {
+		uint64_t frac = quot % scale;
+		buffer[used++] = '.';
+		for (int loop = decimals - 1; loop >= 0; loop--) {
+			buffer[used + loop] = (char) ('0' + frac % 10);
+			frac /= 10;
+		}
+		used += decimals;
+	}
+}
+
+// temperature in 1/32 C units, see convTempBinToCelsius
+static int32_t tempBinToThirtySeconds(uint16_t temp_bin_val) {
+	int32_t v = (temp_bin_val >> 2) & 0x3FFF;
+	if (v & 0x2000)
+		return -((((~v) & 0x1FFF) + 1));
+	return v;
+}
+
+void csvBuffer::addGValue(int16_t raw, double divisor) {
+	uint32_t int_divisor = (uint32_t) divisor;
+	if (int_divisor == divisor && int_divisor &&
+			!(int_divisor & (int_divisor - 1))) {
+		addFixed(raw, int_divisor, 3);
+	} else {
+		addf("%.3f", raw / divisor);
+	}
+}
+
+// ----
+
+string uniqueFilename(const char* aFilename) {
+	string filename = aFilename;
+	int val = 1;
+	bool show_name = false;
+	FILE* fd_ptr = fopen(filename.c_str(),"r");
+	while (fd_ptr) {
+		char tmp[10];
+		filename = aFilename;
+		show_name = true;
+		fclose(fd_ptr);
+		sprintf(tmp,"_%d",val);
+		filename += tmp;
+		fd_ptr = fopen(filename.c_str(),"r");
+		val++;
+	}
+	if (show_name) {
+		fprintf(stderr,"* Note: Using <%s> as file <%s> already exists *\n",
+			filename.c_str(),aFilename);
+	}
+	return filename;
+}
+
 FILE* openUniqueFile(const char* aFilename) {
 	FILE* fd_ptr = NULL;
 	if (aFilename) {
-		string filename = aFilename;
-		int val = 1;
-		bool show_name = false;
-		fd_ptr = fopen(filename.c_str(),"r");
-		while (fd_ptr) {
-			char tmp[10];
-			filename = aFilename;
-			show_name = true;
-			fclose(fd_ptr);
-			sprintf(tmp,"_%d",val);
-			filename += tmp;
-			fd_ptr = fopen(filename.c_str(),"r");
-			val++;
-		}
-		if (show_name) {
-			fprintf(stderr,"* Note: Using <%s> as file <%s> already exists *\n",
-				filename.c_str(),aFilename);
-		}
+		string filename = uniqueFilename(aFilename);
 		fd_ptr = fopen(filename.c_str(),"w");
 	}
 	return fd_ptr;
@@ -173,6 +330,35 @@ FILE* openUniqueFile(const char* aFilename) {
 
 // ----
 
+// Writes each epoch of statistics as a csv line
+struct epochCsv : public MEpochObserver {
+	epochCsv(FILE* aFdPtr);
+	virtual ~epochCsv();
+	virtual void evEpochCallback(const epoch_stats& epoch);
+	FILE* fd_ptr;
+};
+
+epochCsv::epochCsv(FILE* aFdPtr) :
+	fd_ptr(aFdPtr) {
+	fprintf(fd_ptr,"epoch start,samples,mean x,mean y,mean z,var x,var y,"
+		"var z,mean vm,var vm,mean enmo,above threshold,mean temp\n");
+}
+
+epochCsv::~epochCsv() {
+	fclose(fd_ptr);
+}
+
+void epochCsv::evEpochCallback(const epoch_stats& epoch) {
+	fprintf(fd_ptr,"%ld,%u,%.4f,%.4f,%.4f,%.5f,%.5f,%.5f,%.4f,%.5f,%.4f,%u,"
+		"%.02f\n",(long) epoch.start_time,epoch.num_samples,
+		epoch.mean[0],epoch.mean[1],epoch.mean[2],
+		epoch.variance[0],epoch.variance[1],epoch.variance[2],
+		epoch.mean_vm,epoch.variance_vm,epoch.mean_enmo,
+		epoch.count_above_threshold,epoch.mean_temperature);
+}
+
+// ----
+
 struct rawData : public MDataObserver {
 	
 	rawData();
@@ -188,11 +374,17 @@ struct rawData : public MDataObserver {
 	int setTemperatureLevelFilename(const char* aFilename);
 	int setDebugFilename(const char* aFilename);
 	int setCsvFilename(const char* aFilename);
+	int setColumnarFilename(const char* aFilename);
+	int setStatsFilename(const char* aFilename, uint32_t epoch_secs);
 
 	FILE* raw_out_bl;
 	FILE* raw_out_tl;
 	FILE* raw_out_dbg;
 	FILE* raw_out_csv;
+	csvBuffer csv_out;
+	ColumnarWriter raw_out_columnar;
+	epochCsv* raw_out_stats;
+	EpochStats* raw_stats;
 	bool header_output;
 	bool summary_output;
 	time_t start_time;
@@ -207,6 +399,8 @@ rawData::rawData() :
 	raw_out_tl(NULL),
 	raw_out_dbg(NULL),
 	raw_out_csv(NULL),
+	raw_out_stats(NULL),
+	raw_stats(NULL),
 	header_output(false),
 	summary_output(false),
 	start_time(0),
@@ -227,8 +421,11 @@ rawData::~rawData() {
 		fclose(raw_out_dbg);
 	}
 	if (raw_out_csv) {
+		csv_out.setFile(NULL);
 		fclose(raw_out_csv);
 	}
+	delete raw_stats;
+	delete raw_out_stats;
 }
 
 void rawData::outputHeader() {
@@ -359,6 +556,8 @@ void rawData::outputSummary() {
 		}
 	}
 	printf(")\n");
+	if (compressed)
+		printf("compressed:\t%d samples\n",num_raw_samples);
 	printf("current_tick:\t%d\n",current_tick);
 	
 	time_t curr_time = convTicksToTime(start_time, current_tick);
@@ -444,6 +643,8 @@ void rawData::outputSummary() {
 					printf("Unknown");
 					break;
 			}
+			if (accel_conf_raw & ACCEL_COMPRESS_MASK)
+				printf(" compressed");
 		}
 		printf(")\n");
 
@@ -455,6 +656,13 @@ void rawData::outputSummary() {
 }
 
 void rawData::evDoneCallback() {
+	csv_out.flush();
+	if (raw_stats) {
+		raw_stats->finish();
+	}
+	if (raw_out_columnar.isOpen()) {
+		raw_out_columnar.close();
+	}
 	if (num_samples_received == expected_total) {
 		printf("100%%");
 	} else {
@@ -499,14 +707,17 @@ bool rawData::evSamplesCallback() {
 	if (summary_output) {
 		outputSummary();
 		summary_output = false;
-		if (!raw_out_csv && !raw_out_bl && !raw_out_tl && !raw_out_dbg) {
+		if (!raw_out_csv && !raw_out_bl && !raw_out_tl && !raw_out_dbg &&
+				!raw_out_columnar.isOpen() && !raw_stats) {
 			// only a summary requested
 			return true;
 		}
 	}
 	
-	if (!raw_sample_list.empty()) {
-		num_samples_received += raw_sample_list.size();
+	sample_span page_samples = samples();
+	
+	if (!page_samples.empty()) {
+		num_samples_received += page_samples.size();
 		if (expected_total) {
 			uint64_t expected_num = expected_total;
 			uint64_t tmp_num = num_samples_received;
@@ -526,9 +737,20 @@ bool rawData::evSamplesCallback() {
 		}
 	}
 	
+	if (raw_stats) {
+		raw_stats->addPage(*this);
+	}
+	
+	if (raw_out_columnar.isOpen()) {
+		int ret = raw_out_columnar.addPage(*this);
+		if (ret != BB_SUCCESS) {
+			printf("Failed to write columnar page (%d)\n",ret);
+			raw_out_columnar.close();
+		}
+	}
+	
 	if (raw_out_csv) {
 		char time_str[20];
-		double x,y,z;
 		double base = RTC_CLOCK_BASE;
 		double top = RTC_SCALAR * 1000;
 		double factor = top / base;
@@ -540,62 +762,65 @@ bool rawData::evSamplesCallback() {
 		if (!header_output) {
 			outputHeader();
 		}
-		// needs to be %ld
-		fprintf(raw_out_csv,"%ld",millisecs_since_epoc); 
-		if (!raw_sample_list.empty()) {
-			sample s = raw_sample_list.front();
-			s.giveGValues(x, y, z);
-			raw_sample_list.pop_front();
-			fprintf(raw_out_csv,",%.3f,%.3f,%.3f",x,y,z);
-			fprintf(raw_out_csv,",%.02f",
-				convTempBinToCelsius(temperature_raw));
+		csvBuffer& out = csv_out;
+		out.addUint(millisecs_since_epoc);
+		if (!page_samples.empty()) {
+			// raw values are big-endian x,y,z
+			const uint8_t* raw = page_samples[0].sample_raw;
+			out.add(",");
+			out.addGValue((int16_t) ((raw[0] << 8) | raw[1]), g_divisor);
+			out.add(",");
+			out.addGValue((int16_t) ((raw[2] << 8) | raw[3]), g_divisor);
+			out.add(",");
+			out.addGValue((int16_t) ((raw[4] << 8) | raw[5]), g_divisor);
+			out.add(",");
+			out.addFixed(tempBinToThirtySeconds(temperature_raw), 32, 2);
 			if (status_raw != OK_USED_STATUS) {
 				if (!(status_raw & COLLECT_OK_MASK)) {
 					if (status_raw & PAGE_OK_MASK) {
-						fprintf(raw_out_csv,
-							",Potential data loss just before this time\n");
+						out.add(",Potential data loss just before this time\n");
 					} else {
-						fprintf(raw_out_csv,
-							",Definate data loss occurred in this section\n");
+						out.add(",Definate data loss occurred in this section\n");
 					}
 				} else {
-					fprintf(raw_out_csv,",");
+					out.add(",");
 					if (!crc_ok)
-						fprintf(raw_out_csv,"CRC Error & ");
-					fprintf(raw_out_csv,"Unknown status 0x%02x", status_raw);
+						out.add("CRC Error & ");
+					out.addf("Unknown status 0x%02x", status_raw);
 				}
 			} else if (!crc_ok) {
 				time_t err_time =
 					convTicksToTime(start_time, current_tick);
-				fprintf(raw_out_csv, ",CRC Error: at this time (%ld)",
-					err_time);
+				out.addf(",CRC Error: at this time (%ld)", err_time);
 				if (!getLocalTime(time_str, 20, err_time)) {
-					fprintf(raw_out_csv,"(local: %s)",time_str);
+					out.addf("(local: %s)",time_str);
 				}
-				fprintf(raw_out_csv,"\n");
+				out.add("\n");
 			}
-			fprintf(raw_out_csv,"\n");
-			while (!raw_sample_list.empty()) {
-				s = raw_sample_list.front();
-				s.giveGValues(x, y, z);
-				raw_sample_list.pop_front();
-				fprintf(raw_out_csv,",%.3f,%.3f,%.3f\n",x,y,z);
+			out.add("\n");
+			for (size_t idx = 1; idx < page_samples.size(); idx++) {
+				raw = page_samples[idx].sample_raw;
+				out.add(",");
+				out.addGValue((int16_t) ((raw[0] << 8) | raw[1]), g_divisor);
+				out.add(",");
+				out.addGValue((int16_t) ((raw[2] << 8) | raw[3]), g_divisor);
+				out.add(",");
+				out.addGValue((int16_t) ((raw[4] << 8) | raw[5]), g_divisor);
+				out.add("\n");
 			}
 		} else {
 			if (crc_ok) {
-				fprintf(raw_out_csv,",,,,,Error: no samples?\n");
+				out.add(",,,,,Error: no samples?\n");
 			} else {
 				time_t err_time =
 					convTicksToTime(start_time, current_tick);
-				fprintf(raw_out_csv, ",,,,,CRC Error: at this time (%ld)",
-					err_time);
+				out.addf(",,,,,CRC Error: at this time (%ld)", err_time);
 				if (!getLocalTime(time_str, 20, err_time)) {
-					fprintf(raw_out_csv,"(local: %s)",time_str);
+					out.addf("(local: %s)",time_str);
 				}
-				fprintf(raw_out_csv,"\n");
+				out.add("\n");
 			}
 		}
-		fflush(raw_out_csv);
 	}
 	if (raw_out_bl && additional_present) {
 		double bl_fl = convADCToVoltage(battery_raw);
@@ -710,6 +935,7 @@ int rawData::setCsvFilename(const char* aFilename) {
     	printf("csv filename:\t%s\n",filename.c_str());
 		retval = BB_SUCCESS;
 		raw_out_csv = openUniqueFile(filename.c_str());
+		csv_out.setFile(raw_out_csv);
 		if (!raw_out_csv) {
 			printf("Failed to open file for write\n");
 			retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
@@ -718,6 +944,44 @@ int rawData::setCsvFilename(const char* aFilename) {
 	return retval;
 }
 
+int rawData::setColumnarFilename(const char* aFilename) {
+	int retval = -E_BB_BAD_PARAM;
+	if (aFilename) {
+		string filename = aFilename;
+		size_t ext_len = strlen(COLUMNAR_EXT);
+		if ((filename.size() < ext_len) || filename.compare(
+				filename.size() - ext_len, ext_len, COLUMNAR_EXT))
+			filename += COLUMNAR_EXT;
+    	printf("bin filename:\t%s\n",filename.c_str());
+		filename = uniqueFilename(filename.c_str());
+		retval = raw_out_columnar.open(filename.c_str());
+		if (retval != BB_SUCCESS) {
+			printf("Failed to open file for write\n");
+		}
+	}
+	return retval;
+}
+
+int rawData::setStatsFilename(const char* aFilename, uint32_t epoch_secs) {
+	int retval = -E_BB_BAD_PARAM;
+	if (aFilename && !raw_stats) {
+		string filename = aFilename;
+		if (filename.rfind(CSV_EXT) == string::npos)
+			filename += CSV_EXT;
+    	printf("stats filename:\t%s\n",filename.c_str());
+		retval = BB_SUCCESS;
+		FILE* fd_ptr = openUniqueFile(filename.c_str());
+		if (!fd_ptr) {
+			printf("Failed to open file for write\n");
+			retval = -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+		} else {
+			raw_out_stats = new epochCsv(fd_ptr);
+			raw_stats = new EpochStats(raw_out_stats, epoch_secs);
+		}
+	}
+	return retval;
+}
+
 // ----
 
 void textError(int errorCode) {
@@ -725,12 +989,86 @@ void textError(int errorCode) {
 	printf("%s\n",errStr.c_str());
 }
 
+// the index is saved next to the raw file as <raw filename>.idx
+static void saveRawIndex(const RawIndex& index, const string& raw_filename) {
+	string filename = raw_filename + INDEX_EXT;
+	printf("index filename:\t%s\n",filename.c_str());
+	int ret = index.save(filename.c_str());
+	if (ret != BB_SUCCESS) {
+		printf("Failed to save index (%d)\n",ret);
+	}
+}
+
+// ----
+
+static void printProfile(const vector<profile_stats>& stats,
+	uint32_t core_clock_hz) {
+	const char* names[PROFILE_NUM_PATHS] = {"accel intr", "program page",
+		"erase block", "read page"};
+	double us_per_cycle = core_clock_hz ? 1000000.0 / core_clock_hz : 0;
+	
+	printf("core clock %u Hz (paths timed while collecting run at the "
+		"collect clock)\n", core_clock_hz);
+	for (size_t path = 0; path < stats.size(); path++) {
+		const profile_stats& st = stats[path];
+		printf("%-12s count %u", names[path], st.count);
+		if (st.count) {
+			double mean = (double) st.total_cycles / st.count;
+			printf("  cycles min %u mean %.1f max %u", st.min_cycles, mean,
+				st.max_cycles);
+			if (us_per_cycle)
+				printf("  (us %.1f/%.1f/%.1f)", st.min_cycles * us_per_cycle,
+					mean * us_per_cycle, st.max_cycles * us_per_cycle);
+		}
+		printf("\n\t");
+		for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+			int bits = PROFILE_FIRST_BUCKET_BITS + bucket * PROFILE_BUCKET_BITS;
+			if (bucket < PROFILE_BUCKETS - 1)
+				printf("<%u:%u ", 1u << bits, st.buckets[bucket]);
+			else
+				printf(">=%u:%u\n", 1u << (bits - PROFILE_BUCKET_BITS),
+					st.buckets[bucket]);
+		}
+	}
+}
+
+struct fleetProgress : public MFleetObserver {
+	void evFleetProgress(const vector<band_progress>& bands,
+		int pages_received, int pages_expected);
+	void evBandFinished(const band_progress& band);
+};
+
+void fleetProgress::evFleetProgress(const vector<band_progress>& bands,
+	int pages_received, int pages_expected) {
+	int active = 0;
+	for (size_t idx = 0; idx < bands.size(); idx++) {
+		if (!bands[idx].finished)
+			active++;
+	}
+	printf("\r%d of %d pages, %d of %d bands active   ",pages_received,
+		pages_expected,active,(int) bands.size());
+	fflush(stdout);
+}
+
+void fleetProgress::evBandFinished(const band_progress& band) {
+	if (band.result < 0) {
+		printf("\n%s failed (%d)\n",band.serial_num.c_str(),band.result);
+		textError(band.result);
+	} else {
+		printf("\n%s done, %d pages to %s\n",band.serial_num.c_str(),
+			band.pages_received,band.raw_filename.c_str());
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	signal(SIGINT, quitProc);
 	
     int collection_time_in_mins = 0;
     int standby_before_collection_time_mins = 0;
+	int async_transfers = 0;
+	bool stream_download = false;
+	bool debug_enabled = false;
 	rawData raw_samples;
 
     printf("MRC\n");
@@ -752,6 +1090,7 @@ int main(int argc, char *argv[])
 				return 0;
 			} else if (!strcmp("dbg",argv[arg_idx])) {
 				bandif.enableDebug();
+				debug_enabled = true;
 			} else if (!strcmp("-rbl",argv[arg_idx])) {
 				arg_idx++;
 				if (arg_idx < argc) {
@@ -802,8 +1141,91 @@ int main(int argc, char *argv[])
 					printf("Error -rcsv missing filename\n");
 					return -E_BB_BAD_PARAM;
 				} 
+			} else if (!strcmp("-rstats",argv[arg_idx])) {
+				arg_idx++;
+				if (arg_idx < argc) {
+					const char* filename = argv[arg_idx];
+					uint32_t epoch_secs = 60;
+					if (arg_idx + 1 < argc && isdigit(argv[arg_idx + 1][0]))
+						epoch_secs = atoi(argv[++arg_idx]);
+					int ret = raw_samples.setStatsFilename(filename, epoch_secs);
+					if (ret < 0) {
+						printf("Failed to set rstats %s filename (%d)\n",
+							filename,ret);
+					}
+				} else {
+					printf("Error -rstats missing filename\n");
+					return -E_BB_BAD_PARAM;
+				} 
+			} else if (!strcmp("-rbin",argv[arg_idx])) {
+				arg_idx++;
+				if (arg_idx < argc) {
+					int ret = raw_samples.setColumnarFilename(argv[arg_idx]);
+					if (ret < 0) {
+						printf("Failed to set rbin %s filename (%d)\n",
+							argv[arg_idx],ret);
+					}
+				} else {
+					printf("Error -rbin missing filename\n");
+					return -E_BB_BAD_PARAM;
+				} 
 			} else if (!strcmp("-rsum",argv[arg_idx])) {
 				raw_samples.summary_output = true;
+			} else if (!strcmp("-async",argv[arg_idx])) {
+				arg_idx++;
+				if (arg_idx < argc) {
+					int ret = bandif.setAsyncTransfers(atoi(argv[arg_idx]));
+					if (ret != BB_SUCCESS) {
+						printf("Failed to set async transfers %s (%d)\n",
+							argv[arg_idx],ret);
+						return ret;
+					}
+					async_transfers = atoi(argv[arg_idx]);
+				} else {
+					printf("Error -async missing number of transfers\n");
+					return -E_BB_BAD_PARAM;
+				}
+			} else if (!strcmp("-decode",argv[arg_idx])) {
+				arg_idx++;
+				if (arg_idx < argc) {
+					int ret = bandif.setDecodeThreads(atoi(argv[arg_idx]));
+					if (ret != BB_SUCCESS) {
+						printf("Failed to set decode threads %s (%d)\n",
+							argv[arg_idx],ret);
+						return ret;
+					}
+				} else {
+					printf("Error -decode missing number of threads\n");
+					return -E_BB_BAD_PARAM;
+				}
+			} else if (!strcmp("-stream",argv[arg_idx])) {
+				bandif.setStreamDownload(1);
+				stream_download = true;
+			} else if (!strcmp("-fleet",argv[arg_idx])) {
+				const char* out_dir = NULL;
+				if (arg_idx + 1 < argc && argv[arg_idx + 1][0] != '-')
+					out_dir = argv[++arg_idx];
+				BandFleet fleet;
+				if (debug_enabled)
+					fleet.enableDebug();
+				int ret = fleet.connectAll();
+				if (!fleet.bandCount()) {
+					printf("Failed to connect to the bands (%d)\n", ret);
+					textError(ret);
+					return ret;
+				}
+				printf("Downloading %d bands\n",fleet.bandCount());
+				ret = fleet.setAsyncTransfers(async_transfers);
+				if (ret != BB_SUCCESS) {
+					printf("Failed to set async transfers (%d)\n", ret);
+					return ret;
+				}
+				fleet.setStreamDownload(stream_download);
+				fleetProgress progress;
+				ret = fleet.download(out_dir, &progress);
+				printf("\n%d of %d bands downloaded\n",ret,fleet.bandCount());
+				fleet.cleanup();
+				return 0;
 			} else if (!strcmp("-fraw",argv[arg_idx])) {
 				FILE* fd_ptr = NULL;
 				arg_idx++;
@@ -830,6 +1252,59 @@ int main(int argc, char *argv[])
 				if (fd_ptr)
 					fclose(fd_ptr);
 				return 0;
+			} else if (!strcmp("-fwin",argv[arg_idx])) {
+				if (arg_idx + 3 >= argc) {
+					printf("fwin needs a filename, from and to times\n");
+					return -E_BB_BAD_PARAM;
+				}
+				const char* filename = argv[arg_idx + 1];
+				time_t from_time = (time_t) atol(argv[arg_idx + 2]);
+				time_t to_time = (time_t) atol(argv[arg_idx + 3]);
+				arg_idx += 3;
+				
+				RawIndex raw_index;
+				string index_filename = filename;
+				index_filename += INDEX_EXT;
+				if (raw_index.load(index_filename.c_str()) != BB_SUCCESS) {
+					printf("No index, scanning %s\n",filename);
+					int ret = raw_index.build(filename);
+					if (ret != BB_SUCCESS) {
+						printf("Failed to index %s (%d)\n",filename,ret);
+						return ret;
+					}
+				}
+				// the config page is unlikely to be in the window
+				raw_samples.start_time = raw_index.collect_start_time;
+				
+				int ret = bandif.setRawDataCallbackPtr(&raw_samples);
+				if (ret < 0) {
+					printf("Failed to set data callback (%d)\n", ret);
+				} else {
+					int total_rec = bandif.readRawWindow(filename, raw_index,
+						from_time, to_time);
+					if (total_rec < 0) {
+						printf("Read failure (%d)\n",total_rec);
+					}
+					printf("\n");
+				}
+				return 0;
+			} else if (!strcmp("-fmap",argv[arg_idx])) {
+				arg_idx++;
+				if (arg_idx >= argc) {
+					printf("No filename specified for fmap\n");
+					return -E_BB_BAD_PARAM;
+				}
+				int ret = bandif.setRawDataCallbackPtr(&raw_samples);
+				if (ret < 0) {
+					printf("Failed to set data callback (%d)\n", ret);
+				} else {
+					int total_rec = bandif.readRawFromMappedFile(argv[arg_idx]);
+					if (total_rec < 0) {
+						printf("Read failure (%d)\n",total_rec);
+					}
+					printf("\n");
+				}
+				return 0;
 			}
 			arg_idx++;
 		}
@@ -895,9 +1370,26 @@ int main(int argc, char *argv[])
 			} else if (!strcmp("-rcsv",argv[arg_idx])) {
 				arg_idx += 2;
 				continue;
+			} else if (!strcmp("-rbin",argv[arg_idx])) {
+				arg_idx += 2;
+				continue;
+			} else if (!strcmp("-rstats",argv[arg_idx])) {
+				arg_idx += 2;
+				if (arg_idx < argc && isdigit(argv[arg_idx][0]))
+					arg_idx++;
+				continue;
 			} else if (!strcmp("-rsum",argv[arg_idx])) {
 				arg_idx++;
 				continue;
+			} else if (!strcmp("-async",argv[arg_idx])) {
+				arg_idx += 2;
+				continue;
+			} else if (!strcmp("-decode",argv[arg_idx])) {
+				arg_idx += 2;
+				continue;
+			} else if (!strcmp("-stream",argv[arg_idx])) {
+				arg_idx++;
+				continue;
 			} else if (!strcmp("-p",argv[arg_idx])) {
 				arg_idx++;
 				if (arg_idx < argc) {
@@ -1035,13 +1527,17 @@ int main(int argc, char *argv[])
 				}
 			} else if (!strcmp("-raw",argv[arg_idx])) {
 				FILE* fd_ptr = NULL;
+				string filename;
+				RawIndex raw_index;
 				arg_idx++;
 				if (arg_idx < argc) {
-					string filename = argv[arg_idx];
+					filename = argv[arg_idx];
 					if (filename.rfind(RAW_EXT) == string::npos)
 						filename += RAW_EXT;
     				printf("raw filename:\t%s\n",filename.c_str());
-					fd_ptr = openUniqueFile(filename.c_str());
+					filename = uniqueFilename(filename.c_str());
+					fd_ptr = fopen(filename.c_str(),"w");
+					bandif.setRawIndex(&raw_index);
 				}
 				int ret = bandif.setRawDataCallbackPtr(&raw_samples);
 				if (ret < 0) {
@@ -1055,12 +1551,80 @@ int main(int argc, char *argv[])
 					} else {
 						time_t current_time = time(NULL);
 						bandif.setFirstDownloadTime(current_time);
+						if (fd_ptr)
+							saveRawIndex(raw_index, filename);
 					}
 					printf("\n");
 				}
 				if (fd_ptr)
 					fclose(fd_ptr);
 				return 0;
+			} else if (!strcmp("-resume",argv[arg_idx])) {
+				// Same as -raw but appends to an existing raw file, the band
+				// only sends the pages after those already in the file
+				arg_idx++;
+				if (arg_idx >= argc) {
+					printf("Missing raw filename\n");
+					bandif.cleanup();
+					return -E_BB_BAD_PARAM;
+				}
+				string filename = argv[arg_idx];
+				printf("raw filename:\t%s\n",filename.c_str());
+				FILE* fd_ptr = fopen(filename.c_str(),"r+b");
+				if (!fd_ptr) {
+					printf("Failed to open %s\n",filename.c_str());
+					bandif.cleanup();
+					return -E_BB_FAILED_TO_OPEN_FILE_FOR_READ;
+				}
+				
+				// a partial page & the trailing "Done" are cut off, so nothing
+				// is left beyond what the band sends
+				fseek(fd_ptr, 0, SEEK_END);
+				uint32_t pages_held = (uint32_t) (ftell(fd_ptr) /
+					max_transfer_page);
+				long resume_at = (long) pages_held * max_transfer_page;
+#ifdef _WIN32
+				int trunc_ret = _chsize_s(_fileno(fd_ptr), resume_at);
+#else
+				int trunc_ret = ftruncate(fileno(fd_ptr), resume_at);
+#endif
+				if (trunc_ret) {
+					printf("Failed to truncate %s\n",filename.c_str());
+					fclose(fd_ptr);
+					bandif.cleanup();
+					return -E_BB_FAILED_TO_OPEN_FILE_FOR_WRITE;
+				}
+				fseek(fd_ptr, resume_at, SEEK_SET);
+				printf("pages held:\t%u\n",pages_held);
+				
+				RawIndex raw_index;
+				int ret = raw_index.build(filename.c_str());
+				if (ret != BB_SUCCESS) {
+					printf("Failed to index %s (%d)\n",filename.c_str(),ret);
+					fclose(fd_ptr);
+					bandif.cleanup();
+					return ret;
+				}
+				bandif.setRawIndex(&raw_index);
+				ret = bandif.setRawDataCallbackPtr(&raw_samples);
+				if (ret < 0) {
+					printf("Failed to set data callback (%d)\n", ret);
+					textError(ret);
+				} else {
+					raw_samples.outputHeader();
+					int total_rec = bandif.readRawFromBand(fd_ptr, pages_held);
+					if (total_rec < 0) {
+						printf("Read failure (%d)\n",total_rec);
+						textError(total_rec);
+					} else {
+						time_t current_time = time(NULL);
+						bandif.setFirstDownloadTime(current_time);
+						saveRawIndex(raw_index, filename);
+					}
+					printf("\n");
+				}
+				fclose(fd_ptr);
+				return 0;
 			} else if (!strcmp("-uall",argv[arg_idx])) {
 				// Creates a common filename from band, subject & test details
 				// and uses that to name the all the derived component filenames
@@ -1105,7 +1669,11 @@ int main(int argc, char *argv[])
     			filename += bandif.getCentreId();
    				filename += RAW_EXT;
     			printf("raw filename:\t%s\n",filename.c_str());
-				FILE* fd_ptr = openUniqueFile(filename.c_str());
+				filename = uniqueFilename(filename.c_str());
+				FILE* fd_ptr = fopen(filename.c_str(),"w");
+				RawIndex raw_index;
+				if (fd_ptr)
+					bandif.setRawIndex(&raw_index);
 				int ret = bandif.setRawDataCallbackPtr(&raw_samples);
 				if (ret < 0) {
 					printf("Failed to set data callback (%d)\n", ret);
@@ -1117,6 +1685,8 @@ int main(int argc, char *argv[])
 					} else {
 						time_t current_time = time(NULL);
 						bandif.setFirstDownloadTime(current_time);
+						if (fd_ptr)
+							saveRawIndex(raw_index, filename);
 					}
 					printf("\n");
 				}
@@ -1202,6 +1772,25 @@ int main(int argc, char *argv[])
 							printf("Failed to retrieve the battery level\n");
     					return 0;
 					}
+					if (singleParam(argv, arg_idx, argc, "-gsum")) {
+						BioBandIf::band_summary summary;
+						int ret = bandif.getBandSummary(summary);
+						if (ret) {
+							printf("Failed to retrieve the band summary\n");
+							return ret;
+						}
+						printf("device id: %s\n",summary.band_id.c_str());
+						printf("user id: %s\n",summary.subject_id.c_str());
+						printf("test id: %s\n",summary.test_id.c_str());
+						printf("centre id: %s\n",summary.centre_id.c_str());
+						printf("battery level: %.02fV\n",
+							convADCToVoltage(summary.battery_level));
+						printf("page count: %d\n",summary.page_count);
+						printf("capture: %s\n", !summary.capture_exists ?
+							"none" : (summary.capture_complete ? "complete" :
+							"incomplete"));
+						return 0;
+					}
 					if (singleParam(argv, arg_idx, argc, "-gi")) {
 						printf("Retrieving the band id\n");
     					string bert = bandif.getBandId();
@@ -1359,6 +1948,7 @@ int main(int argc, char *argv[])
 					if (!strcmp("-sac",argv[arg_idx])) {
 						accel_data_rate rate = CWA_50HZ;
 						accel_g_scale scale = CWA_8G;
+						bool compress = false;
 						int err = 0;
 						arg_idx++;
 						if (arg_idx < argc) {
@@ -1401,6 +1991,11 @@ int main(int argc, char *argv[])
 									err = 1;
 								}
 							}
+							if (!err && (arg_idx + 1 < argc) &&
+									!strcmp("c",argv[arg_idx + 1])) {
+								arg_idx++;
+								compress = true;
+							}
 						} else {
 							printf("Expecting rate value after -sac\n");
 							err = 1;
@@ -1409,7 +2004,8 @@ int main(int argc, char *argv[])
 							printf("Error:\nValid rates = 50,100,400,1000\n"
 							 "Valid scales = 2,4,8\n");
 						} else {
-							int ret = bandif.setAccelConfig(rate, scale);
+							int ret = bandif.setAccelConfig(rate, scale,
+								compress);
 							if (ret) {
 								printf("Error: Failed to set accel config"
 									" (ret %d)\n", ret);
@@ -1649,6 +2245,20 @@ int main(int argc, char *argv[])
 						}
     					return ret;
 					}
+					if (singleParam(argv, arg_idx, argc, "-prof") ||
+							singleParam(argv, arg_idx, argc, "-profc")) {
+						vector<profile_stats> stats;
+						uint32_t core_clock_hz;
+						int ret = bandif.getProfile(stats, core_clock_hz,
+							!strcmp("-profc",argv[arg_idx]));
+						if (ret) {
+							printf("Failed (ret %d)\n",ret);
+							textError(ret);
+						} else {
+							printProfile(stats, core_clock_hz);
+						}
+    					return ret;
+					}
 					if (singleParam(argv, arg_idx, argc, "-eg")) {
 						// example use of band_if class
 						// TODO missing ret checks after each call